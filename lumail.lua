@@ -181,6 +181,9 @@ index_limit( "all" )
 --   $SUBJECT
 --   $TO
 --
+-- Any of these may be followed by a width-specification, such as
+-- "$FROM{min:20 max:20}", to pad or truncate the value to a fixed
+-- column.  Widths ending in "%" are relative to the screen-width.
 --
 index_format( "[$FLAGS] $DAY/$MONTH/$YEAR $FROM - $SUBJECT" )
 
@@ -934,13 +937,7 @@ end
 -- Mark all messages in the current folder as read.
 --
 function mark_all_read()
-   count = count_messages()
-   i = 0
-   while( i < count ) do
-      jump_index_to( i )
-      mark_read()
-      i = i + 1
-   end
+   mark_messages( "S" )
 end
 
 
@@ -1232,6 +1229,11 @@ end
 --
 history_file( os.getenv( "HOME" ) .. "/.lumail.history" )
 
+--
+-- Cache the headers of messages, so large folders open quickly.
+--
+header_cache( os.getenv( "HOME" ) .. "/.lumail.cache" )
+
 ---
 --
 --   Further primitives which are not included here are documented
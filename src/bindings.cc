@@ -34,15 +34,19 @@
 #include "bindings.h"
 #include "debug.h"
 #include "file.h"
+#include "flag_queue.h"
 #include "global.h"
+#include "header_cache.h"
 #include "input.h"
 #include "lang.h"
 #include "lua.h"
 #include "maildir.h"
 #include "message.h"
+#include "regexp_cache.h"
 #include "screen.h"
 #include "utfstring.h"
 #include "variables.h"
+#include "worker_pool.h"
 
 
 
@@ -79,7 +83,7 @@ std::shared_ptr<CMessage> get_message_for_operation( const char *path )
      * Get all messages from the currently selected messages.
      */
     CGlobal *global = CGlobal::Instance();
-    CMessageList *messages = global->get_messages();
+    CMessageView *messages = global->get_messages();
 
     /**
      * The number of items we've found, and the currently selected one.
@@ -119,6 +123,16 @@ int abort(lua_State * L)
      */
     endwin();
 
+    /**
+     * Wait for any background job which is running.
+     */
+    CWorkerPool::Instance()->stop();
+
+    /**
+     * Write any flag changes we've made.
+     */
+    CFlagQueue::Instance()->flush();
+
     /**
      * Shutdown GMime.
      */
@@ -152,6 +166,15 @@ int alert(lua_State * L)
     if (str == NULL)
         return luaL_error(L, "Missing argument to alert(..)");
 
+    /**
+     * Without a terminal there is nobody to confirm, so just show it.
+     */
+    if ( CScreen::headless() )
+    {
+        std::cout << str << std::endl;
+        return 0;
+    }
+
     /**
      * Cleanup
      */
@@ -203,6 +226,10 @@ int alert(lua_State * L)
     curs_set(0);
     timeout(1000);
 
+    /**
+     * Ensure the area beneath the window is redrawn.
+     */
+    CScreen::clear_main();
     CScreen::clear_status();
     return 0;
 }
@@ -275,7 +302,8 @@ int clear(lua_State * L)
      * Ensure we refresh the display after clearing the screen.
      */
     CScreen::clear_main();
-    refresh();
+    if ( ! CScreen::headless() )
+        refresh();
 
     return 0;
 }
@@ -296,9 +324,7 @@ int exec(lua_State * L)
     /**
      * Save the current state of the TTY
      */
-    refresh();
-    def_prog_mode();
-    endwin();
+    CScreen::suspend();
 
     /* Run the command */
     int result __attribute__((unused));
@@ -308,8 +334,7 @@ int exec(lua_State * L)
     /**
      * Reset + redraw
      */
-    reset_prog_mode();
-    refresh();
+    CScreen::resume();
     return 0;
 }
 
@@ -328,13 +353,29 @@ int exit(lua_State * L)
     endwin();
 
     /**
-     * Shutdown GMime.
+     * Wait for any background job which is running.
      */
-    g_mime_shutdown();
+    CWorkerPool::Instance()->stop();
 
     CLua *lua = CLua::Instance();
     lua->execute("on_exit()");
 
+    /**
+     * Write any flag changes we've made, including those of on_exit().
+     */
+    CFlagQueue::Instance()->flush();
+
+    /**
+     * Persist any parsed message-headers.
+     */
+    CHeaderCache *cache = CHeaderCache::Instance();
+    cache->sync();
+
+    /**
+     * Shutdown GMime, now that no message will be renamed or closed.
+     */
+    g_mime_shutdown();
+
     exit(0);
     return 0;
 }
@@ -663,6 +704,15 @@ int msg(lua_State * L)
     if (strlen(buf) < 1 )
         return luaL_error(L, "Missing argument to msg(..)");
 
+    /**
+     * Without a terminal messages go to STDOUT.
+     */
+    if ( CScreen::headless() )
+    {
+        std::cout << buf << std::endl;
+        return 0;
+    }
+
     /**
      * Are we evaluating?
      */
@@ -688,6 +738,31 @@ int msg(lua_State * L)
 }
 
 
+/**
+ * Return a table of statistics about the compiled-regexp cache.
+ */
+int regexp_cache_stats(lua_State * L)
+{
+    CRegexpCache *cache = CRegexpCache::Instance();
+
+    lua_newtable(L);
+
+    lua_pushstring(L, "hits" );
+    lua_pushinteger(L, cache->hits() );
+    lua_settable(L,-3);
+
+    lua_pushstring(L, "compiles" );
+    lua_pushinteger(L, cache->compiles() );
+    lua_settable(L,-3);
+
+    lua_pushstring(L, "size" );
+    lua_pushinteger(L, cache->size() );
+    lua_settable(L,-3);
+
+    return 1;
+}
+
+
 
 /**
  * Get the screen width.
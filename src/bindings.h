@@ -42,6 +42,11 @@ class CMessage;
  */
 std::shared_ptr<CMessage> get_message_for_operation( const char *path );
 
+/**
+ * Call a hook, with the given path.
+ */
+void call_message_hook( const char *hook, const char *filename );
+
 
 
 /**
@@ -51,6 +56,15 @@ std::shared_ptr<CMessage> get_message_for_operation( const char *path );
  **/
 
 
+/**
+ * bindings_bulk.cc:
+ */
+int copy_messages(lua_State * L);
+int delete_messages(lua_State * L);
+int mark_messages(lua_State * L);
+int move_messages(lua_State * L);
+int unmark_messages(lua_State * L);
+
 /**
  * bindings_file.cc:
  */
@@ -106,6 +120,7 @@ int jump_message_to(lua_State *L);
 int scroll_message_to(lua_State *L);
 int scroll_message_up(lua_State *L);
 int send_email(lua_State *L);
+int sync_flags(lua_State * L);
 int write_message_to_disk(lua_State *L);
 
 bool push_message(lua_State *L, std::shared_ptr<CMessage> message);
@@ -186,6 +201,7 @@ int lua_dump_stack(lua_State *L);
 int message_offset(lua_State * L);
 int mime_type(lua_State *L);
 int msg(lua_State * L);
+int regexp_cache_stats(lua_State * L);
 int screen_height(lua_State * L);
 int screen_width(lua_State * L);
 int show_help(lua_State * L);
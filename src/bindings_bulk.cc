@@ -0,0 +1,251 @@
+/**
+ * bindings_bulk.cc - Bindings for Lua primitives which operate upon sets of messages.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ *
+ */
+
+
+#include <ctype.h>
+#include <string>
+
+#include "bindings.h"
+#include "debug.h"
+#include "file.h"
+#include "global.h"
+#include "maildir.h"
+#include "message.h"
+
+
+
+/**
+ * Find the messages a bulk operation applies to, given by the argument
+ * at the given index:
+ *
+ *   nil    - The messages in the index.
+ *   string - The messages of the selected folders which match the
+ *            filter, which has the same syntax as `index_limit`.
+ *   table  - The message objects it contains.
+ */
+static CMessageList message_set( lua_State *L, int index )
+{
+    if ( lua_istable( L, index ) )
+        return( check_message_list( L, index ) );
+
+    CGlobal *global = CGlobal::Instance();
+    CMessageList result;
+
+    if ( lua_isstring( L, index ) )
+    {
+        std::string filter = lua_tostring( L, index );
+
+        CMessageList *all = global->get_all_messages();
+        if ( all != NULL )
+        {
+            for (std::shared_ptr<CMessage> message : *all)
+            {
+                if ( message->matches_filter( &filter ) )
+                    result.push_back( message );
+            }
+        }
+        return( result );
+    }
+
+    CMessageView *messages = global->get_messages();
+    if ( messages != NULL )
+    {
+        for( size_t i = 0; i < messages->size(); i++ )
+            result.push_back( messages->at( i ) );
+    }
+    return( result );
+}
+
+
+/**
+ * The messages have moved, or gone away, so rescan the folders - once.
+ */
+static void refresh_messages()
+{
+    CGlobal *global = CGlobal::Instance();
+    global->update_messages();
+    global->set_message_offset(0);
+}
+
+
+/**
+ * Copy a set of messages to the given maildir.
+ */
+int copy_messages(lua_State * L)
+{
+    const char *dest = luaL_checkstring(L, 1);
+
+    if ( ! CMaildir::is_maildir( dest ) )
+        return luaL_error(L, "The specified destination is not a Maildir" );
+
+    CMessageList messages = message_set( L, 2 );
+    int count = 0;
+
+    for (std::shared_ptr<CMessage> message : messages)
+    {
+        if ( message->copy( dest ) )
+            count += 1;
+    }
+
+    DEBUG_LOG( "copy_messages - copied " + std::to_string( count ) );
+
+    /**
+     * The destination might be one of the selected folders.
+     */
+    if ( count > 0 )
+        refresh_messages();
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+
+/**
+ * Delete a set of messages.
+ */
+int delete_messages(lua_State * L)
+{
+    CMessageList messages = message_set( L, 1 );
+    int count = 0;
+
+    for (std::shared_ptr<CMessage> message : messages)
+    {
+        /**
+         * Call the on_delete_message hook - before we remove the file
+         * from disk.
+         */
+        call_message_hook( "on_delete_message", message->path().c_str() );
+
+        message->remove();
+        count += 1;
+    }
+
+    DEBUG_LOG( "delete_messages - deleted " + std::to_string( count ) );
+
+    if ( count > 0 )
+        refresh_messages();
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+
+/**
+ * Add flags to a set of messages.
+ *
+ * Adding "S" marks a message read, moving it from new/ to cur/ if it is
+ * there.
+ */
+int mark_messages(lua_State * L)
+{
+    std::string flags = luaL_checkstring(L, 1);
+
+    CMessageList messages = message_set( L, 2 );
+    int count = 0;
+
+    for (std::shared_ptr<CMessage> message : messages)
+    {
+        bool changed = false;
+
+        for (char flag : flags)
+        {
+            flag = toupper( flag );
+
+            if ( flag == 'S' )
+            {
+                if ( message->is_new() )
+                    changed = message->mark_read() || changed;
+            }
+            else
+                changed = message->add_flag( flag ) || changed;
+        }
+
+        if ( changed )
+            count += 1;
+    }
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+
+/**
+ * Move a set of messages to the given maildir.
+ *
+ * Each message keeps its name, and is renamed into place unless the
+ * maildir is upon a different filesystem.
+ */
+int move_messages(lua_State * L)
+{
+    const char *dest = luaL_checkstring(L, 1);
+
+    if ( ! CMaildir::is_maildir( dest ) )
+        return luaL_error(L, "The specified destination is not a Maildir" );
+
+    CMessageList messages = message_set( L, 2 );
+    CDirectoryHandles dirs;
+    int count = 0;
+
+    for (std::shared_ptr<CMessage> message : messages)
+    {
+        if ( message->move_to( dest, dirs ) )
+            count += 1;
+    }
+
+    DEBUG_LOG( "move_messages - moved " + std::to_string( count ) );
+
+    if ( count > 0 )
+        refresh_messages();
+
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+
+/**
+ * Remove flags from a set of messages.
+ */
+int unmark_messages(lua_State * L)
+{
+    std::string flags = luaL_checkstring(L, 1);
+
+    CMessageList messages = message_set( L, 2 );
+    int count = 0;
+
+    for (std::shared_ptr<CMessage> message : messages)
+    {
+        bool changed = false;
+
+        for (char flag : flags)
+        {
+            flag = toupper( flag );
+
+            if ( flag == 'S' )
+                changed = message->mark_unread() || changed;
+            else
+                changed = message->remove_flag( flag ) || changed;
+        }
+
+        if ( changed )
+            count += 1;
+    }
+
+    lua_pushinteger(L, count);
+    return 1;
+}
@@ -112,7 +112,7 @@ int scroll_index_to(lua_State * L)
      * get the current messages
      */
     CGlobal *global = CGlobal::Instance();
-    CMessageList *messages = global->get_messages();
+    CMessageView *messages = global->get_messages();
 
     /**
      * If we have no messages we're not scrolling anywhere.
@@ -29,11 +29,15 @@
 #include "bindings.h"
 #include "debug.h"
 #include "file.h"
+#include "flag_queue.h"
 #include "global.h"
 #include "lang.h"
 #include "lua.h"
 #include "maildir.h"
 #include "message.h"
+#include "rendered_body.h"
+#include "regexp_cache.h"
+#include "screen.h"
 #include "utfstring.h"
 #include "variables.h"
 
@@ -471,27 +475,23 @@ int body(lua_State * L)
      *
      * If that fails then get the body via parsing and filtering.
      */
-    std::vector<UTFString> body;
     CLua *lua = CLua::Instance();
-    body = lua->on_get_body();
+    std::shared_ptr<CRenderedBody> body = lua->on_get_body();
 
-    if ( body.empty() )
-        body = msg->body();
+    if ( ! body )
+        body = msg->rendered_body();
 
 
-    if ( body.empty() )
+    if ( body->count() == 0 )
         lua_pushnil(L);
     else
     {
         /**
-         * Convert the vector of arrays into a string.
+         * Every line is terminated by a newline.
          */
-        UTFString res;
-        for (UTFString bodyelement : body)
-        {
-            res += bodyelement;
+        std::string res = body->text();
+        if ( res[res.size()-1] != '\n' )
             res += "\n";
-        }
 
         lua_pushstring(L, res.c_str());
     }
@@ -697,17 +697,14 @@ int compose(lua_State * L)
         {
             std::string cmd = "less " + filename;
 
-            refresh();
-            def_prog_mode();
-            endwin();
+            CScreen::suspend();
 
             unused = system( cmd.c_str() );
 
             /**
              * Reset + redraw
              */
-            reset_prog_mode();
-            refresh();
+            CScreen::resume();
 
             goto retry;
         }
@@ -745,7 +742,7 @@ int compose(lua_State * L)
 int count_messages(lua_State * L)
 {
     CGlobal *global = CGlobal::Instance();
-    CMessageList *messages = global->get_messages();
+    CMessageView *messages = global->get_messages();
     assert(messages!=NULL);
 
     lua_pushinteger(L, messages->size() );
@@ -799,8 +796,8 @@ int count_lines(lua_State * L)
     /**
      * If that succeeded get the body.
      */
-    std::vector<UTFString> body = msg->body();
-    lua_pushinteger(L, body.size() );
+    std::shared_ptr<CRenderedBody> body = msg->rendered_body();
+    lua_pushinteger(L, body->count() );
     return 1;
 }
 
@@ -994,17 +991,14 @@ int forward(lua_State * L)
         {
             std::string cmd = "less " + filename;
 
-            refresh();
-            def_prog_mode();
-            endwin();
+            CScreen::suspend();
 
             unused = system( cmd.c_str() );
 
             /**
              * Reset + redraw
              */
-            reset_prog_mode();
-            refresh();
+            CScreen::resume();
 
             goto retry;
         }
@@ -1250,6 +1244,18 @@ int mark_unread(lua_State * L)
 }
 
 
+/**
+ * Write any pending flag changes to disk.
+ */
+int sync_flags(lua_State * L)
+{
+    size_t count = CFlagQueue::Instance()->flush();
+
+    lua_pushinteger(L, count );
+    return( 1 );
+}
+
+
 /**
  * Offset within the message we're displaying.
  */
@@ -1429,17 +1435,14 @@ int reply(lua_State * L)
         {
             std::string cmd = "less " + filename;
 
-            refresh();
-            def_prog_mode();
-            endwin();
+            CScreen::suspend();
 
             unused = system( cmd.c_str() );
 
             /**
              * Reset + redraw
              */
-            reset_prog_mode();
-            refresh();
+            CScreen::resume();
 
             goto retry;
         }
@@ -1508,14 +1511,11 @@ int save_message( lua_State *L )
     }
 
     /*
-     * Actually copy the message.
-     */
-    msg->copy(str);
-
-    /**
-     * Remove source.
+     * Move the message, renaming it where possible.
      */
-    msg->remove();
+    CDirectoryHandles dirs;
+    if ( ! msg->move_to( str, dirs ) )
+        return luaL_error(L, "Failed to move the message" );
 
     /**
      * Update messages
@@ -1574,15 +1574,13 @@ int scroll_message_to( lua_State *L)
         return luaL_error(L, "Missing argument to scroll_message_to(..)");
 
     CGlobal *global = CGlobal::Instance();
-    CMessageList *messages = global->get_messages();
+    CMessageView *messages = global->get_messages();
 
     int count = messages->size();
     int selected = global->get_selected_message();
 
     size_t cur_offset = global->get_message_offset();
 
-    std::vector<UTFString> body;
-
 
     std::shared_ptr<CMessage> cur = NULL;
     if (((selected) < count) && count > 0 )
@@ -1595,31 +1593,33 @@ int scroll_message_to( lua_State *L)
      * The body might come from on_get_body.
      */
     CLua *lua = CLua::Instance();
-    body = lua->on_get_body();
-    if ( body.empty() )
-        body = cur->body();
+    std::shared_ptr<CRenderedBody> body = lua->on_get_body();
+    if ( ! body )
+        body = cur->rendered_body();
 
     /**
      * OK at this point we have "body" populated with the message
      * we're going to display.
      */
-    if ( body.size() < 1 )
+    if ( body->count() < 1 )
         return 0;
 
     size_t offset = cur_offset;
     offset += 1;
-    if ( offset >= body.size() )
+    if ( offset >= body->count() )
         offset = 0;
 
+    std::shared_ptr<pcrecpp::RE> regexp = CRegexpCache::Instance()->get( str );
+
     /**
      * Iterate over the text
      */
     while( offset != cur_offset )
     {
         UTFString line = "";
-        line = body.at(offset);
+        line = body->line(offset);
 
-        if (pcrecpp::RE(str, pcrecpp::RE_Options().set_caseless(true)).PartialMatch(line.c_str()) )
+        if ( regexp->PartialMatch(line.c_str()) )
         {
             /**
              * We found a match.  Jump to it.
@@ -1632,7 +1632,7 @@ int scroll_message_to( lua_State *L)
          * Next line.
          */
         offset += 1;
-        if ( offset >= body.size() )
+        if ( offset >= body->count() )
             offset = 0;
     }
 
@@ -1793,6 +1793,10 @@ static int message_mt_path(lua_State *L)
     std::shared_ptr<CMessage> message = check_message(L, 1);
     if (message)
     {
+        /**
+         * The caller may use the name, so it must reflect our flags.
+         */
+        message->sync_flags();
         lua_pushstring(L, message->path().c_str());
         return 1;
     }
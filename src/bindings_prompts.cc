@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <cursesw.h>
 #include <cstdlib>
+#include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -107,6 +108,18 @@ int prompt(lua_State * L)
     if (str == NULL)
         return luaL_error(L, "Missing argument to prompt(..)");
 
+    /**
+     * Without a terminal the prompt goes to STDOUT, and the reply is
+     * read from STDIN.
+     */
+    if ( CScreen::headless() )
+    {
+        std::cout << str << std::flush;
+
+        std::string input = CScreen::get_line();
+        lua_pushstring(L, input.c_str() );
+        return 1;
+    }
 
     curs_set(1);
     echo();
@@ -203,6 +216,31 @@ int prompt_chars(lua_State *L)
     if (chars.empty())
         return luaL_error(L, "Missing characters to function prompt_chars(..)");
 
+    /**
+     * Without a terminal the prompt goes to STDOUT, and the reply is
+     * read from STDIN - ignoring anything not in the set.
+     */
+    if ( CScreen::headless() )
+    {
+        std::cout << str << std::flush;
+
+        gunichar key;
+        while( CInput::Instance()->get_wchar(&key) != ERR )
+        {
+            if ( chars.find( key ) != UTFString::npos )
+            {
+                Glib::ustring buf(1, key);
+                lua_pushstring(L, buf.c_str());
+                return 1;
+            }
+        }
+
+        /**
+         * STDIN was exhausted.
+         */
+        lua_pushnil(L);
+        return 1;
+    }
 
     echo();
 
@@ -255,6 +293,14 @@ int prompt_maildir(lua_State * L)
     int selected = 0;
     int height = CScreen::height();
 
+    /**
+     * Without a terminal there is nothing to select from.
+     */
+    if ( CScreen::headless() )
+    {
+        lua_pushnil(L);
+        return 1;
+    }
 
     while (true)
     {
@@ -37,6 +37,7 @@
 #include "input.h"
 
 #include "maildir.h"
+#include "regexp_cache.h"
 #include "screen.h"
 #include "utfstring.h"
 
@@ -111,6 +112,8 @@ int scroll_text_to( lua_State *L)
     if ( offset >= text.size() )
         offset = 0;
 
+    std::shared_ptr<pcrecpp::RE> regexp = CRegexpCache::Instance()->get( str );
+
     /**
      * Iterate over the text
      */
@@ -119,7 +122,7 @@ int scroll_text_to( lua_State *L)
         UTFString line = "";
         line = text.at(offset);
 
-        if (pcrecpp::RE(str, pcrecpp::RE_Options().set_caseless(true)).PartialMatch(line.c_str()) )
+        if ( regexp->PartialMatch(line.c_str()) )
         {
             /**
              * We found a match.  Jump to it.
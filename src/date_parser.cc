@@ -0,0 +1,399 @@
+/**
+ * date_parser.cc - Parse the dates found in message headers.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#include "date_parser.h"
+
+
+/**
+ * The month names, which we match by their first three letters.
+ */
+static const char *month_names[] = { "jan", "feb", "mar", "apr", "may", "jun",
+                                     "jul", "aug", "sep", "oct", "nov", "dec" };
+
+/**
+ * The named timezones we understand, and their offsets in minutes.
+ */
+static const struct
+{
+    const char *name;
+    int offset;
+} zone_names[] =
+{
+    { "ut",    0 },
+    { "utc",   0 },
+    { "gmt",   0 },
+    { "z",     0 },
+    { "est",  -5 * 60 },
+    { "edt",  -4 * 60 },
+    { "cst",  -6 * 60 },
+    { "cdt",  -5 * 60 },
+    { "mst",  -7 * 60 },
+    { "mdt",  -6 * 60 },
+    { "pst",  -8 * 60 },
+    { "pdt",  -7 * 60 },
+    { "bst",   1 * 60 },
+    { "cet",   1 * 60 },
+    { "cest",  2 * 60 },
+    { "eet",   2 * 60 },
+    { "eest",  3 * 60 },
+    { "msk",   3 * 60 },
+    { "msd",   4 * 60 },
+    { NULL,    0 },
+};
+
+
+/**
+ * The fields of a date as we find them.
+ */
+struct CDateFields
+{
+    int year;
+    int month;
+    int day;
+    int hour;
+    int min;
+    int sec;
+    int zone;
+    bool have_time;
+};
+
+
+/**
+ * Read an unsigned number, returning the count of digits read.
+ */
+static int read_number( const char *&ptr, int &value )
+{
+    int digits = 0;
+    value = 0;
+
+    while( isdigit( (unsigned char)*ptr ) && ( digits < 9 ) )
+    {
+        value = ( value * 10 ) + ( *ptr - '0' );
+        ptr++;
+        digits++;
+    }
+    return( digits );
+}
+
+
+/**
+ * Find the month with the given name, returning 1-12, or zero.
+ */
+static int lookup_month( const char *word, size_t len )
+{
+    if ( len < 3 )
+        return 0;
+
+    for( int i = 0; i < 12; i++ )
+    {
+        if ( strncasecmp( word, month_names[i], 3 ) == 0 )
+            return( i + 1 );
+    }
+    return 0;
+}
+
+
+/**
+ * Find the zone with the given name, returning false if unknown.
+ */
+static bool lookup_zone( const char *word, size_t len, int &offset )
+{
+    for( int i = 0; zone_names[i].name != NULL; i++ )
+    {
+        if ( ( strlen( zone_names[i].name ) == len ) &&
+             ( strncasecmp( word, zone_names[i].name, len ) == 0 ) )
+        {
+            offset = zone_names[i].offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Read a time of the form HH:MM[:SS], or HH.MM[.SS], the hour of which
+ * has already been read.
+ */
+static void read_time( const char *&ptr, int hour, CDateFields &f )
+{
+    char sep = *ptr;
+    int value;
+
+    f.hour = hour;
+    f.min  = 0;
+    f.sec  = 0;
+    f.have_time = true;
+
+    ptr++;
+    read_number( ptr, f.min );
+
+    if ( ( *ptr == sep ) && isdigit( (unsigned char)ptr[1] ) )
+    {
+        ptr++;
+        read_number( ptr, value );
+        f.sec = value;
+    }
+}
+
+
+/**
+ * Convert a two or three-digit year, as RFC 5322 section 4.3 requires.
+ */
+static int full_year( int year, int digits )
+{
+    if ( digits == 2 )
+        return( ( year < 50 ) ? 2000 + year : 1900 + year );
+    if ( digits == 3 )
+        return( 1900 + year );
+    return( year );
+}
+
+
+/**
+ * Parse the given date, returning the seconds since the epoch.
+ */
+bool CDateParser::parse( const std::string &value, time_t &result )
+{
+    CDateFields f;
+    f.year  = -1;
+    f.month = 0;
+    f.day   = 0;
+    f.hour  = 0;
+    f.min   = 0;
+    f.sec   = 0;
+    f.zone  = 0;
+    f.have_time = false;
+
+    const char *ptr = value.c_str();
+
+    while( *ptr )
+    {
+        unsigned char c = *ptr;
+
+        /**
+         * Skip whitespace, and separators.
+         */
+        if ( isspace( c ) || ( c == ',' ) )
+        {
+            ptr++;
+            continue;
+        }
+
+        /**
+         * Skip comments, which may be nested.
+         */
+        if ( c == '(' )
+        {
+            int depth = 0;
+            while( *ptr )
+            {
+                if ( *ptr == '(' )
+                    depth++;
+                else if ( ( *ptr == ')' ) && ( --depth == 0 ) )
+                {
+                    ptr++;
+                    break;
+                }
+                ptr++;
+            }
+            continue;
+        }
+
+        /**
+         * Words: day-names, month-names, and zone-names.
+         */
+        if ( isalpha( c ) )
+        {
+            const char *word = ptr;
+            while( isalpha( (unsigned char)*ptr ) )
+                ptr++;
+
+            size_t len = ptr - word;
+            int month  = lookup_month( word, len );
+            int zone   = 0;
+
+            if ( ( month != 0 ) && ( f.month == 0 ) )
+                f.month = month;
+            else if ( lookup_zone( word, len, zone ) )
+                f.zone = zone;
+
+            continue;
+        }
+
+        /**
+         * Numeric zones: +HHMM / -HHMM.
+         */
+        if ( ( ( c == '+' ) || ( c == '-' ) ) && isdigit( (unsigned char)ptr[1] ) )
+        {
+            const char *start = ++ptr;
+            int zone;
+            int digits = read_number( ptr, zone );
+
+            if ( digits == 4 )
+            {
+                zone = ( ( zone / 100 ) * 60 ) + ( zone % 100 );
+                f.zone = ( c == '-' ) ? -zone : zone;
+            }
+            else if ( digits == 0 )
+                ptr = start;
+
+            continue;
+        }
+
+        if ( isdigit( c ) )
+        {
+            int number;
+            int digits = read_number( ptr, number );
+
+            /**
+             * A time.
+             */
+            if ( ( *ptr == ':' ) && isdigit( (unsigned char)ptr[1] ) )
+            {
+                read_time( ptr, number, f );
+                continue;
+            }
+
+            /**
+             * A compound date: DD-Mon-YYYY, YYYY-MM-DD, MM/DD/YY,
+             * DD.MM.YYYY - or a time of the form HH.MM.SS.
+             */
+            if ( ( ( *ptr == '-' ) || ( *ptr == '/' ) || ( *ptr == '.' ) ) &&
+                 isalnum( (unsigned char)ptr[1] ) )
+            {
+                char sep = *ptr;
+                const char *rest = ptr + 1;
+
+                if ( isalpha( (unsigned char)*rest ) )
+                {
+                    /**
+                     * DD-Mon-YYYY
+                     */
+                    const char *word = rest;
+                    while( isalpha( (unsigned char)*rest ) )
+                        rest++;
+
+                    f.day   = number;
+                    f.month = lookup_month( word, rest - word );
+
+                    if ( ( *rest == sep ) && isdigit( (unsigned char)rest[1] ) )
+                    {
+                        rest++;
+                        int year;
+                        int ydigits = read_number( rest, year );
+                        f.year = full_year( year, ydigits );
+                    }
+                    ptr = rest;
+                    continue;
+                }
+
+                int second, third = -1;
+                int tdigits = 0;
+                read_number( rest, second );
+                if ( ( *rest == sep ) && isdigit( (unsigned char)rest[1] ) )
+                {
+                    rest++;
+                    tdigits = read_number( rest, third );
+                }
+                ptr = rest;
+
+                if ( ( sep == '.' ) && ( tdigits != 4 ) && ( number < 24 ) &&
+                     ( f.month != 0 ) )
+                {
+                    /**
+                     * HH.MM.SS, after the date has been seen.
+                     */
+                    f.hour = number;
+                    f.min  = second;
+                    f.sec  = ( third < 0 ) ? 0 : third;
+                    f.have_time = true;
+                }
+                else if ( digits == 4 )
+                {
+                    /**
+                     * YYYY-MM-DD
+                     */
+                    f.year  = number;
+                    f.month = second;
+                    f.day   = ( third < 0 ) ? 1 : third;
+                }
+                else if ( sep == '/' )
+                {
+                    /**
+                     * MM/DD/YY
+                     */
+                    f.month = number;
+                    f.day   = second;
+                    if ( third >= 0 )
+                        f.year = full_year( third, tdigits );
+                }
+                else
+                {
+                    /**
+                     * DD.MM.YYYY, DD-MM-YYYY
+                     */
+                    f.day   = number;
+                    f.month = second;
+                    if ( third >= 0 )
+                        f.year = full_year( third, tdigits );
+                }
+                continue;
+            }
+
+            /**
+             * A bare number: the day of the month, or the year.
+             */
+            if ( ( f.day == 0 ) && ( digits <= 2 ) && ( number >= 1 ) && ( number <= 31 ) )
+                f.day = number;
+            else if ( f.year < 0 )
+                f.year = full_year( number, digits );
+
+            continue;
+        }
+
+        /**
+         * Anything else is ignored.
+         */
+        ptr++;
+    }
+
+    /**
+     * Validate what we found.
+     */
+    if ( ( f.year < 1900 ) || ( f.month < 1 ) || ( f.month > 12 ) ||
+         ( f.day < 1 ) || ( f.day > 31 ) ||
+         ( f.hour > 23 ) || ( f.min > 59 ) || ( f.sec > 60 ) )
+        return false;
+
+    struct tm t;
+    memset( &t, '\0', sizeof(t) );
+    t.tm_year = f.year - 1900;
+    t.tm_mon  = f.month - 1;
+    t.tm_mday = f.day;
+    t.tm_hour = f.hour;
+    t.tm_min  = f.min;
+    t.tm_sec  = f.sec;
+
+    result = timegm( &t ) - ( f.zone * 60 );
+    return true;
+}
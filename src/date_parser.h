@@ -0,0 +1,45 @@
+/**
+ * date_parser.h - Parse the dates found in message headers.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <string>
+#include <time.h>
+
+
+/**
+ * A parser for the values of Date: headers.
+ *
+ * This handles RFC 5322 dates, including the obsolete forms (two-digit
+ * years, named zones, comments), along with the asctime() style and the
+ * numeric forms which are commonly seen in the wild.  Parsing is done in
+ * a single pass, without consulting the locale.
+ */
+class CDateParser
+{
+
+public:
+
+    /**
+     * Parse the given date, returning the seconds since the epoch.
+     *
+     * Returns false if the value couldn't be understood.
+     */
+    static bool parse( const std::string &value, time_t &result );
+
+};
@@ -73,7 +73,7 @@ UTFString CDebug::timestamp()
     time_t     now = time(0);
     struct tm  tstruct;
     char       buf[80];
-    tstruct = *localtime(&now);
+    localtime_r( &now, &tstruct );
 
     strftime(buf, sizeof(buf), "%Y-%m-%d %X", &tstruct);
 
@@ -96,6 +96,8 @@ void CDebug::debug( UTFString line, bool force)
     if ( m_logfile.empty() )
         return;
 
+    std::lock_guard<std::mutex> guard( m_lock );
+
     /**
      * Add the string to the pending list of log-messages
      * which should be written.
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cassert>
+#include <mutex>
 #include <vector>
 
 #include "utfstring.h"
@@ -70,7 +71,7 @@ class CDebug
   void set_logfile( UTFString path );
 
   /**
-   * Add a new string to the log.
+   * Add a new string to the log.  This may be called from any thread.
    *
    * NOTE: The string will be buffered and not hit the disk immediately, unless
    * you set the force flag to true.
@@ -109,4 +110,9 @@ class CDebug
    */
   std::vector<UTFString> m_pending;
 
+  /**
+   * Serializes access to m_pending, and the logfile.
+   */
+  std::mutex m_lock;
+
 };
@@ -21,8 +21,15 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <iterator>
+#include <mutex>
+#include <thread>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -33,12 +40,17 @@
 #include "debug.h"
 #include "file.h"
 #include "maildir.h"
+#include "screen.h"
 #include "variables.h"
 
 #ifndef FILE_READ_BUFFER
 # define FILE_READ_BUFFER 16384
 #endif
 
+#ifndef MAILDIR_SCAN_THREADS
+# define MAILDIR_SCAN_THREADS 8
+#endif
+
 
 
 /**
@@ -197,8 +209,11 @@ std::string CFile::basename( std::string path )
 
 /**
  * Copy a file.
+ *
+ * The kernel copies the data directly, where it can, rather than it
+ * passing through our buffers.
  */
-void CFile::copy( std::string src, std::string dst )
+bool CFile::copy( std::string src, std::string dst )
 {
 
 #ifdef LUMAIL_DEBUG
@@ -210,19 +225,42 @@ void CFile::copy( std::string src, std::string dst )
     DEBUG_LOG( dm );
 #endif
 
-    std::ifstream isrc(src, std::ios::binary);
-    std::ofstream odst(dst, std::ios::binary);
+    int in = open( src.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( in < 0 )
+        return false;
 
-    std::istreambuf_iterator<char> begin_source(isrc);
-    std::istreambuf_iterator<char> end_source;
-    std::ostreambuf_iterator<char> begin_dest(odst);
+    int out = open( dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+    if ( out < 0 )
+    {
+        close( in );
+        return false;
+    }
 
-    std::copy(begin_source, end_source, begin_dest);
+    bool ok = true;
+    ssize_t len;
 
-    isrc.close();
-    odst.close();
+    while( ( len = sendfile( out, in, NULL, 1 << 30 ) ) > 0 )
+        ;
 
-    assert( CFile::exists( dst ) );
+    /**
+     * Fall back to reading + writing if sendfile can't handle these files.
+     */
+    if ( ( len < 0 ) && ( ( errno == EINVAL ) || ( errno == ENOSYS ) ) )
+    {
+        char buf[FILE_READ_BUFFER];
+
+        while( ok && ( ( len = read( in, buf, sizeof(buf) ) ) > 0 ) )
+            ok = ( write( out, buf, len ) == len );
+    }
+
+    if ( len < 0 )
+        ok = false;
+
+    close( in );
+    if ( close( out ) != 0 )
+        ok = false;
+
+    return( ok );
 }
 
 
@@ -234,9 +272,7 @@ int CFile::edit( std::string filename )
     /**
      * Save the current state of the TTY
      */
-    refresh();
-    def_prog_mode();
-    endwin();
+    CScreen::suspend();
 
     /**
      * Get the editor.
@@ -254,8 +290,7 @@ int CFile::edit( std::string filename )
     /**
      * Reset + redraw
      */
-    reset_prog_mode();
-    refresh();
+    CScreen::resume();
 
     return( ret );
 }
@@ -340,60 +375,208 @@ bool CFile::file_to_pipe( std::string src, std::string cmd )
 
 
 /**
- * Return a sorted list of maildirs beneath the given prefix.
+ * Is the directory "name", relative to the directory-handle dfd, a Maildir?
+ *
+ * This avoids the path-resolution cost of CMaildir::is_maildir().
  */
-std::vector<std::string> CFile::get_all_maildirs(std::string prefix)
+static bool is_maildir_at( int dfd, const char *name )
 {
-    std::vector<std::string> result;
-    dirent *de;
-    DIR *dp;
+    const char *subdirs[] = { "cur", "new", "tmp", NULL };
 
-    prefix = prefix.empty()? "." : prefix.c_str();
-    dp = opendir(prefix.c_str());
-    if (dp)
+    for( int i = 0 ; subdirs[i] ; i++ )
     {
-        if (CMaildir::is_maildir(prefix))
-            result.push_back(prefix);
+        std::string sub = name;
+        sub += "/";
+        sub += subdirs[i];
+
+        struct stat sb;
+        if ( ( fstatat( dfd, sub.c_str(), &sb, 0 ) != 0 ) ||
+             ( ! S_ISDIR( sb.st_mode ) ) )
+            return false;
+    }
+    return true;
+}
 
-        while (true)
-        {
-            de = readdir(dp);
-            if (de == NULL)
-                break;
 
-            if ( ( strcmp( de->d_name, "." ) != 0 ) &&
-                 ( strcmp( de->d_name, ".." ) != 0 ) &&
-                 ( ( de->d_type == DT_UNKNOWN) ||
-                   ( de->d_type == DT_DIR ) ) )
-            {
-                std::string subdir_name = std::string(de->d_name);
-                std::string subdir_path = std::string(prefix + "/" + subdir_name);
-                if (CMaildir::is_maildir(subdir_path))
-                    result.push_back(subdir_path);
-                else
-                {
-                    if (subdir_name != "." && subdir_name != "..")
-                    {
-                        DIR* sdp = opendir(subdir_path.c_str());
-                        if (sdp)
-                        {
-                            closedir(sdp);
-                            std::vector<std::string> sub_maildirs;
-                            sub_maildirs = CFile::get_all_maildirs(subdir_path);
-                            for (std::string sub_maildir: sub_maildirs)
-                            {
-                                result.push_back(sub_maildir);
-                            }
-                        }
-                    }
-                }
-            }
+/**
+ * The state shared between the threads which discover maildirs.
+ */
+struct CMaildirScan
+{
+    /**
+     * Directories waiting to be examined.
+     */
+    std::deque<std::string> pending;
+
+    /**
+     * The number of directories currently being examined.
+     */
+    int active;
+
+    /**
+     * The maildirs we've found.
+     */
+    std::vector<std::string> found;
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+};
+
+
+/**
+ * Examine a single directory, recording the maildirs beneath it and
+ * queuing any other subdirectories for examination.
+ */
+static void scan_directory( CMaildirScan &scan, const std::string &path, bool is_prefix )
+{
+    int dfd = open( path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( dfd < 0 )
+        return;
+
+    DIR *dp = fdopendir( dfd );
+    if ( dp == NULL )
+    {
+        close( dfd );
+        return;
+    }
+
+    std::vector<std::string> maildirs;
+    std::vector<std::string> subdirs;
+
+    /**
+     * The prefix itself might be a maildir, in which case its cur/, new/,
+     * and tmp/ directories needn't be examined.
+     */
+    bool prefix_maildir = is_prefix && is_maildir_at( dfd, "." );
+    if ( prefix_maildir )
+        maildirs.push_back( path );
+
+    dirent *de;
+    while ( ( de = readdir( dp ) ) != NULL )
+    {
+        if ( ( strcmp( de->d_name, "." ) == 0 ) ||
+             ( strcmp( de->d_name, ".." ) == 0 ) )
+            continue;
+
+        /**
+         * Trust d_type when the filesystem provides it.
+         */
+        if ( de->d_type == DT_UNKNOWN )
+        {
+            struct stat sb;
+            if ( ( fstatat( dfd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW ) != 0 ) ||
+                 ( ! S_ISDIR( sb.st_mode ) ) )
+                continue;
         }
-        closedir(dp);
-        std::sort(result.begin(), result.end());
+        else if ( de->d_type != DT_DIR )
+            continue;
+
+        if ( prefix_maildir &&
+             ( ( strcmp( de->d_name, "cur" ) == 0 ) ||
+               ( strcmp( de->d_name, "new" ) == 0 ) ||
+               ( strcmp( de->d_name, "tmp" ) == 0 ) ) )
+            continue;
+
+        std::string subdir_path = path + "/" + de->d_name;
+
+        if ( is_maildir_at( dfd, de->d_name ) )
+            maildirs.push_back( subdir_path );
+        else
+            subdirs.push_back( subdir_path );
     }
+    closedir( dp );
 
-    return result;
+    std::lock_guard<std::mutex> guard( scan.lock );
+    scan.found.insert( scan.found.end(), maildirs.begin(), maildirs.end() );
+    for (std::string subdir : subdirs)
+        scan.pending.push_back( subdir );
+
+    if ( ! subdirs.empty() )
+        scan.wakeup.notify_all();
+}
+
+
+/**
+ * The body of each discovery thread: examine directories until there
+ * are none left, and no other thread might add more.
+ */
+static void scan_worker( CMaildirScan &scan )
+{
+    std::unique_lock<std::mutex> guard( scan.lock );
+
+    while( true )
+    {
+        while( scan.pending.empty() && ( scan.active > 0 ) )
+            scan.wakeup.wait( guard );
+
+        if ( scan.pending.empty() )
+            break;
+
+        std::string path = scan.pending.front();
+        scan.pending.pop_front();
+        scan.active += 1;
+
+        guard.unlock();
+        scan_directory( scan, path, false );
+        guard.lock();
+
+        scan.active -= 1;
+        if ( ( scan.active == 0 ) && scan.pending.empty() )
+            scan.wakeup.notify_all();
+    }
+}
+
+
+/**
+ * Return a sorted list of maildirs beneath the given prefix.
+ */
+std::vector<std::string> CFile::get_all_maildirs(std::string prefix)
+{
+    std::vector<std::string> prefixes;
+    prefixes.push_back( prefix );
+
+    return( get_all_maildirs( prefixes ) );
+}
+
+
+/**
+ * Return a sorted list of maildirs beneath all the given prefixes.
+ *
+ * Each directory is opened once, and the subdirectories are tested
+ * relative to it.  The walk is spread over a number of threads, which
+ * matters most when the maildirs live upon a network filesystem.
+ */
+std::vector<std::string> CFile::get_all_maildirs(std::vector<std::string> prefixes)
+{
+    CMaildirScan scan;
+    scan.active = 0;
+
+    /**
+     * Examine the prefixes first, in parallel.
+     */
+    std::vector<std::thread> threads;
+    for (std::string prefix : prefixes)
+    {
+        prefix = prefix.empty()? "." : prefix;
+        threads.push_back( std::thread( scan_directory, std::ref( scan ), prefix, true ) );
+    }
+    for (std::thread &t : threads)
+        t.join();
+    threads.clear();
+
+    /**
+     * Now walk the subtrees.  Start every thread even if there are few
+     * directories pending, as they may contain many more - the workers
+     * wait for the directories the others discover.
+     */
+    unsigned int count = scan.pending.empty() ? 0 : MAILDIR_SCAN_THREADS;
+    for( unsigned int i = 0; i < count; i++ )
+        threads.push_back( std::thread( scan_worker, std::ref( scan ) ) );
+    for (std::thread &t : threads)
+        t.join();
+
+    std::sort(scan.found.begin(), scan.found.end());
+    return( scan.found );
 }
 
 
@@ -466,3 +649,57 @@ std::vector<std::string> CFile::complete_filename(std::string path)
 
     return( result );
 }
+
+
+/**
+ * Constructor.
+ */
+CDirectoryHandles::CDirectoryHandles()
+{
+}
+
+
+/**
+ * Destructor.  Close our descriptors.
+ */
+CDirectoryHandles::~CDirectoryHandles()
+{
+    for (auto &dir : m_fds)
+    {
+        if ( dir.second >= 0 )
+            close( dir.second );
+    }
+}
+
+
+/**
+ * Get a descriptor for the given directory.
+ */
+int CDirectoryHandles::get( const std::string &path )
+{
+    auto it = m_fds.find( path );
+    if ( it != m_fds.end() )
+        return( it->second );
+
+    int fd = open( path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    m_fds[path] = fd;
+
+    return( fd );
+}
+
+
+/**
+ * Get a descriptor for the directory containing the given file.
+ */
+int CDirectoryHandles::parent( const std::string &path, std::string &name )
+{
+    size_t offset = path.rfind( '/' );
+    if ( offset == std::string::npos )
+    {
+        name = path;
+        return( get( "." ) );
+    }
+
+    name = path.substr( offset + 1 );
+    return( get( ( offset == 0 ) ? "/" : path.substr( 0, offset ) ) );
+}
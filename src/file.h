@@ -18,8 +18,9 @@
 
 #pragma once
 
-#include <vector>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 
 /**
@@ -69,9 +70,9 @@ public:
 
 
     /**
-     * Copy a file.
+     * Copy a file.  Returns false if the copy is incomplete.
      */
-    static void copy( std::string src, std::string dest );
+    static bool copy( std::string src, std::string dest );
 
 
     /**
@@ -97,9 +98,56 @@ public:
      */
     static std::vector<std::string> get_all_maildirs(std::string prefix);
 
+    /**
+     * Return a sorted list of maildirs beneath all the given prefixes.
+     */
+    static std::vector<std::string> get_all_maildirs(std::vector<std::string> prefixes);
+
     /**
      * Allow completion of file/path-names
      */
     static std::vector<std::string> complete_filename(std::string path);
 
 };
+
+
+/**
+ * A cache of descriptors for directories, for use with renameat() and
+ * friends, so that operating upon many files in the same directories
+ * doesn't resolve those directories each time.
+ *
+ * The descriptors are closed when the cache is destroyed.
+ */
+class CDirectoryHandles
+{
+
+public:
+
+    CDirectoryHandles();
+    ~CDirectoryHandles();
+
+    /**
+     * Get a descriptor for the given directory, or -1 on failure.
+     */
+    int get( const std::string &path );
+
+    /**
+     * Get a descriptor for the directory containing the given file, and
+     * the name of the file within it.
+     */
+    int parent( const std::string &path, std::string &name );
+
+private:
+
+    /**
+     * Descriptors are not shared.
+     */
+    CDirectoryHandles(const CDirectoryHandles &);
+    CDirectoryHandles & operator=(const CDirectoryHandles &);
+
+    /**
+     * The descriptors, keyed by path.
+     */
+    std::unordered_map<std::string, int> m_fds;
+
+};
@@ -0,0 +1,330 @@
+/**
+ * filter.cc - Run messages through external filter-commands.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "filter.h"
+
+
+extern char **environ;
+
+
+/**
+ * The number of filter outputs we'll cache.
+ */
+#ifndef FILTER_CACHE_SIZE
+# define FILTER_CACHE_SIZE 16
+#endif
+
+
+/**
+ * Instance-handle.
+ */
+CFilterPipeline *CFilterPipeline::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CFilterPipeline *CFilterPipeline::Instance()
+{
+    if (!pinstance)
+        pinstance = new CFilterPipeline;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is private as this class is a singleton.
+ */
+CFilterPipeline::CFilterPipeline()
+{
+}
+
+
+/**
+ * Run the contents of the given file through the command.
+ */
+bool CFilterPipeline::filter_file( const std::string &identity, const std::string &path,
+                                   const std::string &command, std::string &output )
+{
+    std::string key = identity + "\n" + command;
+    if ( lookup( key, output ) )
+        return true;
+
+    int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+        return false;
+
+    bool ok = run( command, fd, NULL, output );
+    close( fd );
+
+    if ( ok )
+        store( key, output );
+
+    return( ok );
+}
+
+
+/**
+ * Run the given text through the command.
+ */
+bool CFilterPipeline::filter_text( const std::string &identity, const std::string &input,
+                                   const std::string &command, std::string &output )
+{
+    std::string key = identity + "\n" + command;
+    if ( lookup( key, output ) )
+        return true;
+
+    bool ok = run( command, -1, &input, output );
+
+    if ( ok )
+        store( key, output );
+
+    return( ok );
+}
+
+
+/**
+ * Forget all cached output.
+ */
+void CFilterPipeline::clear()
+{
+    std::lock_guard<std::mutex> guard( m_lock );
+
+    m_output.clear();
+    m_used.clear();
+}
+
+
+/**
+ * Spawn the command, and collect its output.
+ *
+ * If input is NULL then input_fd becomes the standard input of the
+ * command, otherwise the text is written to it over a pipe - while its
+ * output is read, so that neither side can block the other.
+ */
+bool CFilterPipeline::run( const std::string &command, int input_fd, const std::string *input,
+                           std::string &output )
+{
+    DEBUG_LOG( "CFilterPipeline::run(" + command + ")" );
+
+    output.clear();
+
+    int out[2] = { -1, -1 };
+    int in[2]  = { -1, -1 };
+
+    if ( pipe2( out, O_CLOEXEC ) != 0 )
+        return false;
+
+    if ( ( input != NULL ) && ( pipe2( in, O_CLOEXEC ) != 0 ) )
+    {
+        close( out[0] );
+        close( out[1] );
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init( &actions );
+    posix_spawn_file_actions_adddup2( &actions, ( input != NULL ) ? in[0] : input_fd, 0 );
+    posix_spawn_file_actions_adddup2( &actions, out[1], 1 );
+
+    /**
+     * The command shouldn't inherit any signals we have blocked.
+     */
+    sigset_t none;
+    sigemptyset( &none );
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init( &attr );
+    posix_spawnattr_setsigmask( &attr, &none );
+    posix_spawnattr_setflags( &attr, POSIX_SPAWN_SETSIGMASK );
+
+    const char *argv[] = { "/bin/sh", "-c", command.c_str(), NULL };
+
+    pid_t pid;
+    int err = posix_spawn( &pid, "/bin/sh", &actions, &attr, (char * const *)argv, environ );
+    posix_spawn_file_actions_destroy( &actions );
+    posix_spawnattr_destroy( &attr );
+
+    close( out[1] );
+    if ( input != NULL )
+        close( in[0] );
+
+    if ( err != 0 )
+    {
+        DEBUG_LOG( "CFilterPipeline::run - posix_spawn failed: " + std::string( strerror( err ) ) );
+        close( out[0] );
+        if ( input != NULL )
+            close( in[1] );
+        return false;
+    }
+
+    /**
+     * The filter might exit without reading all its input, so make sure
+     * that doesn't kill us with SIGPIPE.
+     */
+    sigset_t pipe_set, old_set, pending;
+    sigemptyset( &pipe_set );
+    sigaddset( &pipe_set, SIGPIPE );
+    pthread_sigmask( SIG_BLOCK, &pipe_set, &old_set );
+
+    sigpending( &pending );
+    bool was_pending = sigismember( &pending, SIGPIPE );
+
+    size_t written = 0;
+    if ( input != NULL )
+    {
+        fcntl( in[1], F_SETFL, fcntl( in[1], F_GETFL ) | O_NONBLOCK );
+
+        if ( input->empty() )
+        {
+            close( in[1] );
+            in[1] = -1;
+        }
+    }
+
+    char buf[65536];
+
+    while( true )
+    {
+        struct pollfd fds[2];
+        int nfds = 0;
+
+        fds[nfds].fd     = out[0];
+        fds[nfds].events = POLLIN;
+        nfds++;
+
+        if ( in[1] >= 0 )
+        {
+            fds[nfds].fd     = in[1];
+            fds[nfds].events = POLLOUT;
+            nfds++;
+        }
+
+        if ( poll( fds, nfds, -1 ) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            break;
+        }
+
+        /**
+         * Feed the filter.
+         */
+        if ( ( nfds > 1 ) && ( fds[1].revents & ( POLLOUT | POLLERR | POLLHUP ) ) )
+        {
+            ssize_t len = write( in[1], input->data() + written, input->size() - written );
+            if ( len > 0 )
+                written += len;
+
+            if ( ( ( len < 0 ) && ( errno != EAGAIN ) && ( errno != EINTR ) ) ||
+                 ( written >= input->size() ) )
+            {
+                close( in[1] );
+                in[1] = -1;
+            }
+        }
+
+        /**
+         * Collect its output.
+         */
+        if ( fds[0].revents & ( POLLIN | POLLERR | POLLHUP ) )
+        {
+            ssize_t len = read( out[0], buf, sizeof(buf) );
+            if ( len > 0 )
+                output.append( buf, len );
+            else if ( ( len == 0 ) || ( ( errno != EAGAIN ) && ( errno != EINTR ) ) )
+                break;
+        }
+    }
+
+    if ( in[1] >= 0 )
+        close( in[1] );
+    close( out[0] );
+
+    /**
+     * Discard any SIGPIPE we caused, unless one was already pending.
+     */
+    sigpending( &pending );
+    if ( sigismember( &pending, SIGPIPE ) && ! was_pending )
+    {
+        struct timespec zero = { 0, 0 };
+        sigtimedwait( &pipe_set, NULL, &zero );
+    }
+    pthread_sigmask( SIG_SETMASK, &old_set, NULL );
+
+    int status;
+    while( ( waitpid( pid, &status, 0 ) < 0 ) && ( errno == EINTR ) )
+        ;
+
+    return true;
+}
+
+
+/**
+ * Lookup cached output.
+ */
+bool CFilterPipeline::lookup( const std::string &key, std::string &output )
+{
+    std::lock_guard<std::mutex> guard( m_lock );
+
+    std::unordered_map<std::string, std::string>::iterator it = m_output.find( key );
+    if ( it == m_output.end() )
+        return false;
+
+    m_used.remove( key );
+    m_used.push_front( key );
+
+    output = it->second;
+    return true;
+}
+
+
+/**
+ * Store output in the cache, discarding the least recently used.
+ */
+void CFilterPipeline::store( const std::string &key, const std::string &output )
+{
+    std::lock_guard<std::mutex> guard( m_lock );
+
+    if ( m_output.find( key ) == m_output.end() )
+    {
+        if ( m_output.size() >= FILTER_CACHE_SIZE )
+        {
+            m_output.erase( m_used.back() );
+            m_used.pop_back();
+        }
+    }
+    else
+        m_used.remove( key );
+
+    m_used.push_front( key );
+    m_output[key] = output;
+}
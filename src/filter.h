@@ -0,0 +1,113 @@
+/**
+ * filter.h - Run messages through external filter-commands.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+/**
+ * A singleton class which runs the `mail_filter` and `display_filter`
+ * commands.
+ *
+ * The filter is spawned directly, via `/bin/sh -c`, and fed over a pipe,
+ * or given the message file itself as its standard input, so no temporary
+ * files are involved.  Its output is collected in memory.
+ *
+ * Recent outputs are cached, keyed by the identity of the input and the
+ * command, so that redrawing a filtered message doesn't run the filter
+ * again.
+ *
+ * Filters may be run from the worker threads, as well as the main thread.
+ */
+class CFilterPipeline
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CFilterPipeline *Instance();
+
+    /**
+     * Run the contents of the given file through the command.
+     *
+     * The identity should change whenever the content of the file does.
+     */
+    bool filter_file( const std::string &identity, const std::string &path,
+                      const std::string &command, std::string &output );
+
+    /**
+     * Run the given text through the command.
+     */
+    bool filter_text( const std::string &identity, const std::string &input,
+                      const std::string &command, std::string &output );
+
+    /**
+     * Forget all cached output.
+     */
+    void clear();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CFilterPipeline();
+    CFilterPipeline(const CFilterPipeline &);
+    CFilterPipeline & operator=(const CFilterPipeline &);
+
+private:
+
+    /**
+     * Spawn the command, with the given descriptor, or text, as its input.
+     */
+    bool run( const std::string &command, int input_fd, const std::string *input,
+              std::string &output );
+
+    /**
+     * Lookup/Store cached output.
+     */
+    bool lookup( const std::string &key, std::string &output );
+    void store( const std::string &key, const std::string &output );
+
+    /**
+     * The single instance of this class.
+     */
+    static CFilterPipeline *pinstance;
+
+    /**
+     * Cached output, keyed by input identity + command.
+     */
+    std::unordered_map<std::string, std::string> m_output;
+
+    /**
+     * The keys of the cached outputs, most recently used first.
+     */
+    std::list<std::string> m_used;
+
+    /**
+     * Serializes access to the cache.
+     */
+    std::mutex m_lock;
+
+};
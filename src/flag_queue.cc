@@ -0,0 +1,160 @@
+/**
+ * flag_queue.cc - Write the flags of messages to disk, in batches.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "debug.h"
+#include "flag_queue.h"
+#include "message.h"
+
+
+/**
+ * Instance-handle.
+ */
+CFlagQueue *CFlagQueue::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CFlagQueue *CFlagQueue::Instance()
+{
+    if (!pinstance)
+        pinstance = new CFlagQueue;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is protected as this class is a singleton.
+ */
+CFlagQueue::CFlagQueue()
+{
+}
+
+
+/**
+ * Note that the given message has changes to write.
+ */
+void CFlagQueue::add( CMessage *message )
+{
+    m_messages.insert( message );
+}
+
+
+/**
+ * Forget the given message.
+ */
+void CFlagQueue::forget( CMessage *message )
+{
+    m_messages.erase( message );
+}
+
+
+/**
+ * Are there any changes to write?
+ */
+bool CFlagQueue::pending()
+{
+    return( ! m_messages.empty() );
+}
+
+
+/**
+ * Write all pending changes.
+ */
+size_t CFlagQueue::flush()
+{
+    if ( m_messages.empty() )
+        return 0;
+
+    /**
+     * Renaming a message removes it from the queue, so work from a copy,
+     * ordered so that each directory is visited in turn.
+     */
+    std::vector<CMessage *> batch( m_messages.begin(), m_messages.end() );
+    m_messages.clear();
+
+    std::sort( batch.begin(), batch.end(),
+               [](CMessage *a, CMessage *b) { return( a->path() < b->path() ); } );
+
+    CDirectoryHandles dirs;
+    size_t count = 0;
+
+    for (CMessage *message : batch)
+    {
+        if ( rename( message, dirs ) )
+            count += 1;
+    }
+
+    DEBUG_LOG( "CFlagQueue::flush - renamed " + std::to_string( count ) + " of " + std::to_string( batch.size() ) );
+
+    return( count );
+}
+
+
+/**
+ * Write the pending changes of a single message.
+ */
+bool CFlagQueue::flush( CMessage *message )
+{
+    if ( m_messages.erase( message ) == 0 )
+        return false;
+
+    CDirectoryHandles dirs;
+    return( rename( message, dirs ) );
+}
+
+
+/**
+ * Rename a single message to its pending path.
+ *
+ * If that fails, most likely because the message was removed, its
+ * changes are discarded.
+ */
+bool CFlagQueue::rename( CMessage *message, CDirectoryHandles &dirs )
+{
+    std::string from = message->path();
+    std::string to   = message->pending_path();
+
+    if ( to.empty() || ( to == from ) )
+    {
+        message->discard_flags();
+        return false;
+    }
+
+    std::string from_name, to_name;
+    int from_dir = dirs.parent( from, from_name );
+    int to_dir   = dirs.parent( to, to_name );
+
+    if ( ( from_dir < 0 ) || ( to_dir < 0 ) ||
+         ( renameat( from_dir, from_name.c_str(), to_dir, to_name.c_str() ) != 0 ) )
+    {
+        DEBUG_LOG( "CFlagQueue::rename(" + from + ") failed: " + std::string( strerror( errno ) ) );
+        message->discard_flags();
+        return false;
+    }
+
+    message->path( to );
+    return true;
+}
@@ -0,0 +1,104 @@
+/**
+ * flag_queue.h - Write the flags of messages to disk, in batches.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <unordered_set>
+
+#include "file.h"
+
+
+class CMessage;
+
+
+/**
+ * A singleton which holds the messages whose flags have changed, but
+ * which haven't yet been renamed to match.
+ *
+ * Changing the flags of a message only updates it in memory, so any
+ * number of changes to any number of messages is cheap, and then the
+ * queue renames each file once, to its final name.
+ *
+ * The event-loop flushes the queue whenever it has nothing else to do,
+ * so the renames never delay the command which caused them.  Messages
+ * flush themselves if they're destroyed while queued, and if something
+ * needs the file to have its final name.
+ */
+class CFlagQueue
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CFlagQueue *Instance();
+
+    /**
+     * Note that the given message has changes to write.
+     */
+    void add( CMessage *message );
+
+    /**
+     * Forget the given message, without writing its changes.
+     */
+    void forget( CMessage *message );
+
+    /**
+     * Are there any changes to write?
+     */
+    bool pending();
+
+    /**
+     * Write all pending changes, returning the number of messages
+     * renamed.
+     */
+    size_t flush();
+
+    /**
+     * Write the pending changes of a single message.
+     */
+    bool flush( CMessage *message );
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CFlagQueue();
+    CFlagQueue(const CFlagQueue &);
+    CFlagQueue & operator=(const CFlagQueue &);
+
+private:
+
+    /**
+     * Rename a single message, using the given directory descriptors.
+     */
+    bool rename( CMessage *message, CDirectoryHandles &dirs );
+
+    /**
+     * The single instance of this class.
+     */
+    static CFlagQueue *pinstance;
+
+    /**
+     * The messages with changes to write.
+     */
+    std::unordered_set<CMessage *> m_messages;
+
+};
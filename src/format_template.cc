@@ -0,0 +1,264 @@
+/**
+ * format_template.cc - Compiled format-strings, for index/maildir display.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "debug.h"
+#include "format_template.h"
+#include "global.h"
+
+
+/**
+ * Get value from specification.
+ *
+ * For example get_spec("min:10 max:20%", "max") will return "20%".
+ */
+static std::string get_spec( const std::string &spec, const std::string &fieldname )
+{
+    std::string key = fieldname + ":";
+
+    size_t pos = spec.find( key );
+    if ( pos == std::string::npos )
+        return "";
+
+    size_t start = pos + key.size();
+    size_t end   = start;
+
+    while ( end < spec.size() && isalnum( (unsigned char)spec[end] ) )
+        end++;
+
+    if ( end < spec.size() && spec[end] == '%' )
+        end++;
+
+    return( spec.substr( start, end - start ) );
+}
+
+
+/**
+ * Parse a width from the specification, noting whether it is relative
+ * to the available width.
+ */
+static int get_width( const std::string &spec, const std::string &fieldname, bool &relative )
+{
+    std::string value = get_spec( spec, fieldname );
+
+    relative = false;
+
+    if ( value.empty() )
+        return -1;
+
+    if ( value[value.size()-1] == '%' )
+        relative = true;
+
+    return( atoi( value.c_str() ) );
+}
+
+
+/**
+ * Find the longest field-name which prefixes the given text.
+ */
+static const CFormatField *find_field( const CFormatField *fields, const char *text, size_t len )
+{
+    const CFormatField *best = NULL;
+    size_t best_len = 0;
+
+    for( const CFormatField *f = fields; f->name != NULL; f++ )
+    {
+        size_t n = strlen( f->name );
+
+        if ( ( n <= len ) && ( n > best_len ) && ( strncmp( f->name, text, n ) == 0 ) )
+        {
+            best     = f;
+            best_len = n;
+        }
+    }
+    return( best );
+}
+
+
+/**
+ * Compile the given format-string.
+ */
+CFormatTemplate::CFormatTemplate( const std::string &fmt, const CFormatField *fields, bool header )
+    : m_source( fmt ), m_relative( false )
+{
+    std::string literal;
+    size_t i = 0;
+
+    while( i < fmt.size() )
+    {
+        /**
+         * Find the run of letters which might name a variable.
+         */
+        size_t len = 0;
+        if ( fmt[i] == '$' )
+        {
+            while( ( i + 1 + len < fmt.size() ) &&
+                   isalpha( (unsigned char)fmt[i + 1 + len] ) )
+                len++;
+        }
+
+        const CFormatField *field = NULL;
+        if ( len > 0 )
+            field = find_field( fields, fmt.c_str() + i + 1, len );
+
+        /**
+         * A format-string of the form "$Header-Name".
+         */
+        if ( ( field == NULL ) && header && ( i == 0 ) && ( len > 0 ) )
+        {
+            CFormatToken token;
+            token.id   = FORMAT_HEADER;
+            token.text = fmt.substr( 1 );
+            token.min  = token.max = -1;
+            token.min_relative = token.max_relative = false;
+
+            m_tokens.push_back( token );
+            return;
+        }
+
+        if ( field == NULL )
+        {
+            literal += fmt[i];
+            i++;
+            continue;
+        }
+
+        if ( ! literal.empty() )
+        {
+            CFormatToken token;
+            token.id   = FORMAT_LITERAL;
+            token.text = literal;
+            token.min  = token.max = -1;
+            token.min_relative = token.max_relative = false;
+
+            m_tokens.push_back( token );
+            literal.clear();
+        }
+
+        CFormatToken token;
+        token.id   = field->id;
+        token.text = field->name;
+        token.min  = token.max = -1;
+        token.min_relative = token.max_relative = false;
+
+        i += 1 + strlen( field->name );
+
+        /**
+         * An optional "{min:N max:N}" specification.
+         */
+        if ( ( i < fmt.size() ) && ( fmt[i] == '{' ) )
+        {
+            size_t end = fmt.find( '}', i );
+            if ( end != std::string::npos )
+            {
+                std::string spec = fmt.substr( i + 1, end - i - 1 );
+
+                token.min = get_width( spec, "min", token.min_relative );
+                token.max = get_width( spec, "max", token.max_relative );
+
+                if ( token.min_relative || token.max_relative )
+                    m_relative = true;
+
+                i = end + 1;
+            }
+        }
+
+        m_tokens.push_back( token );
+    }
+
+    if ( ! literal.empty() )
+    {
+        CFormatToken token;
+        token.id   = FORMAT_LITERAL;
+        token.text = literal;
+        token.min  = token.max = -1;
+        token.min_relative = token.max_relative = false;
+
+        m_tokens.push_back( token );
+    }
+}
+
+
+/**
+ * Get the compiled form of the named variable.
+ */
+std::shared_ptr<CFormatTemplate> CFormatTemplate::for_variable( const std::string &name,
+                                                                const CFormatField *fields,
+                                                                bool header )
+{
+    CGlobal *global = CGlobal::Instance();
+
+    std::shared_ptr<CFormatTemplate> compiled = global->get_variable_template( name );
+    if ( compiled == NULL )
+    {
+        std::string *fmt = global->get_variable( name );
+
+        compiled = std::make_shared<CFormatTemplate>( fmt ? *fmt : "", fields, header );
+        global->set_variable_template( name, compiled );
+
+#ifdef LUMAIL_DEBUG
+        DEBUG_LOG( "CFormatTemplate::for_variable - compiled " + name );
+#endif
+    }
+
+    return( compiled );
+}
+
+
+/**
+ * Pad, or truncate, the UTF-8 text appended after `start`.
+ */
+void CFormatTemplate::fit( std::string &out, size_t start, const CFormatToken &token, int width )
+{
+    int min = token.min;
+    int max = token.max;
+
+    if ( token.min_relative && min > 0 )
+        min = min * width / 100;
+    if ( token.max_relative && max > 0 )
+        max = max * width / 100;
+
+    /**
+     * Make sure min is not greater than max.
+     */
+    if ( max >= 0 && min > max )
+        min = max;
+
+    /**
+     * Count the characters, truncating as soon as we pass the maximum.
+     */
+    int chars = 0;
+    for( size_t i = start; i < out.size(); i++ )
+    {
+        if ( ( out[i] & 0xC0 ) == 0x80 )
+            continue;
+
+        if ( max >= 0 && chars == max )
+        {
+            out.resize( i );
+            break;
+        }
+        chars++;
+    }
+
+    if ( chars < min )
+        out.append( min - chars, ' ' );
+}
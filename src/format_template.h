@@ -0,0 +1,166 @@
+/**
+ * format_template.h - Compiled format-strings, for index/maildir display.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/**
+ * The token-ID used for literal text.
+ */
+#define FORMAT_LITERAL 0
+
+/**
+ * The token-ID used for a bare "$Header-Name" format-string.
+ */
+#define FORMAT_HEADER -1
+
+
+/**
+ * A variable which may be expanded, e.g. { "FROM", 2 }.
+ *
+ * Tables of these are terminated by an entry with a NULL name.
+ */
+struct CFormatField
+{
+    const char *name;
+    int id;
+};
+
+
+/**
+ * A single step of a compiled format-string.
+ */
+struct CFormatToken
+{
+    /**
+     * FORMAT_LITERAL, FORMAT_HEADER, or the ID of a field.
+     */
+    int id;
+
+    /**
+     * The literal text, or the name of the header to lookup.
+     */
+    std::string text;
+
+    /**
+     * The minimum/maximum width of the expansion, -1 if unset.
+     */
+    int min;
+    int max;
+
+    /**
+     * Are the widths above percentages of the available width?
+     */
+    bool min_relative;
+    bool max_relative;
+};
+
+
+/**
+ * A format-string, such as "[$FLAGS] $FROM{min:20 max:20} - $SUBJECT",
+ * compiled into a list of tokens.
+ *
+ * The string is parsed once, and may then be expanded any number of
+ * times without searching for variable-names or re-reading the
+ * width-specifications.
+ */
+class CFormatTemplate
+{
+
+public:
+
+    /**
+     * Compile the given format-string, recognizing the given fields.
+     *
+     * If `header` is true a format-string which consists solely of an
+     * unknown "$Name" is treated as a lookup of the header "Name".
+     */
+    CFormatTemplate( const std::string &fmt, const CFormatField *fields, bool header = false );
+
+    /**
+     * Get the compiled form of the named variable, recompiling it only
+     * if the variable has been changed since we last did so.
+     */
+    static std::shared_ptr<CFormatTemplate> for_variable( const std::string &name,
+                                                          const CFormatField *fields,
+                                                          bool header = false );
+
+    /**
+     * Append the expansion of this template to `out`.
+     *
+     * The lookup function is invoked as lookup(token, out), and must
+     * append the value of token.id to out.  Percentage widths are
+     * relative to the given width.
+     */
+    template <typename F> void expand( std::string &out, int width, F lookup ) const
+    {
+        for (const CFormatToken &token : m_tokens)
+        {
+            if ( token.id == FORMAT_LITERAL )
+            {
+                out += token.text;
+                continue;
+            }
+
+            size_t start = out.size();
+            lookup( token, out );
+
+            if ( ( token.min > 0 ) || ( token.max >= 0 ) )
+                fit( out, start, token, width );
+        }
+    }
+
+    /**
+     * The source we were compiled from.
+     */
+    const std::string &source() const { return m_source; }
+
+    /**
+     * Does expanding this template depend upon the available width?
+     */
+    bool relative() const { return m_relative; }
+
+private:
+
+    /**
+     * Pad, or truncate, the text appended after `start` to the widths
+     * given by the token.
+     */
+    static void fit( std::string &out, size_t start, const CFormatToken &token, int width );
+
+private:
+
+    /**
+     * The format-string we were compiled from.
+     */
+    std::string m_source;
+
+    /**
+     * The compiled tokens.
+     */
+    std::vector<CFormatToken> m_tokens;
+
+    /**
+     * Do any of our tokens have percentage widths?
+     */
+    bool m_relative;
+};
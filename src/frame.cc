@@ -0,0 +1,404 @@
+/**
+ * frame.cc - A cell-grid of the main display area, drawn by difference.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#define _XOPEN_SOURCE_EXTENDED 1
+
+#include <cstdarg>
+#include <cstdio>
+#include <cursesw.h>
+#include <wchar.h>
+
+#include "frame.h"
+
+
+/**
+ * Instance-handle.
+ */
+CFrame *CFrame::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CFrame *CFrame::Instance()
+{
+    if (!pinstance)
+        pinstance = new CFrame;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is private as this class is a singleton.
+ */
+CFrame::CFrame()
+{
+    m_height  = 0;
+    m_width   = 0;
+    m_row     = 0;
+    m_col     = 0;
+    m_attr    = 0;
+    m_invalid = true;
+}
+
+
+/**
+ * Start a new, blank, frame.
+ */
+void CFrame::begin( int height, int width )
+{
+    if ( height < 0 )
+        height = 0;
+    if ( width < 0 )
+        width = 0;
+
+    if ( ( height != m_height ) || ( width != m_width ) )
+    {
+        m_height = height;
+        m_width  = width;
+
+        m_cells.assign( height * width, CCell() );
+        m_shown.assign( height * width, CCell() );
+        m_dirty.assign( height, true );
+        m_blank.assign( height, false );
+        m_invalid = true;
+    }
+
+    CCell blank;
+    blank.text = " ";
+    blank.attr = 0;
+
+    /**
+     * Rows which are blank on-screen are only dirty if they're drawn upon.
+     */
+    for( int row = 0; row < m_height; row++ )
+    {
+        m_dirty[row] = m_invalid || !m_blank[row];
+
+        for( int col = 0; col < m_width; col++ )
+            m_cells[row * m_width + col] = blank;
+    }
+
+    m_row  = 0;
+    m_col  = 0;
+    m_attr = 0;
+}
+
+
+/**
+ * Forget the previous frame.
+ */
+void CFrame::invalidate()
+{
+    m_invalid = true;
+}
+
+
+/**
+ * Move the cursor.
+ */
+void CFrame::position( int row, int col )
+{
+    m_row = row;
+    m_col = col;
+}
+
+
+/**
+ * Set the attributes of following text.
+ */
+void CFrame::set_attr( int attr )
+{
+    m_attr = attr;
+}
+
+
+/**
+ * Add to the attributes of following text.
+ *
+ * As with attron() a colour-pair replaces any current colour-pair.
+ */
+void CFrame::add_attr( int attr )
+{
+    if ( attr & A_COLOR )
+        m_attr = ( m_attr & ~A_COLOR ) | attr;
+    else
+        m_attr |= attr;
+}
+
+
+/**
+ * Draw formatted text at the cursor.
+ */
+void CFrame::print( const char *fmt, ... )
+{
+    char buf[1024];
+
+    va_list ap;
+    va_start( ap, fmt );
+    int len = vsnprintf( buf, sizeof(buf), fmt, ap );
+    va_end( ap );
+
+    if ( len < 0 )
+        return;
+
+    if ( len < (int)sizeof(buf) )
+    {
+        add( std::string( buf, len ) );
+        return;
+    }
+
+    /**
+     * Too large for our buffer, so format again into one large enough.
+     */
+    std::string large( len + 1, '\0' );
+
+    va_start( ap, fmt );
+    vsnprintf( &large[0], large.size(), fmt, ap );
+    va_end( ap );
+
+    large.resize( len );
+    add( large );
+}
+
+
+/**
+ * Draw UTF-8 text at the cursor.
+ *
+ * Control-characters are handled as curses would: newlines clear the
+ * rest of the row, tabs advance to the next tab-stop, and anything else
+ * is drawn as "^X".  Text which reaches the edge of the frame wraps onto
+ * the next row.
+ */
+void CFrame::add( const std::string &text )
+{
+    size_t i = 0;
+
+    while( ( i < text.size() ) && ( m_row < m_height ) )
+    {
+        unsigned char c = text[i];
+
+        /**
+         * Decode the next character, replacing anything malformed.
+         */
+        size_t len = 1;
+        wchar_t cp = c;
+        bool bad   = ( c >= 0x80 && c < 0xC0 );
+
+        if ( c >= 0xC0 )
+        {
+            len = ( c >= 0xF0 ) ? 4 : ( c >= 0xE0 ) ? 3 : 2;
+            cp  = c & ( 0x3F >> ( len - 1 ) );
+
+            for( size_t j = 1; j < len; j++ )
+            {
+                if ( ( i + j >= text.size() ) || ( ( text[i + j] & 0xC0 ) != 0x80 ) )
+                {
+                    len = j;
+                    bad = true;
+                    break;
+                }
+                cp = ( cp << 6 ) | ( text[i + j] & 0x3F );
+            }
+        }
+
+        std::string ch = bad ? "?" : text.substr( i, len );
+        if ( bad )
+            cp = L'?';
+        i += len;
+
+        if ( cp == L'\n' )
+        {
+            if ( m_row >= 0 )
+            {
+                for( int col = ( m_col > 0 ? m_col : 0 ); col < m_width; col++ )
+                    set_cell( m_row, col, " ", 0 );
+            }
+            newline();
+        }
+        else if ( cp == L'\t' )
+        {
+            do
+            {
+                put( " ", 1 );
+            }
+            while( ( m_col % 8 ) != 0 );
+        }
+        else if ( cp < 32 || cp == 127 )
+        {
+            put( "^", 1 );
+            put( std::string( 1, (char)( cp ^ 0x40 ) ), 1 );
+        }
+        else
+        {
+            int width = wcwidth( cp );
+
+            /**
+             * Combining characters join the previous cell.
+             */
+            if ( width == 0 )
+            {
+                if ( m_row >= 0 && m_col > 0 && m_col <= m_width )
+                    m_cells[m_row * m_width + m_col - 1].text += ch;
+                continue;
+            }
+
+            if ( width == 2 && m_width > 1 )
+                put( ch, 2 );
+            else
+                put( ch, 1 );
+        }
+    }
+}
+
+
+/**
+ * Store a single character at the cursor, wrapping if necessary.
+ */
+void CFrame::put( const std::string &text, int width )
+{
+    if ( m_col + width > m_width )
+        newline();
+
+    if ( ( m_row >= 0 ) && ( m_row < m_height ) && ( m_col >= 0 ) )
+    {
+        CCell *cells = &m_cells[m_row * m_width];
+
+        /**
+         * Don't leave half of a double-width character behind.
+         */
+        if ( m_col > 0 && cells[m_col].text.empty() )
+            set_cell( m_row, m_col - 1, " ", cells[m_col - 1].attr );
+        if ( m_col + width < m_width && cells[m_col + width].text.empty() )
+            set_cell( m_row, m_col + width, " ", cells[m_col + width].attr );
+
+        set_cell( m_row, m_col, text, m_attr );
+        if ( width == 2 )
+            set_cell( m_row, m_col + 1, "", m_attr );
+    }
+
+    m_col += width;
+    if ( m_col >= m_width )
+        newline();
+}
+
+
+/**
+ * Update a single cell.
+ */
+void CFrame::set_cell( int row, int col, const std::string &text, int attr )
+{
+    CCell &cell = m_cells[row * m_width + col];
+
+    cell.text = text;
+    cell.attr = attr;
+
+    if ( ! m_dirty[row] && ( cell != m_shown[row * m_width + col] ) )
+        m_dirty[row] = true;
+}
+
+
+/**
+ * Advance the cursor to the next row.
+ */
+void CFrame::newline()
+{
+    m_row += 1;
+    m_col  = 0;
+}
+
+
+/**
+ * Pass the changed cells to curses.
+ */
+bool CFrame::flush()
+{
+    bool drawn = false;
+
+    for( int row = 0; row < m_height; row++ )
+    {
+        if ( ! m_dirty[row] )
+            continue;
+
+        m_dirty[row] = false;
+
+        CCell *cells = &m_cells[row * m_width];
+        CCell *shown = &m_shown[row * m_width];
+
+        /**
+         * Find the span of the row which changed.
+         */
+        int first = 0;
+        int last  = m_width - 1;
+
+        if ( ! m_invalid )
+        {
+            while( first < m_width && cells[first] == shown[first] )
+                first++;
+            while( last > first && cells[last] == shown[last] )
+                last--;
+        }
+
+        if ( first >= m_width )
+            continue;
+
+        if ( first > 0 && cells[first].text.empty() )
+            first--;
+
+        /**
+         * Draw the span as runs of identical attributes.
+         */
+        int col = first;
+        while( col <= last )
+        {
+            int start = col;
+            int attr  = cells[col].attr;
+            std::string run;
+
+            while( col <= last && cells[col].attr == attr )
+            {
+                run += cells[col].text;
+                col++;
+            }
+
+            attrset( attr );
+            mvaddstr( row, start, run.c_str() );
+        }
+
+        /**
+         * This row is now on-screen.
+         */
+        bool blank = true;
+        for( int c = 0; c < m_width; c++ )
+        {
+            shown[c] = cells[c];
+            if ( cells[c].attr != 0 || cells[c].text != " " )
+                blank = false;
+        }
+        m_blank[row] = blank;
+
+        drawn = true;
+    }
+
+    if ( drawn )
+        attrset( A_NORMAL );
+
+    m_invalid = false;
+    return( drawn );
+}
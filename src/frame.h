@@ -0,0 +1,185 @@
+/**
+ * frame.h - A cell-grid of the main display area, drawn by difference.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/**
+ * A single character-cell of the screen.
+ */
+struct CCell
+{
+    /**
+     * The UTF-8 text of the cell.
+     *
+     * This is empty for the second column of a double-width character.
+     */
+    std::string text;
+
+    /**
+     * The curses attributes, including colour-pair, of the cell.
+     */
+    int attr;
+
+    bool operator==( const CCell &other ) const
+    {
+        return( ( attr == other.attr ) && ( text == other.text ) );
+    }
+    bool operator!=( const CCell &other ) const
+    {
+        return( !( *this == other ) );
+    }
+};
+
+
+/**
+ * The main display area, everything but the status-line, as a grid of
+ * cells.
+ *
+ * Each refresh the mode-drawers render a complete frame into this grid,
+ * using the same cursor/attribute model as curses.  flush() then compares
+ * it with the frame previously drawn, and passes only the cells which
+ * differ to curses - so an unchanged screen costs no drawing at all.
+ */
+class CFrame
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CFrame *Instance();
+
+    /**
+     * Start a new frame of the given size, with every cell blank.
+     *
+     * If the size differs from that of the previous frame then the
+     * whole of the next frame will be drawn.
+     */
+    void begin( int height, int width );
+
+    /**
+     * Forget the previous frame, because something other than us has
+     * drawn upon the screen.  The whole of the next frame will be drawn.
+     */
+    void invalidate();
+
+    /**
+     * Move the cursor, as move().
+     */
+    void position( int row, int col );
+
+    /**
+     * Set the attributes of following text, as attrset().
+     */
+    void set_attr( int attr );
+
+    /**
+     * Add to the attributes of following text, as attron().
+     */
+    void add_attr( int attr );
+
+    /**
+     * Draw text at the cursor, as printw().
+     */
+    void print( const char *fmt, ... ) __attribute__ ((format (printf, 2, 3)));
+
+    /**
+     * Draw the given UTF-8 text at the cursor, as addstr().
+     */
+    void add( const std::string &text );
+
+    /**
+     * Pass the cells which have changed since the previous frame to curses.
+     *
+     * Returns true if anything was drawn.
+     */
+    bool flush();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CFrame();
+    CFrame(const CFrame &);
+    CFrame & operator=(const CFrame &);
+
+private:
+
+    /**
+     * Store a single character, of the given width, at the cursor.
+     */
+    void put( const std::string &text, int width );
+
+    /**
+     * Set the cell at the given position, noting the row is dirty if it
+     * differs from what is on-screen.
+     */
+    void set_cell( int row, int col, const std::string &text, int attr );
+
+    /**
+     * Advance the cursor to the next row.
+     */
+    void newline();
+
+private:
+
+    /**
+     * The single instance of this object.
+     */
+    static CFrame *pinstance;
+
+    /**
+     * The dimensions of the frame.
+     */
+    int m_height;
+    int m_width;
+
+    /**
+     * The cursor position, and current attributes.
+     */
+    int m_row;
+    int m_col;
+    int m_attr;
+
+    /**
+     * The frame being drawn, and the frame which is on-screen.
+     */
+    std::vector<CCell> m_cells;
+    std::vector<CCell> m_shown;
+
+    /**
+     * Rows of m_cells which might differ from m_shown.
+     */
+    std::vector<bool> m_dirty;
+
+    /**
+     * Rows of m_shown which are entirely blank.
+     */
+    std::vector<bool> m_blank;
+
+    /**
+     * Is m_shown unknown, so that everything must be drawn?
+     */
+    bool m_invalid;
+};
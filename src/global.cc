@@ -21,9 +21,9 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <pcrecpp.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unordered_set>
 
 
 #include <sys/ioctl.h>
@@ -32,11 +32,17 @@
 
 #include "debug.h"
 #include "file.h"
+#include "format_template.h"
 #include "global.h"
+#include "header_cache.h"
+#include "header_prefetch.h"
 #include "lua.h"
 #include "maildir.h"
 #include "message.h"
+#include "message_sort.h"
+#include "regexp_cache.h"
 #include "util.h"
+#include "watcher.h"
 
 /**
  * Instance-handle.
@@ -68,6 +74,7 @@ CGlobal::CGlobal()
     m_msg_offset     = 0;
     m_text_offset    = 0;
     m_messages       = NULL;
+    m_all_messages   = NULL;
     m_maildirs       = NULL;
 
     /**
@@ -77,11 +84,14 @@ CGlobal::CGlobal()
     set_variable( "display_filter",         new std::string("") );
     set_variable( "editor",                 new std::string("/usr/bin/vim") );
     set_variable( "global_mode",            new std::string("maildir"));
+    set_variable( "header_cache",           new std::string( "" ) );
     set_variable( "history_file",           new std::string( "" ) );
     set_variable( "index_format",           new std::string( "[$FLAGS] $FROM - $SUBJECT" ) );
     set_variable( "index_highlight_mode",   new std::string( "standout" ) );
     set_variable( "index_limit",            new std::string("all") );
     set_variable( "mail_filter",            new std::string("") );
+    set_variable( "message_cache_entries",  new std::string( "16" ) );
+    set_variable( "message_cache_size",     new std::string( "32M" ) );
     set_variable( "maildir_format",         new std::string( "$CHECK - $PATH" ) );
     set_variable( "maildir_highlight_mode", new std::string( "standout" ) );
     set_variable( "maildir_limit",          new std::string("all") );
@@ -136,140 +146,6 @@ CGlobal::CGlobal()
  */
 
 
-/**
- * Sort CMessages, by the user-selected criterion.
- */
-bool sort_messages(std::shared_ptr<CMessage> a, std::shared_ptr<CMessage> b)
-{
-    assert( NULL != a );
-    assert( NULL != b );
-
-    /**
-     * Get the type of sort.
-     */
-    CGlobal   *global = CGlobal::Instance();
-    std::string *sort = global->get_variable("sort");
-
-    /**
-     * Sort by date.  Default if nothing is explicitly set.
-     */
-    if ( ( sort->empty() ) ||
-         ( strcmp( sort->c_str(), "date-asc" ) == 0 ) ||
-         ( strcmp( sort->c_str(), "date-desc" ) == 0 ) )
-    {
-        bool asc = true;
-
-        /**
-         * Are we descending?
-         */
-        if  ( ( ! sort->empty() ) && ( strcmp( sort->c_str(), "date-desc" ) == 0 ) )
-            asc = false;
-
-        if ( asc )
-            return (a->mtime() < b->mtime());
-        else
-            return (b->mtime() < a->mtime());
-
-    }
-
-    /**
-     * Sort by subject, asc/desc.
-     */
-    if (  ( !sort->empty() ) &&
-          ( ( strcmp(sort->c_str(), "subject" ) == 0 )  ||
-            ( strcmp(sort->c_str(), "subject-asc" ) == 0 )  ||
-            ( strcmp(sort->c_str(), "subject-desc" ) == 0 )  ) )
-    {
-
-        bool asc = true;
-
-        /**
-         * Are we descending?
-         */
-        if  ( ( ! sort->empty() ) && ( strcmp( sort->c_str(), "subject-desc" ) == 0 ) )
-            asc = false;
-
-        std::string as = a->header("Subject");
-        std::string bs = b->header("Subject");
-
-        if ( ! asc )
-        {
-            std::string tmp = as;
-            as = bs;
-            bs = tmp;
-        }
-
-        std::transform(as.begin(), as.end(), as.begin(), tolower);
-        std::transform(bs.begin(), bs.end(), bs.begin(), tolower);
-
-        return( strcmp( as.c_str(), bs.c_str() ) < 0 );
-    }
-
-    /**
-     * Sort by sender, asc/desc.
-     */
-    if (  ( !sort->empty() ) &&
-          ( ( strcmp(sort->c_str(), "from" ) == 0 )  ||
-            ( strcmp(sort->c_str(), "from-asc" ) == 0 )  ||
-            ( strcmp(sort->c_str(), "from-desc" ) == 0 )  ) )
-    {
-
-        bool asc = true;
-
-        /**
-         * Are we descending?
-         */
-        if  ( ( sort != NULL ) && ( strcmp( sort->c_str(), "from-desc" ) == 0 ) )
-            asc = false;
-
-        std::string as = a->header("From");
-        std::string bs = b->header("From");
-
-        if ( ! asc )
-        {
-            std::string tmp = as;
-            as = bs;
-            bs = tmp;
-        }
-
-        std::transform(as.begin(), as.end(), as.begin(), tolower);
-        std::transform(bs.begin(), bs.end(), bs.begin(), tolower);
-
-        return( strcmp( as.c_str(), bs.c_str() ) < 0 );
-    }
-
-
-    /**
-     * Sort by the date-header
-     */
-    if (  ( ! sort->empty() ) &&
-          ( ( strcmp(sort->c_str(), "header" ) == 0 )  ||
-            ( strcmp(sort->c_str(), "header-asc" ) == 0 )  ||
-            ( strcmp(sort->c_str(), "header-desc" ) == 0 )  ) )
-    {
-
-        bool asc = true;
-
-        /**
-         * Are we descending?
-         */
-        if  ( ( sort != NULL ) && ( strcmp( sort->c_str(), "header-desc" ) == 0 ) )
-            asc = false;
-
-        time_t at = a->get_date_field();
-        time_t bt = b->get_date_field();
-
-        if ( asc )
-            return ( at < bt );
-        else
-            return ( bt < at );
-
-    }
-
-    return false;
-}
-
-
 /**
  * Sort maildirs by name, case-insensitively.
  */
@@ -350,12 +226,22 @@ CMaildirList CGlobal::get_folders()
 /**
  * Get all messages from the currently selected folders.
  */
-CMessageList * CGlobal::get_messages()
+CMessageView * CGlobal::get_messages()
 {
     return( m_messages );
 }
 
 
+/**
+ * Get all messages from the currently selected folders, regardless of
+ * `index_limit`.
+ */
+CMessageList * CGlobal::get_all_messages()
+{
+    return( m_all_messages );
+}
+
+
 /**
  * Update the list of global Maildirs.
  */
@@ -394,24 +280,10 @@ void CGlobal::update_maildirs()
     std::vector<UTFString> prefixes = CUtil::split( prefix->c_str(), '|' );
 
     /**
-     * We'll store each maildir here.
+     * Find the folders beneath each prefix, which are scanned in parallel.
      */
-    std::vector<std::string> folders;
-
-    /**
-     * For each maildir prefix we have add in the folders we've found.
-     */
-    for (std::string path : prefixes)
-    {
-        DEBUG_LOG( "Handling maildir_prefix " + path );
-        /**
-         * Get the folders, and merge in.
-         */
-        std::vector<std::string> tmp = CFile::get_all_maildirs(path);
-
-        for (std::string t : tmp)
-            folders.push_back( t );
-    }
+    std::vector<std::string> roots( prefixes.begin(), prefixes.end() );
+    std::vector<std::string> folders = CFile::get_all_maildirs( roots );
 
 
 
@@ -444,7 +316,7 @@ void CGlobal::update_maildirs()
                 /**
                  * Perform the regex matching, via PCRE.
                  */
-                if (pcrecpp::RE(reg, pcrecpp::RE_Options().set_caseless(true)).PartialMatch(path) )
+                if ( CRegexpCache::Instance()->partial_match( reg, path ) )
                     ignore = true;
             }
 
@@ -462,31 +334,43 @@ void CGlobal::update_maildirs()
      */
     std::sort(m_maildirs->begin(), m_maildirs->end(), sort_maildir_ptr_by_name);
 
+    /**
+     * Watch each of the maildirs for changes.
+     */
+    std::vector<std::string> paths;
+    for (std::shared_ptr<CMaildir> maildir : (*m_maildirs))
+        paths.push_back( maildir->path() );
+
+    CWatcher *watcher = CWatcher::Instance();
+    watcher->watch_maildirs( paths );
 }
 
 
 /**
  * Update the list of global messages, using the index_limit string set by lua.
+ *
+ * Each selected folder is rescanned against its snapshot, so that only
+ * messages which were added, removed, or renamed need to be handled.  If
+ * the selection and sort are unchanged then the sorted list of all
+ * messages is updated in-place, otherwise it is rebuilt from the
+ * snapshots.  The visible messages are then derived from that list.
  */
 void CGlobal::update_messages()
 {
 
     DEBUG_LOG( "CGlobal::update_messages" );
 
-
     /**
-     * If we have items already then free each of them.
+     * Persist any headers we parsed from the previous selection.
      */
-    if ( m_messages != NULL )
-    {
-        delete( m_messages );
-        m_messages = NULL;
-    }
+    CHeaderCache *cache = CHeaderCache::Instance();
+    cache->sync();
 
     /**
-     * create a new store.
+     * Account for changes the watcher has seen but not yet reported,
+     * such as those the caller has just made.
      */
-    m_messages = new CMessageList;
+    CWatcher::Instance()->process();
 
     /**
      * Get the selected maildirs.
@@ -494,37 +378,305 @@ void CGlobal::update_messages()
     CGlobal *global = CGlobal::Instance();
     std::vector<std::string> folders = global->get_selected_folders();
     std::string * filter = global->get_variable("index_limit" );
+    std::string * sort   = global->get_variable("sort" );
 
+    /**
+     * Forget the snapshots of folders which are no longer selected.
+     */
+    for (auto it = m_snapshots.begin(); it != m_snapshots.end(); )
+    {
+        if ( std::find( folders.begin(), folders.end(), it->first ) == folders.end() )
+            it = m_snapshots.erase( it );
+        else
+            ++it;
+    }
 
     /**
-     * For each selected maildir read the messages.
+     * Can we update the current list in-place?
      */
+    bool incremental = ( m_messages != NULL ) &&
+        ( folders == m_messages_folders ) &&
+        ( *sort == m_messages_sort );
+
+    /**
+     * For each selected maildir bring the snapshot up to date.
+     */
+    CMessageList added;
+    CMessageList removed;
+    CMessageList renamed;
+
     for (std::string folder : folders)
+    {
+        CMaildir tmp = CMaildir(folder);
+        CMaildirSnapshot &snapshot = m_snapshots[folder];
+
+        if ( tmp.rescan( snapshot, added, removed, renamed ) && cache->enabled() )
+        {
+            /**
+             * Forget any cached headers for messages which have gone away.
+             */
+            std::vector<std::string> paths;
+            for (std::shared_ptr<CMessage> content : snapshot.order)
+                paths.push_back( content->path() );
+
+            cache->expire( folder, paths );
+        }
+    }
+
+    if ( incremental )
     {
         /**
-         * get the messages from this folder.
+         * If nothing changed on-disk, and the limit is the same, then
+         * there is nothing to do.
          */
-        CMaildir tmp = CMaildir(folder);
-        CMessageList contents = tmp.getMessages();
+        if ( added.empty() && removed.empty() && renamed.empty() )
+        {
+            if ( *filter != m_messages_limit )
+                filter_messages();
+            return;
+        }
+
+        DEBUG_LOG( "CGlobal::update_messages - updating in-place" );
 
         /**
-         * Append to the list of messages combined.
+         * Note which messages are visible, so that only the new ones
+         * need to be tested against the limit.
          */
-        for (std::shared_ptr<CMessage> content: contents)
+        std::unordered_set<CMessage *> visible;
+        if ( *filter == m_messages_limit )
         {
-            if ( content->matches_filter( filter ) )
-                m_messages->push_back(content) ;
+            for (size_t i = 0; i < m_messages->size(); i++)
+                visible.insert( m_messages->at( i ).get() );
         }
 
         /**
-         * Sort?
+         * A renamed message might no longer match the limit, so we remove
+         * it and re-add it.
          */
-        std::sort(m_messages->begin(), m_messages->end(), sort_messages);
+        std::unordered_set<CMessage *> gone;
+        for (std::shared_ptr<CMessage> msg : removed)
+            gone.insert( msg.get() );
+        for (std::shared_ptr<CMessage> msg : renamed)
+            gone.insert( msg.get() );
+
+        if ( ! gone.empty() )
+        {
+            for (CMessage *msg : gone)
+                visible.erase( msg );
+
+            m_all_messages->erase( std::remove_if( m_all_messages->begin(), m_all_messages->end(),
+                                                   [&gone](const std::shared_ptr<CMessage> &m)
+                                                   { return( gone.find( m.get() ) != gone.end() ); } ),
+                                   m_all_messages->end() );
+        }
+
+        added.insert( added.end(), renamed.begin(), renamed.end() );
+
+        /**
+         * If the headers are still being read then the list is in its
+         * provisional order, and the new messages must be placed likewise.
+         */
+        CHeaderPrefetch *prefetch = CHeaderPrefetch::Instance();
+
+        CMessageSorter sorter( *sort );
+        bool provisional = sorter.needs_headers() && prefetch->active();
+        sorter.set_provisional( provisional );
+
+        for (std::shared_ptr<CMessage> content : added)
+        {
+            CMessageList::iterator pos = std::upper_bound( m_all_messages->begin(), m_all_messages->end(), content,
+                                                           [&sorter](std::shared_ptr<CMessage> a, std::shared_ptr<CMessage> b)
+                                                           { return( sorter.less( a, b ) ); } );
+            m_all_messages->insert( pos, content );
+
+            if ( ( *filter == m_messages_limit ) && content->matches_filter( filter ) )
+                visible.insert( content.get() );
+        }
+
+        if ( *filter == m_messages_limit )
+        {
+            m_messages->clear();
+            for (size_t i = 0; i < m_all_messages->size(); i++)
+            {
+                if ( visible.find( m_all_messages->at( i ).get() ) != visible.end() )
+                    m_messages->push_back( i );
+            }
+        }
+        else
+            filter_messages();
+
+        /**
+         * Read the headers of the new messages too, along with those the
+         * current run hasn't yet reached.
+         */
+        if ( ! added.empty() )
+        {
+            prefetch->start( m_messages, get_selected_message() );
+
+            if ( provisional )
+            {
+                if ( prefetch->active() )
+                    prefetch->resort_when_done();
+                else
+                    resort_messages();
+            }
+        }
+
+        return;
     }
 
+    /**
+     * create a new store.
+     */
+    if ( m_all_messages == NULL )
+        m_all_messages = new CMessageList;
+    if ( m_messages == NULL )
+        m_messages = new CMessageView( m_all_messages );
 
+    /**
+     * Sort each folder, and merge the results.
+     */
+    std::vector<CMessageList> lists( folders.size() );
+
+    for( size_t i = 0; i < folders.size(); i++ )
+        lists[i] = m_snapshots[folders[i]].order;
+
+    /**
+     * If the sort needs headers, and they can be read in the background,
+     * then sort provisionally, by mtime, rather than waiting for them.
+     */
+    CHeaderPrefetch *prefetch = CHeaderPrefetch::Instance();
+
+    CMessageSorter sorter( *sort );
+    bool provisional = sorter.needs_headers() && prefetch->enabled();
+    sorter.set_provisional( provisional );
+    sorter.sort( lists, *m_all_messages );
+
+    m_messages_folders = folders;
+    m_messages_sort    = *sort;
+
+    filter_messages();
+
+    /**
+     * Read the headers of the visible messages in the background, and
+     * correct the order as they arrive.
+     */
+    prefetch->start( m_messages, get_selected_message() );
+
+    if ( provisional )
+    {
+        if ( prefetch->active() )
+            prefetch->resort_when_done();
+        else
+            resort_messages();
+    }
 }
 
+
+/**
+ * Update the visible messages, after `index_limit` has changed.
+ *
+ * This only consults the messages we already hold, and doesn't rescan
+ * the selected folders.
+ */
+void CGlobal::filter_messages()
+{
+    if ( m_messages == NULL )
+    {
+        update_messages();
+        return;
+    }
+
+    DEBUG_LOG( "CGlobal::filter_messages" );
+
+    std::string *filter = get_variable( "index_limit" );
+
+    m_messages->clear();
+    for (size_t i = 0; i < m_all_messages->size(); i++)
+    {
+        if ( m_all_messages->at( i )->matches_filter( filter ) )
+            m_messages->push_back( i );
+    }
+
+    m_messages_limit = *filter;
+}
+
+
+/**
+ * Reorder the global list of messages, after `sort` has changed.
+ *
+ * The messages already hold the headers & dates we sort by, so there
+ * is no need to rescan the selected folders, or to apply the limit
+ * again.  The selected message remains selected.
+ */
+void CGlobal::resort_messages()
+{
+    if ( m_messages == NULL )
+    {
+        update_messages();
+        return;
+    }
+
+    DEBUG_LOG( "CGlobal::resort_messages" );
+
+    std::string *sort = get_variable( "sort" );
+
+    /**
+     * Remember the selected message, and the visible ones.
+     */
+    std::shared_ptr<CMessage> selected = NULL;
+    int offset = get_selected_message();
+    if ( ( offset >= 0 ) && ( offset < (int)m_messages->size() ) )
+        selected = m_messages->at( offset );
+
+    std::unordered_set<CMessage *> visible;
+    for (size_t i = 0; i < m_messages->size(); i++)
+        visible.insert( m_messages->at( i ).get() );
+
+    /**
+     * Sort the complete list.  If we're still reading headers in the
+     * background then the sort is provisional, and will be repeated once
+     * they have all arrived.
+     */
+    std::vector<CMessageList> lists( 1 );
+    lists[0].swap( *m_all_messages );
+
+    CHeaderPrefetch *prefetch = CHeaderPrefetch::Instance();
+
+    CMessageSorter sorter( *sort );
+    if ( sorter.needs_headers() && prefetch->active() )
+    {
+        sorter.set_provisional( true );
+        prefetch->resort_when_done();
+    }
+    sorter.sort( lists, *m_all_messages );
+
+    m_messages_sort = *sort;
+
+    /**
+     * Rebuild the view, and find the selected message again.
+     */
+    int position = -1;
+
+    m_messages->clear();
+    for (size_t i = 0; i < m_all_messages->size(); i++)
+    {
+        CMessage *msg = m_all_messages->at( i ).get();
+
+        if ( visible.find( msg ) != visible.end() )
+        {
+            if ( msg == selected.get() )
+                position = m_messages->size();
+
+            m_messages->push_back( i );
+        }
+    }
+
+    if ( position >= 0 )
+        set_selected_message( position );
+}
+
+
 /**
  * Remove all selected folders.
  */
@@ -628,6 +780,7 @@ void CGlobal::set_variable( std::string name, std::string *value )
      * Store new value.
      */
     m_variables[ name ] = value;
+    m_variable_generations[ name ] += 1;
 
 #ifdef LUMAIL_DEBUG
     std::string dm = "Set variable named '" ;
@@ -641,6 +794,42 @@ void CGlobal::set_variable( std::string name, std::string *value )
 }
 
 
+/**
+ * Get the number of times the named variable has been set.
+ */
+unsigned long CGlobal::get_variable_generation( const std::string &name )
+{
+    std::unordered_map<std::string, unsigned long>::iterator it = m_variable_generations.find( name );
+    if ( it == m_variable_generations.end() )
+        return 0;
+
+    return( it->second );
+}
+
+
+/**
+ * Get the compiled template for the named variable, if it is current.
+ */
+std::shared_ptr<CFormatTemplate> CGlobal::get_variable_template( const std::string &name )
+{
+    auto it = m_variable_templates.find( name );
+    if ( ( it == m_variable_templates.end() ) ||
+         ( it->second.first != get_variable_generation( name ) ) )
+        return NULL;
+
+    return( it->second.second );
+}
+
+
+/**
+ * Store the compiled template for the named variable.
+ */
+void CGlobal::set_variable_template( const std::string &name, std::shared_ptr<CFormatTemplate> compiled )
+{
+    m_variable_templates[name] = std::make_pair( get_variable_generation( name ), compiled );
+}
+
+
 /**
  * Return our map of variables to the caller.
  */
@@ -683,7 +872,7 @@ bool CGlobal::setup_domain_socket( std::string path )
         return false;
     }
 
-    if (listen(m_domain_socket, 1) == -1)
+    if (listen(m_domain_socket, SOMAXCONN) == -1)
     {
         return false;
     }
@@ -23,11 +23,14 @@
 #include <vector>
 #include <memory>
 
+#include "maildir.h"
+#include "message_view.h"
+
 /**
  * Forward declaration of classes.
  */
-class CMaildir;
 class CMessage;
+class CFormatTemplate;
 
 /**
  * A singleton class to store global data:
@@ -68,13 +71,29 @@ public:
     /**
      * Get all messages from the currently-selected folders.
      */
-    std::vector<std::shared_ptr<CMessage> > *get_messages();
+    CMessageView *get_messages();
+
+    /**
+     * Get all messages from the currently-selected folders, regardless
+     * of `index_limit`.
+     */
+    CMessageList *get_all_messages();
 
     /**
      * Update the global list of messages.
      */
     void update_messages();
 
+    /**
+     * Reorder the global list of messages, after `sort` has changed.
+     */
+    void resort_messages();
+
+    /**
+     * Update the visible messages, after `index_limit` has changed.
+     */
+    void filter_messages();
+
 
     /**
      * Update the global list of Maildirs.
@@ -232,6 +251,24 @@ public:
      */
     void set_variable( std::string name, std::string *value );
 
+    /**
+     * Get the number of times the named variable has been set, so that
+     * values derived from it may be recomputed only when it changes.
+     */
+    unsigned long get_variable_generation( const std::string &name );
+
+    /**
+     * Get the compiled template for the named variable, or NULL if it
+     * hasn't been compiled since the variable last changed.
+     */
+    std::shared_ptr<CFormatTemplate> get_variable_template( const std::string &name );
+
+    /**
+     * Store the compiled template for the current value of the named
+     * variable.
+     */
+    void set_variable_template( const std::string &name, std::shared_ptr<CFormatTemplate> compiled );
+
     /**
      * Get the table of all known settings.
      */
@@ -280,9 +317,29 @@ private:
     std::vector < std::string > m_selected_folders;
 
     /**
-     * The list of currently visible messages.
+     * All the messages in the selected folders, sorted.
+     */
+    CMessageList *m_all_messages;
+
+    /**
+     * The currently visible messages, i.e. those of m_all_messages
+     * which match the index_limit.
      */
-    std::vector<std::shared_ptr<CMessage> > *m_messages;
+    CMessageView *m_messages;
+
+    /**
+     * Snapshots of the contents of each selected folder, used to update
+     * the list of messages without discarding the existing objects.
+     */
+    std::unordered_map<std::string, CMaildirSnapshot> m_snapshots;
+
+    /**
+     * The folders, limit, and sort, which m_all_messages and m_messages
+     * were built from.
+     */
+    std::vector<std::string> m_messages_folders;
+    std::string m_messages_limit;
+    std::string m_messages_sort;
 
     /**
      * The list of all currently visible maildirs.
@@ -294,6 +351,17 @@ private:
      */
     std::unordered_map<std::string, std::string *> m_variables;
 
+    /**
+     * The number of times each setting has been changed.
+     */
+    std::unordered_map<std::string, unsigned long> m_variable_generations;
+
+    /**
+     * The compiled templates of format-variables, along with the
+     * generation of the variable each was compiled from.
+     */
+    std::unordered_map<std::string, std::pair<unsigned long, std::shared_ptr<CFormatTemplate> > > m_variable_templates;
+
     /**
      * The handle to the domain-socket.
      */
@@ -0,0 +1,591 @@
+/**
+ * header_cache.cc - Persistent, per-maildir, cache of message headers.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "file.h"
+#include "global.h"
+#include "header_cache.h"
+#include "maildir.h"
+
+
+/**
+ * The magic string which begins each index-file.
+ *
+ * Bump the version if the format changes and old indexes will be
+ * silently discarded.
+ */
+#define HEADER_CACHE_MAGIC "lumail-header-cache\t1"
+
+
+/**
+ * Instance-handle.
+ */
+CHeaderCache *CHeaderCache::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CHeaderCache *CHeaderCache::Instance()
+{
+    if (!pinstance)
+        pinstance = new CHeaderCache;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is private as this class is a singleton.
+ */
+CHeaderCache::CHeaderCache()
+{
+}
+
+
+
+/*****
+ *
+ * Static helpers.  Not exported or visible outside this unit.
+ *
+ */
+
+
+/**
+ * Escape a value such that it may be stored upon a single line,
+ * in a tab-separated record.
+ */
+static std::string escape_value( const std::string &input )
+{
+    std::string result;
+    result.reserve( input.size() );
+
+    for( char c : input )
+    {
+        switch( c )
+        {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        case '\r':
+            result += "\\r";
+            break;
+        default:
+            result += c;
+        }
+    }
+    return( result );
+}
+
+
+/**
+ * Reverse the escaping performed by escape_value.
+ */
+static std::string unescape_value( const std::string &input )
+{
+    std::string result;
+    result.reserve( input.size() );
+
+    for( size_t i = 0; i < input.size(); i++ )
+    {
+        if ( ( input[i] == '\\' ) && ( i + 1 < input.size() ) )
+        {
+            i++;
+            switch( input[i] )
+            {
+            case 't':
+                result += '\t';
+                break;
+            case 'n':
+                result += '\n';
+                break;
+            case 'r':
+                result += '\r';
+                break;
+            default:
+                result += input[i];
+            }
+        }
+        else
+            result += input[i];
+    }
+    return( result );
+}
+
+
+/**
+ * Split a line by TAB characters.
+ */
+static std::vector<std::string> split_fields( const std::string &line )
+{
+    std::vector<std::string> fields;
+
+    size_t start = 0;
+    size_t end   = 0;
+
+    while( ( end = line.find( '\t', start ) ) != std::string::npos )
+    {
+        fields.push_back( line.substr( start, end - start ) );
+        start = end + 1;
+    }
+    fields.push_back( line.substr( start ) );
+
+    return( fields );
+}
+
+
+
+/**
+ * Set the directory to store our index-files in.
+ */
+void CHeaderCache::set_directory( std::string path )
+{
+    /**
+     * Write out anything pending beneath the previous location.
+     */
+    sync();
+    m_folders.clear();
+
+    m_directory = path;
+
+    if ( m_directory.empty() )
+        return;
+
+    /**
+     * Create the directory, if it is missing.
+     */
+    if ( ! CFile::is_directory( m_directory ) )
+    {
+        if ( mkdir( m_directory.c_str(), 0700 ) != 0 )
+        {
+            DEBUG_LOG( "CHeaderCache::set_directory - failed to create " + m_directory );
+            m_directory = "";
+        }
+    }
+}
+
+
+/**
+ * Is caching enabled?
+ */
+bool CHeaderCache::enabled()
+{
+    return( ! m_directory.empty() );
+}
+
+
+/**
+ * Split a message path into the maildir, and the unique filename stem.
+ *
+ * e.g. "/home/foo/Maildir/bar/cur/1234.host:2,S" becomes
+ * "/home/foo/Maildir/bar" + "1234.host".
+ */
+bool CHeaderCache::split_path( const std::string &path, std::string &maildir, std::string &stem )
+{
+    size_t slash = path.find_last_of( '/' );
+    if ( ( slash == std::string::npos ) || ( slash < 4 ) )
+        return false;
+
+    /**
+     * The parent must be cur/ or new/.
+     */
+    size_t parent = path.find_last_of( '/', slash - 1 );
+    if ( parent == std::string::npos )
+        return false;
+
+    std::string sub = path.substr( parent + 1, slash - parent - 1 );
+    if ( ( sub != "cur" ) && ( sub != "new" ) )
+        return false;
+
+    maildir = path.substr( 0, parent );
+    stem    = CMaildir::stem( path );
+
+    return( ! stem.empty() );
+}
+
+
+/**
+ * Lookup the cached entry for the given message.
+ */
+bool CHeaderCache::lookup( std::string path, ino_t inode, off_t size, time_t mtime,
+                           std::unordered_map<std::string, UTFString> &headers, time_t &date )
+{
+    if ( ! enabled() )
+        return false;
+
+    std::string maildir;
+    std::string stem;
+    if ( ! split_path( path, maildir, stem ) )
+        return false;
+
+    CHeaderCacheFolder *f = folder( maildir );
+
+    std::unordered_map<std::string, CHeaderCacheEntry>::iterator it = f->entries.find( stem );
+    if ( it == f->entries.end() )
+        return false;
+
+    /**
+     * If the file has changed then the entry is stale.
+     */
+    CHeaderCacheEntry &entry = it->second;
+    if ( ( entry.inode != inode ) ||
+         ( entry.size != size ) ||
+         ( entry.mtime != mtime ) )
+    {
+        DEBUG_LOG( "CHeaderCache::lookup - stale entry for " + path );
+        f->entries.erase( it );
+        f->dirty = true;
+        return false;
+    }
+
+    for( auto it = entry.headers.begin(); it != entry.headers.end(); ++it )
+        headers[it->first] = it->second;
+
+    if ( entry.date != 0 )
+        date = entry.date;
+
+    return true;
+}
+
+
+/**
+ * Store the headers for the given message.
+ */
+void CHeaderCache::store( std::string path, ino_t inode, off_t size, time_t mtime,
+                          const std::unordered_map<std::string, UTFString> &headers, time_t date )
+{
+    if ( ! enabled() )
+        return;
+
+    std::string maildir;
+    std::string stem;
+    if ( ! split_path( path, maildir, stem ) )
+        return;
+
+    update_wanted();
+
+    CHeaderCacheEntry entry;
+    entry.inode = inode;
+    entry.size  = size;
+    entry.mtime = mtime;
+    entry.date  = date;
+
+    /**
+     * Store only the headers we're interested in.  A missing header is
+     * stored as empty, which is what CMessage::header() would return.
+     */
+    for( std::string name : m_wanted )
+    {
+        std::unordered_map<std::string, UTFString>::const_iterator it = headers.find( name );
+        if ( it != headers.end() )
+            entry.headers[name] = it->second;
+        else
+            entry.headers[name] = "";
+    }
+
+    CHeaderCacheFolder *f = folder( maildir );
+    f->entries[stem] = entry;
+    f->dirty = true;
+}
+
+
+/**
+ * Update the parsed date of an existing entry.
+ */
+void CHeaderCache::store_date( std::string path, ino_t inode, off_t size, time_t mtime, time_t date )
+{
+    if ( ! enabled() )
+        return;
+
+    std::string maildir;
+    std::string stem;
+    if ( ! split_path( path, maildir, stem ) )
+        return;
+
+    CHeaderCacheFolder *f = folder( maildir );
+
+    std::unordered_map<std::string, CHeaderCacheEntry>::iterator it = f->entries.find( stem );
+    if ( it == f->entries.end() )
+        return;
+
+    CHeaderCacheEntry &entry = it->second;
+    if ( ( entry.inode == inode ) &&
+         ( entry.size == size ) &&
+         ( entry.mtime == mtime ) &&
+         ( entry.date != date ) )
+    {
+        entry.date = date;
+        f->dirty   = true;
+    }
+}
+
+
+/**
+ * Remove stale entries from the index of the given maildir.
+ */
+void CHeaderCache::expire( std::string maildir, const std::vector<std::string> &paths )
+{
+    if ( ! enabled() )
+        return;
+
+    std::unordered_set<std::string> present;
+    for( std::string path : paths )
+    {
+        std::string md;
+        std::string stem;
+        if ( split_path( path, md, stem ) )
+            present.insert( stem );
+    }
+
+    CHeaderCacheFolder *f = folder( maildir );
+
+    for( auto it = f->entries.begin(); it != f->entries.end(); )
+    {
+        if ( present.find( it->first ) == present.end() )
+        {
+            it = f->entries.erase( it );
+            f->dirty = true;
+        }
+        else
+            ++it;
+    }
+}
+
+
+/**
+ * Write all modified indexes to disk.
+ */
+void CHeaderCache::sync()
+{
+    if ( ! enabled() )
+        return;
+
+    for( auto it = m_folders.begin(); it != m_folders.end(); ++it )
+    {
+        if ( it->second.dirty )
+            save( it->first, it->second );
+    }
+}
+
+
+/**
+ * Find the loaded index of the given maildir, loading it if required.
+ */
+CHeaderCache::CHeaderCacheFolder *CHeaderCache::folder( const std::string &maildir )
+{
+    std::unordered_map<std::string, CHeaderCacheFolder>::iterator it = m_folders.find( maildir );
+    if ( it != m_folders.end() )
+        return( &it->second );
+
+    CHeaderCacheFolder &f = m_folders[maildir];
+    f.dirty = false;
+    load( maildir, f );
+
+    return( &f );
+}
+
+
+/**
+ * The filename of the index for the given maildir.
+ *
+ * We use a FNV-1a hash of the path, as it is stable across builds.
+ */
+std::string CHeaderCache::index_file( const std::string &maildir )
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for( unsigned char c : maildir )
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    char name[32] = { '\0' };
+    snprintf( name, sizeof(name)-1, "%016llx", (unsigned long long)hash );
+
+    return( m_directory + "/" + name );
+}
+
+
+/**
+ * Load the index for the given maildir.
+ *
+ * Each line, after the header, is a TAB-separated record:
+ *
+ *   stem inode size mtime date name=value name=value ..
+ */
+void CHeaderCache::load( const std::string &maildir, CHeaderCacheFolder &folder )
+{
+    std::ifstream input( index_file( maildir ) );
+    if ( ! input.is_open() )
+        return;
+
+    DEBUG_LOG( "CHeaderCache::load(" + maildir + ")" );
+
+    /**
+     * Ensure the file is one of ours, and describes the right maildir.
+     */
+    std::string line;
+    if ( ! getline( input, line ) || ( line != HEADER_CACHE_MAGIC ) )
+        return;
+    if ( ! getline( input, line ) || ( unescape_value( line ) != maildir ) )
+        return;
+
+    while( getline( input, line ) )
+    {
+        std::vector<std::string> fields = split_fields( line );
+        if ( fields.size() < 5 )
+            continue;
+
+        CHeaderCacheEntry entry;
+        entry.inode = strtoull( fields[1].c_str(), NULL, 10 );
+        entry.size  = strtoll( fields[2].c_str(), NULL, 10 );
+        entry.mtime = strtoll( fields[3].c_str(), NULL, 10 );
+        entry.date  = strtoll( fields[4].c_str(), NULL, 10 );
+
+        for( size_t i = 5; i < fields.size(); i++ )
+        {
+            size_t eq = fields[i].find( '=' );
+            if ( eq == std::string::npos )
+                continue;
+
+            entry.headers[fields[i].substr(0, eq)] = unescape_value( fields[i].substr( eq + 1 ) );
+        }
+
+        folder.entries[unescape_value( fields[0] )] = entry;
+    }
+}
+
+
+/**
+ * Save the index for the given maildir.
+ *
+ * The index is written to a temporary file which is then renamed over
+ * the original, so a crash can't leave a truncated index behind.
+ */
+void CHeaderCache::save( const std::string &maildir, CHeaderCacheFolder &folder )
+{
+    DEBUG_LOG( "CHeaderCache::save(" + maildir + ")" );
+
+    std::string path = index_file( maildir );
+    std::string tmp  = path + ".tmp";
+
+    std::ofstream out( tmp, std::ios::binary | std::ios::trunc );
+    if ( ! out.is_open() )
+        return;
+
+    out << HEADER_CACHE_MAGIC << "\n";
+    out << escape_value( maildir ) << "\n";
+
+    for( auto it = folder.entries.begin(); it != folder.entries.end(); ++it )
+    {
+        CHeaderCacheEntry &entry = it->second;
+
+        out << escape_value( it->first )
+            << "\t" << (unsigned long long)entry.inode
+            << "\t" << (long long)entry.size
+            << "\t" << (long long)entry.mtime
+            << "\t" << (long long)entry.date;
+
+        for( auto hit = entry.headers.begin(); hit != entry.headers.end(); ++hit )
+            out << "\t" << hit->first << "=" << escape_value( hit->second );
+
+        out << "\n";
+    }
+    out.close();
+
+    if ( out.fail() || ( rename( tmp.c_str(), path.c_str() ) != 0 ) )
+    {
+        DEBUG_LOG( "CHeaderCache::save - failed to write " + path );
+        unlink( tmp.c_str() );
+        return;
+    }
+
+    folder.dirty = false;
+}
+
+
+/**
+ * Update the list of headers we store.
+ *
+ * We always store the headers used for sorting, along with any
+ * referenced by the current `index_format`.
+ */
+std::unordered_set<std::string> CHeaderCache::wanted()
+{
+    update_wanted();
+    return( m_wanted );
+}
+
+
+/**
+ * Update the list of headers we store, if the index_format has changed.
+ */
+void CHeaderCache::update_wanted()
+{
+    CGlobal *global  = CGlobal::Instance();
+    std::string *fmt = global->get_variable( "index_format" );
+    std::string format = ( fmt != NULL ) ? *fmt : "";
+
+    if ( ( ! m_wanted.empty() ) && ( format == m_wanted_format ) )
+        return;
+
+    m_wanted_format = format;
+    m_wanted.clear();
+
+    m_wanted.insert( "date" );
+    m_wanted.insert( "from" );
+    m_wanted.insert( "subject" );
+    m_wanted.insert( "to" );
+
+    /**
+     * Any "$Header" references which aren't our own expansions.
+     */
+    size_t offset = 0;
+    while( ( offset = format.find( '$', offset ) ) != std::string::npos )
+    {
+        size_t end = offset + 1;
+        while( ( end < format.size() ) &&
+               ( isalnum( format[end] ) || format[end] == '-' || format[end] == '_' ) )
+            end++;
+
+        std::string name = format.substr( offset + 1, end - offset - 1 );
+        std::transform(name.begin(), name.end(), name.begin(), tolower);
+
+        if ( ! name.empty() &&
+             name != "flags" && name != "year" && name != "month" &&
+             name != "mon" && name != "day" )
+            m_wanted.insert( name );
+
+        offset = end;
+    }
+}
@@ -0,0 +1,197 @@
+/**
+ * header_cache.h - Persistent, per-maildir, cache of message headers.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/types.h>
+
+#include "utfstring.h"
+
+
+/**
+ * A single cached message.
+ *
+ * The entry is only considered valid if the inode, size, and mtime of
+ * the message on-disk match those we recorded.
+ */
+struct CHeaderCacheEntry
+{
+    /**
+     * The identity of the file we parsed.
+     */
+    ino_t  inode;
+    off_t  size;
+    time_t mtime;
+
+    /**
+     * The parsed value of the Date: header, zero if not yet parsed.
+     */
+    time_t date;
+
+    /**
+     * The (decoded) headers we stored, keyed by lower-cased name.
+     *
+     * Headers which were absent from the message are stored with an
+     * empty value, so that we don't need to reparse to discover that.
+     */
+    std::unordered_map<std::string, UTFString> headers;
+};
+
+
+/**
+ * A singleton class which maintains an on-disk index of the headers
+ * of messages, so that opening a large folder doesn't require every
+ * message within it to be parsed each time.
+ *
+ * There is one index-file per maildir, beneath the directory set via
+ * the `header_cache` primitive.  Entries are keyed by the unique part
+ * of the maildir filename, i.e. the part before ":2,", so that a flag
+ * change doesn't invalidate them.
+ *
+ * If no directory has been set then caching is disabled.
+ */
+class CHeaderCache
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CHeaderCache *Instance();
+
+    /**
+     * Set the directory to store our index-files in.
+     */
+    void set_directory( std::string path );
+
+    /**
+     * Is caching enabled?
+     */
+    bool enabled();
+
+    /**
+     * Lookup the cached entry for the given message.
+     *
+     * Returns false if there is no entry, or if the entry is stale.
+     */
+    bool lookup( std::string path, ino_t inode, off_t size, time_t mtime,
+                 std::unordered_map<std::string, UTFString> &headers, time_t &date );
+
+    /**
+     * Store the headers for the given message.
+     *
+     * Only the headers we consider interesting are retained.
+     */
+    void store( std::string path, ino_t inode, off_t size, time_t mtime,
+                const std::unordered_map<std::string, UTFString> &headers, time_t date );
+
+    /**
+     * Update the parsed date of the given message, if it is cached.
+     */
+    void store_date( std::string path, ino_t inode, off_t size, time_t mtime, time_t date );
+
+    /**
+     * The (lower-case) names of the headers we store.
+     */
+    std::unordered_set<std::string> wanted();
+
+    /**
+     * Remove entries from the index of the given maildir which don't
+     * correspond to any of the given messages.
+     */
+    void expire( std::string maildir, const std::vector<std::string> &paths );
+
+    /**
+     * Write all modified indexes to disk.
+     */
+    void sync();
+
+    /**
+     * Split a message path into the maildir to which it belongs, and
+     * the unique stem of its filename.
+     */
+    static bool split_path( const std::string &path, std::string &maildir, std::string &stem );
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CHeaderCache();
+    CHeaderCache(const CHeaderCache &);
+    CHeaderCache & operator=(const CHeaderCache &);
+
+private:
+
+    /**
+     * The entries for a single maildir.
+     */
+    struct CHeaderCacheFolder
+    {
+        bool dirty;
+        std::unordered_map<std::string, CHeaderCacheEntry> entries;
+    };
+
+    /**
+     * Find the loaded index of the given maildir, loading it if required.
+     */
+    CHeaderCacheFolder *folder( const std::string &maildir );
+
+    /**
+     * The filename of the index for the given maildir.
+     */
+    std::string index_file( const std::string &maildir );
+
+    /**
+     * Load/Save the index for the given maildir.
+     */
+    void load( const std::string &maildir, CHeaderCacheFolder &folder );
+    void save( const std::string &maildir, CHeaderCacheFolder &folder );
+
+    /**
+     * Update the list of headers we store, if the index_format has changed.
+     */
+    void update_wanted();
+
+    /**
+     * The single instance of this class.
+     */
+    static CHeaderCache *pinstance;
+
+    /**
+     * The directory we store indexes beneath.  Empty if disabled.
+     */
+    std::string m_directory;
+
+    /**
+     * The indexes we've loaded, keyed by maildir path.
+     */
+    std::unordered_map<std::string, CHeaderCacheFolder> m_folders;
+
+    /**
+     * The headers we'll store, and the index_format they were built from.
+     */
+    std::unordered_set<std::string> m_wanted;
+    std::string m_wanted_format;
+
+};
@@ -0,0 +1,309 @@
+/**
+ * header_prefetch.cc - Read the headers of messages in the background.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <cursesw.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unordered_set>
+
+#include "date_parser.h"
+#include "debug.h"
+#include "global.h"
+#include "header_cache.h"
+#include "header_prefetch.h"
+#include "header_reader.h"
+#include "message.h"
+#include "screen.h"
+#include "worker_pool.h"
+
+
+/**
+ * The current time, in milliseconds.
+ */
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+}
+
+
+/**
+ * Instance-handle.
+ */
+CHeaderPrefetch *CHeaderPrefetch::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CHeaderPrefetch *CHeaderPrefetch::Instance()
+{
+    if (!pinstance)
+        pinstance = new CHeaderPrefetch;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is protected as this class is a singleton.
+ */
+CHeaderPrefetch::CHeaderPrefetch()
+{
+    m_enabled   = false;
+    m_pending   = 0;
+    m_resort    = false;
+    m_resorted  = 0;
+}
+
+
+/**
+ * Allow/Prevent prefetching.
+ */
+void CHeaderPrefetch::enable( bool state )
+{
+    if ( ! state )
+        cancel();
+
+    m_enabled = state;
+}
+
+
+/**
+ * Can we prefetch, for the current configuration?
+ *
+ * Messages passed through a `mail_filter` must be parsed in full, upon
+ * the main thread, so they're never prefetched.
+ */
+bool CHeaderPrefetch::enabled()
+{
+    if ( ! m_enabled || ( CWorkerPool::Instance()->size() == 0 ) )
+        return false;
+
+    std::string *filter = CGlobal::Instance()->get_variable( "mail_filter" );
+    return( ( filter == NULL ) || filter->empty() );
+}
+
+
+/**
+ * Are we still reading headers for the current selection?
+ */
+bool CHeaderPrefetch::active()
+{
+    return( m_pending > 0 );
+}
+
+
+/**
+ * Abandon the current run.
+ */
+void CHeaderPrefetch::cancel()
+{
+    if ( m_cancelled )
+        *m_cancelled = true;
+
+    m_cancelled.reset();
+    m_pending = 0;
+    m_resort  = false;
+}
+
+
+/**
+ * Start reading the headers of the visible messages.
+ */
+void CHeaderPrefetch::start( CMessageView *messages, int selected )
+{
+    cancel();
+
+    if ( ! enabled() || ( messages == NULL ) || messages->empty() )
+        return;
+
+    /**
+     * Start with the screenful above the selection, then work downwards
+     * before wrapping around to the top.
+     */
+    int count = messages->size();
+    int first = std::max( 0, std::min( selected, count - 1 ) - CScreen::height() );
+
+    std::vector<CPrefetchedHeaders> batch;
+    std::vector<std::vector<CPrefetchedHeaders> > batches;
+
+    for( int i = 0; i < count; i++ )
+    {
+        std::shared_ptr<CMessage> message = messages->at( ( first + i ) % count );
+        if ( message->headers_loaded() )
+            continue;
+
+        CPrefetchedHeaders entry;
+        entry.message = message;
+        entry.path    = message->path();
+        entry.inode   = 0;
+        entry.size    = 0;
+        entry.mtime   = 0;
+        entry.valid   = false;
+        entry.date    = 0;
+        batch.push_back( entry );
+
+        if ( batch.size() >= HEADER_PREFETCH_BATCH )
+        {
+            batches.push_back( batch );
+            batch.clear();
+        }
+    }
+
+    if ( ! batch.empty() )
+        batches.push_back( batch );
+
+    if ( batches.empty() )
+        return;
+
+    DEBUG_LOG( "CHeaderPrefetch::start - " + std::to_string( batches.size() ) + " batches" );
+
+    /**
+     * The workers only need the names of the headers we keep.
+     */
+    std::unordered_set<std::string> keep = CHeaderCache::Instance()->wanted();
+    std::shared_ptr<std::vector<std::string> > wanted = std::make_shared<std::vector<std::string> >( keep.begin(), keep.end() );
+
+    std::shared_ptr<std::atomic<bool> > cancelled = std::make_shared<std::atomic<bool> >( false );
+
+    m_cancelled = cancelled;
+    m_pending   = batches.size();
+    m_resorted  = now_ms();
+
+    CWorkerPool *pool = CWorkerPool::Instance();
+
+    for (std::vector<CPrefetchedHeaders> &b : batches)
+    {
+        std::shared_ptr<std::vector<CPrefetchedHeaders> > job = std::make_shared<std::vector<CPrefetchedHeaders> >();
+        job->swap( b );
+
+        pool->submit( [job, wanted, cancelled]()
+                      {
+                          read_batch( *job, *wanted, *cancelled );
+                      },
+                      [this, job, cancelled]()
+                      {
+                          if ( ! *cancelled )
+                              apply_batch( *job );
+                      } );
+    }
+}
+
+
+/**
+ * The messages were given a provisional order.
+ */
+void CHeaderPrefetch::resort_when_done()
+{
+    if ( active() )
+        m_resort = true;
+}
+
+
+/**
+ * Read the headers for a batch of messages, upon a worker thread.
+ *
+ * Nothing here may touch the messages themselves, only their paths.
+ */
+void CHeaderPrefetch::read_batch( std::vector<CPrefetchedHeaders> &batch,
+                                  const std::vector<std::string> &wanted,
+                                  const std::atomic<bool> &cancelled )
+{
+    CHeaderReader reader;
+
+    for (CPrefetchedHeaders &entry : batch)
+    {
+        if ( cancelled )
+            return;
+
+        struct stat sb;
+        if ( stat( entry.path.c_str(), &sb ) != 0 )
+            continue;
+
+        if ( ! reader.read( entry.path ) )
+            continue;
+
+        entry.inode = sb.st_ino;
+        entry.size  = sb.st_size;
+        entry.mtime = sb.st_mtime;
+        entry.valid = true;
+
+        /**
+         * A missing header is stored as empty, as the header-cache does.
+         */
+        for (const std::string &name : wanted)
+            entry.headers[name] = reader.has( name ) ? reader.get( name ) : "";
+
+        /**
+         * Dates we can't parse are left for the main thread, which will
+         * try the user's `date_formats`.
+         */
+        std::string date = entry.headers["date"];
+        if ( ! date.empty() )
+            CDateParser::parse( date, entry.date );
+    }
+}
+
+
+/**
+ * Apply a batch of results, upon the main thread.
+ */
+void CHeaderPrefetch::apply_batch( std::vector<CPrefetchedHeaders> &batch )
+{
+    for (CPrefetchedHeaders &entry : batch)
+    {
+        std::shared_ptr<CMessage> message = entry.message.lock();
+
+        if ( entry.valid && message && ( message->path() == entry.path ) )
+            message->set_headers( entry.inode, entry.size, entry.mtime, entry.headers, entry.date );
+    }
+
+    if ( m_pending > 0 )
+        m_pending -= 1;
+
+    if ( ! m_resort )
+        return;
+
+    /**
+     * Refine the order as we go, and correct it once we're done.
+     */
+    if ( m_pending == 0 )
+    {
+        m_resort = false;
+        resort();
+    }
+    else if ( now_ms() - m_resorted >= HEADER_PREFETCH_RESORT )
+    {
+        resort();
+    }
+}
+
+
+/**
+ * Correct the provisional order of the messages.
+ */
+void CHeaderPrefetch::resort()
+{
+    DEBUG_LOG( "CHeaderPrefetch::resort" );
+
+    m_resorted = now_ms();
+    CGlobal::Instance()->resort_messages();
+}
@@ -0,0 +1,189 @@
+/**
+ * header_prefetch.h - Read the headers of messages in the background.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#include "message_view.h"
+#include "utfstring.h"
+
+
+/**
+ * The number of messages read by each background job.
+ */
+#ifndef HEADER_PREFETCH_BATCH
+# define HEADER_PREFETCH_BATCH 64
+#endif
+
+
+/**
+ * The minimum interval, in milliseconds, between refinements of a
+ * provisional sort.
+ */
+#ifndef HEADER_PREFETCH_RESORT
+# define HEADER_PREFETCH_RESORT 500
+#endif
+
+
+/**
+ * The headers of a single message, as read by a worker.
+ */
+struct CPrefetchedHeaders
+{
+    /**
+     * The message, and the path it had when we read it.
+     */
+    std::weak_ptr<CMessage> message;
+    std::string path;
+
+    /**
+     * The identity of the file we read.
+     */
+    ino_t  inode;
+    off_t  size;
+    time_t mtime;
+
+    /**
+     * Did the read succeed?
+     */
+    bool valid;
+
+    /**
+     * The decoded headers we want, and the parsed Date: header.
+     */
+    std::unordered_map<std::string, UTFString> headers;
+    time_t date;
+};
+
+
+/**
+ * A singleton which reads the headers of the visible messages upon the
+ * worker-pool, the messages nearest the selection first.
+ *
+ * Each message adopts its headers upon the main thread, as they arrive.
+ * If the messages were given a provisional order, because their true
+ * order depends upon headers we didn't yet have, they're resorted as
+ * results arrive, and once more when all have done so.
+ */
+class CHeaderPrefetch
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CHeaderPrefetch *Instance();
+
+    /**
+     * Allow/Prevent prefetching.
+     *
+     * This is only enabled while the event-loop is running, as there is
+     * nothing to apply the results otherwise.
+     */
+    void enable( bool state );
+
+    /**
+     * Can we prefetch, for the current configuration?
+     */
+    bool enabled();
+
+    /**
+     * Are we still reading headers for the current selection?
+     */
+    bool active();
+
+    /**
+     * Start reading the headers of the visible messages which don't
+     * already have them, abandoning any previous run.
+     */
+    void start( CMessageView *messages, int selected );
+
+    /**
+     * The messages were given a provisional order, which must be
+     * corrected as the current run progresses.
+     */
+    void resort_when_done();
+
+    /**
+     * Abandon the current run.
+     */
+    void cancel();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CHeaderPrefetch();
+    CHeaderPrefetch(const CHeaderPrefetch &);
+    CHeaderPrefetch & operator=(const CHeaderPrefetch &);
+
+private:
+
+    /**
+     * Read the headers for a batch of messages, upon a worker thread.
+     */
+    static void read_batch( std::vector<CPrefetchedHeaders> &batch,
+                            const std::vector<std::string> &wanted,
+                            const std::atomic<bool> &cancelled );
+
+    /**
+     * Apply a batch of results, upon the main thread.
+     */
+    void apply_batch( std::vector<CPrefetchedHeaders> &batch );
+
+    /**
+     * Correct the provisional order of the messages.
+     */
+    void resort();
+
+    /**
+     * The single instance of this class.
+     */
+    static CHeaderPrefetch *pinstance;
+
+    /**
+     * Are we allowed to prefetch?
+     */
+    bool m_enabled;
+
+    /**
+     * Set to abandon the jobs of the current run.
+     */
+    std::shared_ptr<std::atomic<bool> > m_cancelled;
+
+    /**
+     * The number of batches of the current run not yet applied.
+     */
+    size_t m_pending;
+
+    /**
+     * Does the current run need to correct the order of the messages,
+     * and when did it last do so?
+     */
+    bool m_resort;
+    long long m_resorted;
+
+};
@@ -0,0 +1,256 @@
+/**
+ * header_reader.cc - Read the headers of a message, without its body.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmime/gmime.h>
+
+#include "debug.h"
+#include "header_reader.h"
+
+
+/**
+ * The amount we read from a message at a time.
+ */
+#ifndef HEADER_READ_BUFFER
+# define HEADER_READ_BUFFER 8192
+#endif
+
+
+/**
+ * Constructor.
+ */
+CHeaderReader::CHeaderReader()
+{
+}
+
+
+/**
+ * Destructor.
+ */
+CHeaderReader::~CHeaderReader()
+{
+}
+
+
+/**
+ * Read the headers from the given file.
+ *
+ * We read until we find the blank line which terminates the headers,
+ * so the size of any attachments is irrelevant.
+ */
+bool CHeaderReader::read( const std::string &path )
+{
+    clear();
+
+    int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+        return false;
+
+    std::string data;
+    char buf[HEADER_READ_BUFFER];
+
+    while( true )
+    {
+        ssize_t len = ::read( fd, buf, sizeof(buf) );
+        if ( len <= 0 )
+            break;
+
+        /**
+         * Look for the end of the headers, allowing for the terminator
+         * to be split across two reads.
+         */
+        size_t start = ( data.size() > 3 ) ? data.size() - 3 : 0;
+        data.append( buf, len );
+
+        size_t end = data.find( "\n\n", start );
+        size_t crlf = data.find( "\n\r\n", start );
+        if ( ( crlf != std::string::npos ) &&
+             ( ( end == std::string::npos ) || ( crlf < end ) ) )
+            end = crlf;
+
+        if ( end != std::string::npos )
+        {
+            data.resize( end + 1 );
+            break;
+        }
+    }
+    close( fd );
+
+    parse( data.c_str(), data.size() );
+    return true;
+}
+
+
+/**
+ * Parse the headers from the given buffer.
+ */
+void CHeaderReader::parse( const char *data, size_t len )
+{
+    std::string name;
+    std::string value;
+
+    const char *ptr = data;
+    const char *end = data + len;
+
+    while( ptr < end )
+    {
+        /**
+         * Find the end of this line, and strip the line-ending.
+         */
+        const char *eol = (const char *)memchr( ptr, '\n', end - ptr );
+        if ( eol == NULL )
+            eol = end;
+
+        const char *line_end = eol;
+        if ( ( line_end > ptr ) && ( *(line_end - 1) == '\r' ) )
+            line_end--;
+
+        /**
+         * A blank line terminates the headers.
+         */
+        if ( line_end == ptr )
+            break;
+
+        if ( ( *ptr == ' ' ) || ( *ptr == '\t' ) )
+        {
+            /**
+             * A continuation line: unfold it onto the current value.
+             */
+            if ( ! name.empty() )
+                value.append( ptr, line_end - ptr );
+        }
+        else
+        {
+            /**
+             * A new header - store the previous one.
+             */
+            if ( ! name.empty() )
+                m_raw[name] = value;
+
+            name.clear();
+            value.clear();
+
+            const char *colon = (const char *)memchr( ptr, ':', line_end - ptr );
+            if ( colon != NULL )
+            {
+                name.assign( ptr, colon - ptr );
+
+                /**
+                 * Header names can't contain whitespace, but be liberal
+                 * about any before the colon.
+                 */
+                while( ( ! name.empty() ) &&
+                       ( ( name[name.size()-1] == ' ' ) || ( name[name.size()-1] == '\t' ) ) )
+                    name.erase( name.size() - 1 );
+
+                std::transform(name.begin(), name.end(), name.begin(), tolower);
+
+                const char *v = colon + 1;
+                while( ( v < line_end ) && ( ( *v == ' ' ) || ( *v == '\t' ) ) )
+                    v++;
+
+                value.assign( v, line_end - v );
+            }
+        }
+
+        ptr = eol + 1;
+    }
+
+    if ( ! name.empty() )
+        m_raw[name] = value;
+}
+
+
+/**
+ * Forget any headers we've read.
+ */
+void CHeaderReader::clear()
+{
+    m_raw.clear();
+    m_decoded.clear();
+}
+
+
+/**
+ * The names of all the headers we read.
+ */
+std::vector<std::string> CHeaderReader::names()
+{
+    std::vector<std::string> result;
+
+    for (auto it = m_raw.begin(); it != m_raw.end(); ++it)
+        result.push_back( it->first );
+
+    return( result );
+}
+
+
+/**
+ * Is the given header present?
+ */
+bool CHeaderReader::has( const std::string &name )
+{
+    return( m_raw.find( name ) != m_raw.end() );
+}
+
+
+/**
+ * Get the decoded value of the given header.
+ */
+UTFString CHeaderReader::get( const std::string &name )
+{
+    std::unordered_map<std::string, UTFString>::iterator done = m_decoded.find( name );
+    if ( done != m_decoded.end() )
+        return( done->second );
+
+    std::unordered_map<std::string, std::string>::iterator it = m_raw.find( name );
+    if ( it == m_raw.end() )
+        return "";
+
+    UTFString result = decode( it->second );
+    m_decoded[name] = result;
+    return( result );
+}
+
+
+/**
+ * Decode the RFC 2047 encoded-words in the given value.
+ *
+ * Plain ASCII values, which are the majority, are returned as-is.
+ */
+UTFString CHeaderReader::decode( const std::string &value )
+{
+    bool plain = ( value.find( "=?" ) == std::string::npos );
+    for( size_t i = 0; plain && i < value.size(); i++ )
+    {
+        if ( (unsigned char)value[i] & 0x80 )
+            plain = false;
+    }
+
+    if ( plain )
+        return( value );
+
+    char *decoded = g_mime_utils_header_decode_text( value.c_str() );
+    UTFString result = decoded;
+    g_free( decoded );
+
+    return( result );
+}
@@ -0,0 +1,100 @@
+/**
+ * header_reader.h - Read the headers of a message, without its body.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "utfstring.h"
+
+
+/**
+ * A lightweight reader for the (RFC 5322) header-block of a message.
+ *
+ * Only the file up to the first blank line is read, folded lines are
+ * joined, and the RFC 2047 decoding of each value is deferred until it
+ * is actually requested.  This is far cheaper than asking GMime to parse
+ * a message, which reads every MIME part, when only the headers are
+ * required - e.g. to draw the index.
+ */
+class CHeaderReader
+{
+
+public:
+
+    /**
+     * Constructor/Destructor.
+     */
+    CHeaderReader();
+    ~CHeaderReader();
+
+    /**
+     * Read the headers from the given file.
+     *
+     * Returns false if the file couldn't be read.
+     */
+    bool read( const std::string &path );
+
+    /**
+     * Parse the headers from the given buffer, which should contain
+     * the header-block of a message.
+     */
+    void parse( const char *data, size_t len );
+
+    /**
+     * Forget any headers we've read.
+     */
+    void clear();
+
+    /**
+     * The names of all the headers we read, in lower-case.
+     */
+    std::vector<std::string> names();
+
+    /**
+     * Is the given, lower-case, header present?
+     */
+    bool has( const std::string &name );
+
+    /**
+     * Get the decoded value of the given, lower-case, header.
+     *
+     * If a header appears more than once then the last value is returned.
+     */
+    UTFString get( const std::string &name );
+
+private:
+
+    /**
+     * Decode the RFC 2047 encoded-words in the given value.
+     */
+    static UTFString decode( const std::string &value );
+
+    /**
+     * The undecoded header values, keyed by lower-case name.
+     */
+    std::unordered_map<std::string, std::string> m_raw;
+
+    /**
+     * The values we've decoded so far.
+     */
+    std::unordered_map<std::string, UTFString> m_decoded;
+
+};
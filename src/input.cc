@@ -18,8 +18,11 @@
 
 #define _XOPEN_SOURCE_EXTENDED 1
 #include <cstdlib>
+#include <glib.h>
 #include <ncurses.h>
+#include <unistd.h>
 #include "input.h"
+#include "screen.h"
 
 
 /**
@@ -63,6 +66,15 @@ void CInput::add( UTFString input )
 }
 
 
+/**
+ * Is there input remaining in our faux buffer?
+ */
+bool CInput::pending()
+{
+    return( m_offset < m_pending.size() );
+}
+
+
 /**
  * Get a character from either our faux buffer, or via curses.
  */
@@ -90,8 +102,45 @@ int CInput::get_wchar(gunichar *wch)
         }
     }
 
+    /**
+     * Without a terminal we read UTF-8 from STDIN.
+     */
+    if ( CScreen::headless() )
+        return( read_stdin( wch ) );
+
     /**
      * Otherwise defer to ncurses.
      */
     return( get_wch( (wint_t *) wch) );
 }
+
+
+/**
+ * Read a single character from STDIN, blocking until it is available.
+ */
+int CInput::read_stdin(gunichar *wch)
+{
+    char buf[6];
+    int  len = 0;
+
+    while( len < (int)sizeof(buf) )
+    {
+        if ( read( STDIN_FILENO, buf + len, 1 ) != 1 )
+            return( ERR );
+
+        len += 1;
+
+        /**
+         * Stop once we have the number of bytes the first promised.
+         */
+        if ( len >= g_utf8_skip[ (unsigned char)buf[0] ] )
+            break;
+    }
+
+    gunichar c = g_utf8_get_char_validated( buf, len );
+    if ( c == (gunichar)-1 || c == (gunichar)-2 )
+        c = '?';
+
+    *wch = c;
+    return( OK );
+}
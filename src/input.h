@@ -41,12 +41,24 @@ public:
      */
     int get_wchar(gunichar *wch);
 
+    /**
+     * Is there input remaining in our faux buffer?
+     */
+    bool pending();
+
     /**
      * Enqueue some input to the input buffer.
      */
     void add( UTFString input );
 
 
+private:
+
+    /**
+     * Read a single character from STDIN, when we have no terminal.
+     */
+    int read_stdin(gunichar *wch);
+
 protected:
 
     /**
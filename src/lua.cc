@@ -29,6 +29,7 @@
 #include "file.h"
 #include "global.h"
 #include "lua.h"
+#include "rendered_body.h"
 #include "version.h"
 
 /**
@@ -72,6 +73,7 @@ struct CLuaMapping primitive_list[] =
     {"log_message", "Add a message to the debug-log.", (lua_CFunction) log_message },
     {"mime_type", "Get the MIME-type for a file.", (lua_CFunction) mime_type },
     {"msg", "Write a message to the status-area.", (lua_CFunction) msg },
+    {"regexp_cache_stats", "Return the hit/compile counts of the compiled-regexp cache.", (lua_CFunction) regexp_cache_stats },
     {"screen_height", "Return the height of the screen in rows.", (lua_CFunction) screen_height },
     {"screen_width", "Return the width of the screen in columns.", (lua_CFunction) screen_width },
     {"sleep", "Pause execution for the given number of seconds.", (lua_CFunction) sleep },
@@ -109,6 +111,7 @@ struct CLuaMapping primitive_list[] =
     {"from", "Query or update the from-address for outgoing mails.", (lua_CFunction) from },
     {"get_variables", "Retrieve all known-variables and their values.", (lua_CFunction) get_variables },
     {"global_mode", "Query or update the global-mode.", (lua_CFunction) global_mode },
+    {"header_cache", "Query or update the directory used to cache message-headers.", (lua_CFunction) header_cache },
     {"hostname", "Retrieve the hostname of the current system..", (lua_CFunction) hostname },
     {"index_format", "Query or update the index-format string.", (lua_CFunction) index_format },
     {"index_limit", "Query or update the index-limit string.", (lua_CFunction) index_limit },
@@ -116,6 +119,8 @@ struct CLuaMapping primitive_list[] =
     {"maildir_format", "Query or update the maildir-format string.", (lua_CFunction) maildir_format },
     {"maildir_limit", "Query or update the maildir-limit string.", (lua_CFunction) maildir_limit },
     {"maildir_prefix", "Query or update the root of the Maildir hierarchy.", (lua_CFunction) maildir_prefix },
+    {"message_cache_entries", "Query or update the number of parsed messages to retain.", (lua_CFunction) message_cache_entries },
+    {"message_cache_size", "Query or update the total size of the parsed messages to retain.", (lua_CFunction) message_cache_size },
     {"sendmail_path", "Query or update the sendmail-path, used for sending mails.", (lua_CFunction) sendmail_path },
     {"sent_mail", "Query or update the Maildir location to send outgoing mails to.", (lua_CFunction) sent_mail },
     {"sort", "Query or update the sorting string for index-mode.", (lua_CFunction) sort },
@@ -140,6 +145,15 @@ struct CLuaMapping primitive_list[] =
     {"scroll_index_to", "Scroll the message list to the given offset.", (lua_CFunction) scroll_index_to },
     {"scroll_index_up", "Scroll the message list up.", (lua_CFunction) scroll_index_up },
 
+/**
+ * Bulk message functions: defined in src/bindings_bulk.cc
+ */
+    {"copy_messages", "Copy the messages in the index, matching a filter, or in a list, to a Maildir.", (lua_CFunction) copy_messages },
+    {"delete_messages", "Delete the messages in the index, matching a filter, or in a list.", (lua_CFunction) delete_messages },
+    {"mark_messages", "Add flags to the messages in the index, matching a filter, or in a list.", (lua_CFunction) mark_messages },
+    {"move_messages", "Move the messages in the index, matching a filter, or in a list, to a Maildir.", (lua_CFunction) move_messages },
+    {"unmark_messages", "Remove flags from the messages in the index, matching a filter, or in a list.", (lua_CFunction) unmark_messages },
+
 /**
  * Message-Related functions: defined in src/bindings_message.cc
  */
@@ -168,6 +182,7 @@ struct CLuaMapping primitive_list[] =
     {"scroll_message_up", "Scroll the current message up.", (lua_CFunction) scroll_message_up },
     {"scroll_message_to", "Scroll the current message to the next matching regexp.", (lua_CFunction) scroll_message_to },
     {"send_email", "Send an email, via Lua.", (lua_CFunction) send_email },
+    {"sync_flags", "Write any pending changes to message flags to disk.", (lua_CFunction) sync_flags },
     {"write_message_to_disk", "Write a message to disk.", (lua_CFunction)write_message_to_disk },
 
 /**
@@ -371,6 +386,59 @@ void CLua::execute(std::string lua, bool show_error )
 
 
 
+/**
+ * Evaluate the given string, collecting any values it returns.
+ */
+bool CLua::evaluate(const std::string &lua, std::string &result)
+{
+    result.clear();
+
+    int top = lua_gettop(m_lua);
+
+    if ( luaL_loadbuffer(m_lua, lua.c_str(), lua.size(), "=socket") ||
+         lua_pcall(m_lua, 0, LUA_MULTRET, 0) )
+    {
+        if ( lua_isstring(m_lua, -1) )
+            result = lua_tostring(m_lua, -1);
+        else
+            result = "unknown error";
+
+        lua_settop(m_lua, top);
+        return false;
+    }
+
+    for( int i = top + 1; i <= lua_gettop(m_lua); i++ )
+    {
+        if ( i > top + 1 )
+            result += "\n";
+
+        switch( lua_type(m_lua, i) )
+        {
+        case LUA_TNIL:
+            result += "nil";
+            break;
+        case LUA_TBOOLEAN:
+            result += lua_toboolean(m_lua, i) ? "true" : "false";
+            break;
+        case LUA_TNUMBER:
+        case LUA_TSTRING:
+        {
+            size_t len;
+            const char *str = lua_tolstring(m_lua, i, &len);
+            result.append( str, len );
+            break;
+        }
+        default:
+            result += lua_typename(m_lua, lua_type(m_lua, i));
+            break;
+        }
+    }
+
+    lua_settop(m_lua, top);
+    return true;
+}
+
+
 /**
  * Lookup a value in a nested-table.
  *
@@ -562,9 +630,9 @@ bool CLua::on_key(const char *key )
 /**
  * Invoke the on_get_body() callback.
  */
-std::vector<UTFString> CLua::on_get_body()
+std::shared_ptr<CRenderedBody> CLua::on_get_body()
 {
-    std::vector<UTFString> result;
+    std::shared_ptr<CRenderedBody> result;
 
     /**
      * Get the "on_get_body()" function, and see if it exists.
@@ -586,20 +654,11 @@ std::vector<UTFString> CLua::on_get_body()
     lua_pop(m_lua,1);
 
     /**
-     * If the string is non-empty then parse.
+     * If the string is non-empty then index it, reusing the result
+     * from last time if the text is unchanged.
      */
     if ( str != NULL && strlen( str ) )
-    {
-        /**
-         * Split the body into an array, by newlines.
-         */
-        std::stringstream stream(str);
-        std::string line;
-        while (std::getline(stream, line))
-        {
-            result.push_back( line );
-        }
-    }
+        result = CRenderedBodyCache::Instance()->for_text( str );
 
 
     return( result );
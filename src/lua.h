@@ -32,6 +32,7 @@ extern "C"
 
 class CMaildir;
 class CMessage;
+class CRenderedBody;
 
 
 /**
@@ -114,6 +115,14 @@ public:
      */
     void execute(std::string lua, bool show_error = true);
 
+    /**
+     * Evaluate the given string, collecting any values it returns.
+     *
+     * Returns false, with the error-message in result, on failure.
+     * Multiple return-values are separated by newlines.
+     */
+    bool evaluate(const std::string &lua, std::string &result);
+
     /**
      * Lookup a value in a nested-table.
      *
@@ -165,7 +174,7 @@ public:
     /**
      * Invoke the on_get_body() callback.
      */
-    std::vector<UTFString> on_get_body();
+    std::shared_ptr<CRenderedBody> on_get_body();
 
     /**
      * Invoke the Lua-defined on_key() callback.
@@ -20,40 +20,72 @@
 
 #include <algorithm>
 #include <curses.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <signal.h>
-#include <poll.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "debug.h"
 #include "file.h"
+#include "flag_queue.h"
 #include "global.h"
+#include "header_prefetch.h"
 #include "input.h"
 #include "lua.h"
 #include "lumail.h"
 #include "maildir.h"
 #include "message.h"
+#include "message_prefetch.h"
 #include "screen.h"
+#include "socket_client.h"
 #include "version.h"
+#include "watcher.h"
+#include "worker_pool.h"
 
 
 
+/**
+ * The write-end of the pipe our signal handler writes to.
+ */
+static int g_signal_pipe = -1;
+
+
+/**
+ * Note the arrival of a signal, for the event-loop to handle.
+ */
+static void signal_handler( int signo )
+{
+    int saved = errno;
+
+    unsigned char sig = (unsigned char)signo;
+    int result __attribute__((unused));
+    result = write( g_signal_pipe, &sig, 1 );
+
+    errno = saved;
+}
+
 
 /**
  * Constructor:  Setup the screen, Gmime, etc.
  */
-CLumail::CLumail()
+CLumail::CLumail( bool headless )
 {
     if ( getenv( "RFC2047" ) != NULL)
         g_mime_init(GMIME_ENABLE_RFC2047_WORKAROUNDS);
     else
         g_mime_init (0);
 
+    CScreen::set_headless( headless );
+
     m_screen = new CScreen();
     m_screen->setup();
 
@@ -61,6 +93,18 @@ CLumail::CLumail()
      * Get a lua instance.
      */
     m_lua = CLua::Instance();
+
+    /**
+     * Start the background workers.
+     */
+    m_pool = CWorkerPool::Instance();
+    m_pool->start();
+
+    m_epoll   = -1;
+    m_timer   = -1;
+    m_signals = -1;
+    m_listen  = -1;
+    m_watcher = -1;
 }
 
 
@@ -70,7 +114,34 @@ CLumail::CLumail()
  */
 CLumail::~CLumail()
 {
-    endwin();
+    CHeaderPrefetch::Instance()->enable( false );
+    CMessagePrefetch::Instance()->enable( false );
+    m_pool->stop();
+    m_clients.clear();
+
+    CFlagQueue::Instance()->flush();
+
+    if ( m_signals != -1 )
+    {
+        sigset_t set;
+        event_signals( &set );
+        for( int sig = 1; sig < NSIG; sig++ )
+        {
+            if ( sigismember( &set, sig ) == 1 )
+                signal( sig, SIG_DFL );
+        }
+
+        close( g_signal_pipe );
+        close( m_signals );
+        g_signal_pipe = -1;
+    }
+    if ( m_timer != -1 )
+        close( m_timer );
+    if ( m_epoll != -1 )
+        close( m_epoll );
+
+    if ( ! CScreen::headless() )
+        endwin();
 
     g_mime_shutdown();
 }
@@ -193,154 +264,487 @@ bool CLumail::open_folder(std::string folder)
 }
 
 /**
- * Can the socket be read from?  Timeout after N-milliseconds.
+ * Process changes to the watched maildirs.
+ *
+ * The maildir counts are refreshed lazily, as they're drawn, but if a
+ * selected folder changed then the index must be updated.
  */
-bool CLumail::can_read(int socket, int n )
+void CLumail::maildir_watch_pump()
 {
+    CWatcher *watcher = CWatcher::Instance();
+    if ( watcher->fd() < 0 )
+        return;
 
-#ifdef DOMAIN_SOCKET
+    std::vector<std::string> changed = watcher->process();
+    if ( changed.empty() )
+        return;
 
-    int r = 0;
-    struct pollfd fds[1];
+    CGlobal *global = CGlobal::Instance();
+    std::vector<std::string> selected = global->get_selected_folders();
 
-    fds[0].fd = socket;
-    fds[0].events = POLLIN;
-    do
+    for (std::string path : changed)
     {
-        r = poll(fds, 1, n);
+        if ( std::find( selected.begin(), selected.end(), path ) != selected.end() )
+        {
+            DEBUG_LOG( "Selected folder changed on-disk: " + path );
+            global->update_messages();
+            global->set_selected_message( global->get_selected_message() );
+            return;
+        }
     }
-    while (r == -1 && errno == EINTR);
-    return (r > 0);
-#else
-    return false;
-#endif
+}
 
+/**
+ * The signals our event-loop receives via its signal-pipe.
+ */
+void CLumail::event_signals( sigset_t *set )
+{
+    sigemptyset( set );
+    sigaddset( set, SIGWINCH );
+    sigaddset( set, SIGCHLD );
 }
 
 
 /**
- * Process input from the domain socket.
+ * Create the epoll set, and the descriptors we always watch.
  */
-void CLumail::domain_socket_pump(int socket_fd)
+bool CLumail::setup_event_sources()
 {
-#ifdef DOMAIN_SOCKET
-
-    char buf[1024];
-    int rval;
+    m_epoll = epoll_create1( EPOLL_CLOEXEC );
+    if ( m_epoll < 0 )
+    {
+        DEBUG_LOG( "CLumail::setup_event_sources - epoll_create1 failed" );
+        return false;
+    }
 
     /**
-     * If we can't read input then return after 50ms.
+     * Signals are written to a pipe by their handler, rather than being
+     * blocked and read via a signalfd, so that the commands we spawn
+     * don't inherit them blocked.
      */
-    if ( ! can_read( socket_fd , 50 ) )
-        return;
+    int fds[2];
+    if ( pipe2( fds, O_NONBLOCK | O_CLOEXEC ) != 0 )
+    {
+        DEBUG_LOG( "CLumail::setup_event_sources - pipe2 failed" );
+        return false;
+    }
+
+    m_signals     = fds[0];
+    g_signal_pipe = fds[1];
+
+    struct sigaction action;
+    memset( &action, 0, sizeof(action) );
+    action.sa_handler = signal_handler;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+
+    sigset_t set;
+    event_signals( &set );
+    for( int sig = 1; sig < NSIG; sig++ )
+    {
+        if ( sigismember( &set, sig ) == 1 )
+            sigaction( sig, &action, NULL );
+    }
+
+    m_timer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if ( m_timer < 0 )
+    {
+        DEBUG_LOG( "CLumail::setup_event_sources - timerfd failed" );
+        return false;
+    }
 
     /**
-     * Look for a new connection.
+     * Without a terminal there are no keys to read.
      */
-    int msgsock = accept(socket_fd, 0, 0);
-    if (msgsock == -1)
+    if ( ! CScreen::headless() )
+        watch_fd( STDIN_FILENO );
+
+    watch_fd( m_signals );
+    watch_fd( m_timer );
+    watch_fd( m_pool->fd() );
+
+    CWatcher *watcher = CWatcher::Instance();
+    if ( watcher->fd() >= 0 )
     {
-#ifdef LUMAIL_DEBUG
-        DEBUG_LOG( "Error accepting new domain-socket connection" );
-#endif
-        return;
+        m_watcher = watcher->fd();
+        watch_fd( m_watcher );
     }
 
+    arm_idle_timer();
+    return true;
+}
+
+
+/**
+ * Add a file-descriptor to the epoll set, watching for input if no
+ * events are given.
+ */
+void CLumail::watch_fd( int fd, unsigned int events )
+{
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events  = events ? events : EPOLLIN;
+    ev.data.fd = fd;
+
+    if ( epoll_ctl( m_epoll, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+        DEBUG_LOG( "CLumail::watch_fd - epoll_ctl failed: " + std::string( strerror( errno ) ) );
+}
+
+
+/**
+ * Change the events we watch a file-descriptor for.
+ */
+void CLumail::modify_fd( int fd, unsigned int events )
+{
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events  = events;
+    ev.data.fd = fd;
+
+    epoll_ctl( m_epoll, EPOLL_CTL_MOD, fd, &ev );
+}
+
+
+/**
+ * Remove a file-descriptor from the epoll set.
+ */
+void CLumail::unwatch_fd( int fd )
+{
+    epoll_ctl( m_epoll, EPOLL_CTL_DEL, fd, NULL );
+}
+
+
+/**
+ * (Re)Start the countdown until on_idle() is invoked.
+ */
+void CLumail::arm_idle_timer()
+{
+    struct itimerspec when;
+    memset( &when, 0, sizeof(when) );
+    when.it_value.tv_sec = 1;
+
+    timerfd_settime( m_timer, 0, &when, NULL );
+}
+
+
+/**
+ * Ensure the epoll set contains the current domain-socket.
+ */
+void CLumail::sync_domain_socket()
+{
+    m_listen = CGlobal::Instance()->get_domain_socket();
+    if ( m_listen < 0 )
+        return;
+
     /**
-     * Process input.
+     * A replaced socket is removed from the epoll set when it is closed,
+     * but its successor may well reuse the same descriptor-number, so
+     * always try to add it.  Normally this fails with EEXIST.
      */
-    do
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events  = EPOLLIN;
+    ev.data.fd = m_listen;
+
+    epoll_ctl( m_epoll, EPOLL_CTL_ADD, m_listen, &ev );
+}
+
+
+/**
+ * Accept all pending connections to the domain-socket.
+ */
+void CLumail::accept_clients( int socket_fd )
+{
+#ifdef DOMAIN_SOCKET
+    while( true )
     {
-        bzero(buf, sizeof(buf));
-        if ((rval = read(msgsock, buf, 1024)) < 0)
+        int client = accept4( socket_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( client < 0 )
         {
+            if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+            {
 #ifdef LUMAIL_DEBUG
-        DEBUG_LOG( "Error reading from domain-socket" );
+                DEBUG_LOG( "Error accepting new domain-socket connection" );
 #endif
+            }
+            if ( errno == EINTR )
+                continue;
+            return;
         }
-        else if (rval == 0)
-        {
+
+        m_clients[client] = std::make_shared<CSocketClient>( client );
+        watch_fd( client );
+    }
+#else
+    (void)socket_fd;
+#endif
+}
+
+
+/**
+ * Process input from, or output to, a connected client.
+ *
+ * Commands are run as soon as they have been read in full, and the client
+ * is watched for writability only while it has replies it hasn't accepted.
+ */
+void CLumail::client_event( int client, unsigned int events )
+{
+    std::map<int, std::shared_ptr<CSocketClient> >::iterator it = m_clients.find( client );
+    if ( it == m_clients.end() )
+        return;
+
+    std::shared_ptr<CSocketClient> conn = it->second;
+
+    if ( events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) )
+        conn->readable();
+    if ( events & EPOLLOUT )
+        conn->writable();
+
+    if ( conn->finished() )
+    {
 #ifdef LUMAIL_DEBUG
         DEBUG_LOG( "Disconnection from domain-socket" );
 #endif
+        unwatch_fd( client );
+        m_clients.erase( it );
+        return;
+    }
+
+    unsigned int want = 0;
+    if ( conn->want_read() )
+        want |= EPOLLIN;
+    if ( conn->want_write() )
+        want |= EPOLLOUT;
+
+    modify_fd( client, want );
+}
+
+
+/**
+ * Process all the keys which are available, without blocking.
+ */
+void CLumail::keyboard_input()
+{
+    bool headless = CScreen::headless();
+
+    while( true )
+    {
+        /**
+         * Without a terminal the only keys are those queued via stuff().
+         */
+        if ( headless && ! CInput::Instance()->pending() )
+            break;
+
+        /**
+         * Key-handlers may change the curses timeout, so reset it
+         * before each read.
+         */
+        if ( ! headless )
+            timeout(0);
+
+        gunichar key;
+        int r = CInput::Instance()->get_wchar(&key);
+        if ( r == ERR )
+            break;
+
+        handle_key( key, r == KEY_CODE_YES );
+
+        /**
+         * Drawing has side-effects, such as bounding the selection, which
+         * handlers of later keys might depend upon.  The terminal itself
+         * is only updated once all the keys have been handled.
+         */
+        m_screen->refresh_display();
+    }
+
+    if ( ! headless )
+        timeout(1000);
+
+    arm_idle_timer();
+}
+
+
+/**
+ * Handle a single keypress.
+ */
+void CLumail::handle_key( gunichar key, bool isKeyCode )
+{
+    /**
+     * The human-readable version of the key which has
+     * been pressed.
+     *
+     * i.e. Ctrl-r -> ^R.
+     */
+    const char *name = CScreen::get_key_name( key, isKeyCode );
+
+    /**
+     * See if we can handle it via our keyboard map, or
+     * the Lua function "on_key".
+     */
+    if ( (!m_lua->on_key( name )) && ( !m_lua->on_keypress(name)) )
+    {
+        /**
+         * Both calls failed, so show a message.
+         */
+        std::string foo = "msg(\"Unbound key: ";
+        foo += std::string(name) + "\");";
+        m_lua->execute(foo);
+    }
+}
+
+
+/**
+ * Process the signals which are pending on our signal-pipe.
+ */
+void CLumail::signal_input()
+{
+    unsigned char sig;
+
+    while( read( m_signals, &sig, 1 ) == 1 )
+    {
+        if ( ( sig == SIGWINCH ) && ! CScreen::headless() )
+        {
+            /**
+             * Curses never sees this signal, so resize it ourselves.
+             */
+            struct winsize w;
+            if ( ioctl( STDIN_FILENO, TIOCGWINSZ, &w ) == 0 )
+                resizeterm( w.ws_row, w.ws_col );
+
+            CScreen::clear_main();
         }
-        else
+        else if ( sig == SIGCHLD )
         {
+            /**
+             * Our children are reaped by whoever spawned them, and there
+             * is nothing else to do.
+             */
 #ifdef LUMAIL_DEBUG
-            DEBUG_LOG( "Read from domain-socket:"  + std::string(buf) );
+            DEBUG_LOG( "CLumail::signal_input - SIGCHLD" );
 #endif
-            m_lua->execute(buf);
         }
-    } while (rval > 0);
-
-#endif
-
+    }
 }
 
+
 /**
  * Draw/Refresh the display and intepret keys.
+ *
+ * Every source of input - the keyboard, the domain-socket and its clients,
+ * the maildir watcher, the idle-timer, signals, and the completions of
+ * background jobs - is within a single epoll set, and each is handled as
+ * soon as it is ready.
  */
 void CLumail::run_event_loop()
 {
+    bool headless = CScreen::headless();
+
+    if ( ! setup_event_sources() )
+    {
+        if ( ! headless )
+            endwin();
+        std::cerr << "Failed to setup the event-loop." << std::endl;
+        exit(1);
+    }
+
+    /**
+     * Now that we can apply their results, read the headers of messages
+     * in the background, and render the bodies of those either side of
+     * the one being viewed.  Without a terminal there is no first frame
+     * to hurry, and scripts expect each command to see the final order.
+     */
+    if ( ! headless )
+    {
+        CHeaderPrefetch *prefetch = CHeaderPrefetch::Instance();
+        prefetch->enable( true );
+        prefetch->start( CGlobal::Instance()->get_messages(),
+                         CGlobal::Instance()->get_selected_message() );
+
+        CMessagePrefetch::Instance()->enable( true );
+    }
+
     /**
      * Now enter our event-loop
      */
     while (true)
     {
-
         /**
-         * Refresh the screen.
-         *
-         * This is placed here to avoid having to wait for the
-         * on_idle callback to complete, which could stall updates.
+         * Refresh the screen, only the parts which changed are drawn.
          */
-        m_screen->refresh_display();
+        if ( ! headless )
+        {
+            m_screen->refresh_display();
+            refresh();
+        }
 
+        /**
+         * Has Lua bound a (new) domain-socket?
+         */
+        sync_domain_socket();
 
         /**
-         * Do we have a domain-socket?
+         * If there is input queued via stuff() then we mustn't sleep.
          */
-        CGlobal *global = CGlobal::Instance();
-        int sock = global->get_domain_socket();
-        if ( sock >= 0 )
-                domain_socket_pump( sock );
+        int wait = CInput::Instance()->pending() ? 0 : -1;
 
+        /**
+         * Before we sleep, write any flag changes the last command made.
+         */
+        if ( wait < 0 )
+            CFlagQueue::Instance()->flush();
 
-        gunichar key;
-        int  r = CInput::Instance()->get_wchar(&key);
+        struct epoll_event events[16];
+        int n = epoll_wait( m_epoll, events, 16, wait );
 
-        if (r== ERR)
+        if ( n < 0 )
         {
-            /*
-             * Timeout - so we go round the loop again.
-             */
-            m_lua->execute("on_idle()");
+            if ( errno == EINTR )
+                continue;
+
+            DEBUG_LOG( "CLumail::run_event_loop - epoll_wait failed: " + std::string( strerror( errno ) ) );
+            break;
         }
-        else
+
+        if ( n == 0 )
+            keyboard_input();
+
+        for( int i = 0; i < n; i++ )
         {
-            /**
-             * The human-readable version of the key which has
-             * been pressed.
-             *
-             * i.e. Ctrl-r -> ^R.
-             */
-            const char *name = CScreen::get_key_name( key, r == KEY_CODE_YES );
+            int fd = events[i].data.fd;
 
-            /**
-             * See if we can handle it via our keyboard map, or
-             * the Lua function "on_key".
-             */
-            if ( (!m_lua->on_key( name )) && ( !m_lua->on_keypress(name)) )
+            if ( fd == STDIN_FILENO )
             {
-                /**
-                 * Both calls failed, so show a message.
-                 */
-                std::string foo = "msg(\"Unbound key: ";
-                foo += std::string(name) + "\");";
-                m_lua->execute(foo);
+                keyboard_input();
+            }
+            else if ( fd == m_timer )
+            {
+                uint64_t expired;
+                if ( read( m_timer, &expired, sizeof(expired) ) == sizeof(expired) )
+                {
+                    m_lua->execute("on_idle()");
+                    arm_idle_timer();
+                }
+            }
+            else if ( fd == m_signals )
+            {
+                signal_input();
+            }
+            else if ( fd == m_pool->fd() )
+            {
+                m_pool->complete();
+            }
+            else if ( fd == m_watcher )
+            {
+                maildir_watch_pump();
+            }
+            else if ( fd == m_listen )
+            {
+                accept_clients( fd );
+            }
+            else if ( m_clients.find( fd ) != m_clients.end() )
+            {
+                client_event( fd, events[i].events );
             }
         }
     }
-
 }
-
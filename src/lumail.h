@@ -23,10 +23,18 @@
  */
 class CLua;
 class CScreen;
+class CSocketClient;
+class CWorkerPool;
 
 
+#include <map>
+#include <memory>
+#include <signal.h>
+#include <string>
 #include <vector>
 
+#include "utfstring.h"
+
 
 /**
  * This class is the driver for our whole application.
@@ -38,8 +46,11 @@ public:
 
     /**
      * Constructor:  Setup the screen, Gmime, etc.
+     *
+     * If headless is true the terminal is left alone, and we can run as a
+     * batch-process, or a server upon the domain-socket.
      */
-    CLumail();
+    CLumail( bool headless = false );
 
     /**
      * Destructor.  Tear down the screen, etc.
@@ -57,21 +68,72 @@ public:
      */
     bool open_folder( std::string path );
 
-   /**
-    * Can the socket be read from?  Timeout after N-milliseconds.
-    */
-    bool can_read(int socket, int n );
-
     /**
-     * Process input from the domain socket.
+     * Process changes to the watched maildirs.
      */
-    void domain_socket_pump(int socket);
+    void maildir_watch_pump();
 
     /**
      * Draw/Refresh the display and intepret keys.
      */
     void run_event_loop();
 
+private:
+
+    /**
+     * Get the set of signals which the event-loop receives via its
+     * signal-pipe.
+     */
+    static void event_signals( sigset_t *set );
+
+    /**
+     * Create the epoll set, and the timer + signal descriptors within it.
+     */
+    bool setup_event_sources();
+
+    /**
+     * Add/Update/Remove a file-descriptor in the epoll set.
+     */
+    void watch_fd( int fd, unsigned int events = 0 );
+    void modify_fd( int fd, unsigned int events );
+    void unwatch_fd( int fd );
+
+    /**
+     * (Re)Start the countdown until on_idle() is invoked.
+     */
+    void arm_idle_timer();
+
+    /**
+     * Ensure the epoll set contains the current domain-socket, which
+     * may be changed by Lua at any time.
+     */
+    void sync_domain_socket();
+
+    /**
+     * Accept all pending connections to the domain-socket.
+     */
+    void accept_clients( int socket_fd );
+
+    /**
+     * Process input from, or output to, a connected client.
+     */
+    void client_event( int client, unsigned int events );
+
+    /**
+     * Process all the keys which are available, without blocking.
+     */
+    void keyboard_input();
+
+    /**
+     * Handle a single keypress.
+     */
+    void handle_key( gunichar key, bool isKeyCode );
+
+    /**
+     * Process the signals which are pending on our signal-pipe.
+     */
+    void signal_input();
+
 private:
 
     /**
@@ -84,4 +146,31 @@ private:
      */
     CScreen *m_screen;
 
+    /**
+     * The background workers, whose results are applied by our event-loop.
+     */
+    CWorkerPool *m_pool;
+
+    /**
+     * The epoll set, the idle-timer, and the read-end of the signal-pipe.
+     */
+    int m_epoll;
+    int m_timer;
+    int m_signals;
+
+    /**
+     * The domain-socket currently within the epoll set, or -1.
+     */
+    int m_listen;
+
+    /**
+     * The inotify descriptor currently within the epoll set, or -1.
+     */
+    int m_watcher;
+
+    /**
+     * The connected domain-socket clients.
+     */
+    std::map<int, std::shared_ptr<CSocketClient> > m_clients;
+
 };
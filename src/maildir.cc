@@ -18,16 +18,41 @@
 
 #include <algorithm>
 #include <dirent.h>
-#include <iomanip>
-#include <pcrecpp.h>
+#include <cstdio>
 #include <sstream>
+#include <unordered_set>
 #include <vector>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <cursesw.h>
 
 #include "debug.h"
 #include "file.h"
+#include "format_template.h"
 #include "global.h"
 #include "maildir.h"
 #include "message.h"
+#include "regexp_cache.h"
+#include "screen.h"
+#include "watcher.h"
+
+
+#ifdef SYS_getdents64
+/**
+ * The record returned by the getdents64 system-call.
+ */
+struct linux_dirent64
+{
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+#endif
 
 
 /**
@@ -38,6 +63,7 @@ CMaildir::CMaildir(std::string path)
     m_path     = path;
     m_name     = "";
     m_modified = 0;   /* mtime of the maildir */
+    m_generation = 0; /* watcher generation */
     m_unread   = -1;  /* unread messages in maildir */
     m_total    = -1;  /* total messages in maildir */
 
@@ -107,42 +133,153 @@ time_t CMaildir::last_modified()
 void CMaildir::update_cache()
 {
     /**
-     * If the cached date isn't different then we need do nothing.
+     * If the maildir is being watched then the watcher will tell us
+     * whether it changed, without us having to stat() anything.
      */
-    time_t last_mod = last_modified();
+    CWatcher *watcher = CWatcher::Instance();
+    unsigned long gen = 0;
 
-    /**
-     * If we've got -1 for the count/unread then we've
-     * just been created.
-     *
-     */
-    if ( ( last_mod <= m_modified ) &&
-         ( m_unread != -1 ) &&
-         ( m_total != -1 ) )
-        return;
+    if ( watcher->generation( path(), gen ) )
+    {
+        if ( ( gen == m_generation ) &&
+             ( m_unread != -1 ) &&
+             ( m_total != -1 ) )
+            return;
 
-    DEBUG_LOG( "CMaildir::update_cache(" + path() + ")");
+        m_generation = gen;
+    }
+    else
+    {
+        /**
+         * If the cached date isn't different then we need do nothing.
+         */
+        time_t last_mod = last_modified();
 
-    m_modified = last_mod;
+        /**
+         * If we've got -1 for the count/unread then we've
+         * just been created.
+         *
+         */
+        if ( ( last_mod <= m_modified ) &&
+             ( m_unread != -1 ) &&
+             ( m_total != -1 ) )
+            return;
 
+        m_modified = last_mod;
+    }
 
-    /**
-     * Get all messages, and update the total
-     */
-    CMessageList all = getMessages();
-    m_total = all.size();
+    DEBUG_LOG( "CMaildir::update_cache(" + path() + ")");
 
 
     /**
-     * Now update the unread count.
+     * Count the messages from their filenames alone, rather than
+     * creating a CMessage for each.
      */
+    m_total  = 0;
     m_unread = 0;
-    for (std::shared_ptr<CMessage> message : all)
+    count_messages( m_path + "/cur", false, m_total, m_unread );
+    count_messages( m_path + "/new", true,  m_total, m_unread );
+}
+
+
+/**
+ * Is the message with the given filename unread?
+ *
+ * This is the same test CMessage::is_new() makes, but it works upon the
+ * raw bytes of the name, so it needs no allocation.
+ */
+static bool filename_is_new( const char *name, bool in_new )
+{
+    if ( in_new )
+        return true;
+
+    const char *flags = strstr( name, ":2," );
+    if ( flags == NULL )
+        return true;
+
+    return( strchr( flags + 3, 'S' ) == NULL );
+}
+
+
+/**
+ * Count the messages in the given cur/ or new/ directory, and the number
+ * of those which are unread.
+ *
+ * Entries are read in large batches via getdents64, where available, and
+ * nothing is allocated per entry.
+ */
+void CMaildir::count_messages( const std::string &dir, bool in_new, int &total, int &unread )
+{
+    int dfd = open( dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( dfd < 0 )
+        return;
+
+#ifdef SYS_getdents64
+    char buf[32768] __attribute__ ((aligned(8)));
+
+    while( true )
+    {
+        long len = syscall( SYS_getdents64, dfd, buf, sizeof(buf) );
+        if ( len <= 0 )
+            break;
+
+        for( long offset = 0; offset < len; )
+        {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)( buf + offset );
+            offset += de->d_reclen;
+
+            if ( de->d_name[0] == '.' )
+                continue;
+
+            if ( de->d_type == DT_DIR )
+                continue;
+
+            if ( de->d_type == DT_UNKNOWN )
+            {
+                struct stat sb;
+                if ( ( fstatat( dfd, de->d_name, &sb, 0 ) == 0 ) &&
+                     ( S_ISDIR( sb.st_mode ) ) )
+                    continue;
+            }
+
+            total += 1;
+            if ( filename_is_new( de->d_name, in_new ) )
+                unread += 1;
+        }
+    }
+
+    close( dfd );
+#else
+    DIR *dp = fdopendir( dfd );
+    if ( dp == NULL )
     {
-        if ( message->is_new() )
-            m_unread++;
+        close( dfd );
+        return;
+    }
+
+    dirent *de;
+    while ( ( de = readdir( dp ) ) != NULL )
+    {
+        if ( de->d_name[0] == '.' )
+            continue;
+
+        if ( de->d_type == DT_DIR )
+            continue;
+
+        if ( de->d_type == DT_UNKNOWN )
+        {
+            struct stat sb;
+            if ( ( fstatat( dfd, de->d_name, &sb, 0 ) == 0 ) &&
+                 ( S_ISDIR( sb.st_mode ) ) )
+                continue;
+        }
 
+        total += 1;
+        if ( filename_is_new( de->d_name, in_new ) )
+            unread += 1;
     }
+    closedir( dp );
+#endif
 }
 
 
@@ -202,6 +339,23 @@ std::string CMaildir::path()
 }
 
 
+/**
+ * The fields which may be used in `maildir_format`.
+ */
+typedef enum { FMT_CHECK = 1, FMT_TOTAL, FMT_READ, FMT_UNREAD, FMT_PATH, FMT_NAME } TMaildirField;
+
+static const CFormatField maildir_fields[] = {
+    { "CHECK",  FMT_CHECK },
+    { "TOTAL",  FMT_TOTAL },
+    { "READ",   FMT_READ },
+    { "NEW",    FMT_UNREAD },
+    { "UNREAD", FMT_UNREAD },
+    { "PATH",   FMT_PATH },
+    { "NAME",   FMT_NAME },
+    { NULL,     0 }
+};
+
+
 /**
  * Format this maildir for display in maildir-mode.
  */
@@ -210,96 +364,48 @@ std::string CMaildir::format( bool selected, std::string fmt )
     std::string result;
 
     /**
-     * Get the format-string we'll expand from the global
-     * setting, if it wasn't supplied.
+     * Use the compiled form of the global setting, if no format-string
+     * was supplied.
      */
+    std::shared_ptr<CFormatTemplate> tmpl;
     if ( fmt.empty() )
-    {
-        CGlobal *global  = CGlobal::Instance();
-        std::string *fmt = global->get_variable("maildir_format");
-        result = std::string(*fmt);
-    }
+        tmpl = CFormatTemplate::for_variable( "maildir_format", maildir_fields );
     else
-    {
-        result = fmt;
-    }
-
-
-    /**
-     * The variables we know about.
-     */
-    const char *fields[8] = { "$CHECK",
-                              "$TOTAL",
-                              "$READ",
-                              "$NEW",
-                              "$UNREAD",
-                              "$PATH",
-                              "$NAME",
-                              0 };
-    const char **std_name = fields;
+        tmpl = std::make_shared<CFormatTemplate>( fmt, maildir_fields );
 
+    int width = tmpl->relative() ? CScreen::width() - 3 : 0;
 
-    /**
-     * Iterate over everything we could possibly-expand.
-     */
-    for( int i = 0 ; std_name[i] ; ++i)
+    tmpl->expand( result, width, [this, selected]( const CFormatToken &token, std::string &buf )
     {
-        size_t offset = result.find( std_name[i], 0 );
+        char count[16];
 
-        if ( ( offset != std::string::npos ) && ( offset < result.size() ) )
+        switch( token.id )
         {
-
-            /**
-             * Remove the part we don't care about.
-             */
-            result.erase( offset, strlen( std_name[i] ) );
-
-            /**
-             * Conversion helper.
-             */
-            std::ostringstream convert;
-
-            /**
-             * Expand the specific variables.
-             */
-            if ( strcmp(std_name[i] , "$CHECK" ) == 0 )
-            {
-                if ( selected )
-                    result.insert(offset, "[X]" );
-                else
-                    result.insert(offset, "[ ]" );
-            }
-            if ( strcmp(std_name[i] , "$TOTAL" ) == 0 )
-            {
-                int total = total_messages();
-                convert << std::setfill('0') << std::setw(4) << total;
-                result.insert(offset, convert.str());
-            }
-            if ( strcmp(std_name[i] , "$READ" ) == 0 )
-            {
-                int read = total_messages() - unread_messages();;
-                convert << std::setfill('0') << std::setw(4) << read;
-                result.insert(offset, convert.str());
-            }
-            if ( ( strcmp(std_name[i] , "$NEW" ) == 0 ) ||
-                 ( strcmp(std_name[i] , "$UNREAD" ) == 0 ) )
-            {
-                int unread = unread_messages();
-                convert << std::setfill('0') << std::setw(4) << unread;
-                result.insert(offset, convert.str());
-            }
-            if ( strcmp(std_name[i] , "$PATH" ) == 0 )
-            {
-                result.insert(offset, path());
-            }
-            if ( strcmp(std_name[i] , "$NAME" ) == 0 )
-            {
-                result.insert(offset, name());
-            }
+        case FMT_CHECK:
+            buf += selected ? "[X]" : "[ ]";
+            break;
+        case FMT_TOTAL:
+            snprintf( count, sizeof(count), "%04d", total_messages() );
+            buf += count;
+            break;
+        case FMT_READ:
+            snprintf( count, sizeof(count), "%04d", total_messages() - unread_messages() );
+            buf += count;
+            break;
+        case FMT_UNREAD:
+            snprintf( count, sizeof(count), "%04d", unread_messages() );
+            buf += count;
+            break;
+        case FMT_PATH:
+            buf += path();
+            break;
+        case FMT_NAME:
+            buf += name();
+            break;
         }
-    }
-    return( result );
+    });
 
+    return( result );
 }
 
 
@@ -332,7 +438,7 @@ bool CMaildir::matches_regexp( std::string *regexp )
     /**
      * Regexp Matching.
      */
-    if (pcrecpp::RE(*regexp, pcrecpp::RE_Options().set_caseless(true)).PartialMatch(p) )
+    if ( CRegexpCache::Instance()->partial_match( *regexp, p ) )
         return true;
 
     return false;
@@ -417,6 +523,154 @@ CMessageList CMaildir::getMessages()
 }
 
 
+/**
+ * Update the given snapshot to match the contents of the folder.
+ *
+ * Existing CMessage objects are retained, along with their cached
+ * headers, unless the file they refer to has gone away.  A message
+ * which has been renamed, because its flags changed, has its path
+ * updated in-place.
+ */
+bool CMaildir::rescan( CMaildirSnapshot &snapshot, CMessageList &added,
+                       CMessageList &removed, CMessageList &renamed )
+{
+    /**
+     * If neither cur/ nor new/ changed since the last scan then the
+     * snapshot is up to date.  Ask the watcher if we can, otherwise
+     * compare the modification times of the directories.
+     *
+     * Directory mtimes have a granularity of one second, so a change
+     * made in the same second as our scan must cause a rescan.
+     */
+    CWatcher *watcher = CWatcher::Instance();
+    unsigned long gen = 0;
+
+    if ( watcher->generation( path(), gen ) )
+    {
+        if ( ( snapshot.scanned != 0 ) && ( gen == snapshot.generation ) )
+            return false;
+    }
+    else if ( ( snapshot.scanned != 0 ) && ( last_modified() < snapshot.scanned ) )
+        return false;
+
+    snapshot.generation = gen;
+
+    DEBUG_LOG( "CMaildir::rescan(" + path() + ")" );
+
+    snapshot.scanned = time(NULL);
+    snapshot.order.clear();
+
+    bool changed = false;
+
+    /**
+     * The messages we've seen during this scan.
+     */
+    std::unordered_set<CMessage *> seen;
+
+    /**
+     * Directories we search.
+     */
+    std::vector<std::string> dirs;
+    dirs.push_back(m_path + "/cur/");
+    dirs.push_back(m_path + "/new/");
+
+    for (std::string dir : dirs)
+    {
+        DIR *dp = opendir(dir.c_str());
+        if (!dp)
+            continue;
+
+        dirent *de;
+        while ( ( de = readdir(dp) ) != NULL )
+        {
+            if ( de->d_name[0] == '.' )
+                continue;
+
+            if ( ( de->d_type == DT_DIR ) ||
+                 ( de->d_type == DT_UNKNOWN && CFile::is_directory( dir + de->d_name ) ) )
+                continue;
+
+            std::string file = dir + de->d_name;
+            std::string key  = stem( de->d_name );
+
+            auto it = snapshot.messages.find( key );
+
+            /**
+             * The same stem twice?  That shouldn't happen, but if it does
+             * then keep both messages, keying the second by its path.
+             */
+            if ( ( it != snapshot.messages.end() ) &&
+                 ( seen.find( it->second.get() ) != seen.end() ) &&
+                 ( it->second->path() != file ) )
+            {
+                key = file;
+                it  = snapshot.messages.find( key );
+            }
+
+            if ( it == snapshot.messages.end() )
+            {
+                std::shared_ptr<CMessage> t = std::shared_ptr<CMessage>(new CMessage(file));
+                snapshot.messages[key] = t;
+                snapshot.order.push_back( t );
+                seen.insert( t.get() );
+                added.push_back( t );
+                changed = true;
+            }
+            else
+            {
+                std::shared_ptr<CMessage> t = it->second;
+                snapshot.order.push_back( t );
+                seen.insert( t.get() );
+
+                if ( t->path() != file )
+                {
+                    t->path( file );
+                    renamed.push_back( t );
+                    changed = true;
+                }
+            }
+        }
+        closedir(dp);
+    }
+
+    /**
+     * Anything we didn't see has been removed.
+     */
+    for (auto it = snapshot.messages.begin(); it != snapshot.messages.end(); )
+    {
+        if ( seen.find( it->second.get() ) == seen.end() )
+        {
+            removed.push_back( it->second );
+            it = snapshot.messages.erase( it );
+            changed = true;
+        }
+        else
+            ++it;
+    }
+
+    return( changed );
+}
+
+
+/**
+ * Return the unique part of a maildir filename.
+ */
+std::string CMaildir::stem( const std::string &filename )
+{
+    std::string name = filename;
+
+    size_t slash = name.find_last_of( '/' );
+    if ( slash != std::string::npos )
+        name = name.substr( slash + 1 );
+
+    size_t info = name.find( ':' );
+    if ( info != std::string::npos )
+        name = name.substr( 0, info );
+
+    return( name );
+}
+
+
 /**
  * Generate a new filename in the given folder.
  */
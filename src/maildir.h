@@ -21,6 +21,8 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <ctime>
 
 /**
  * Forward declaration of class.
@@ -32,6 +34,38 @@ class CMessage;
  */
 typedef std::vector<std::shared_ptr<CMessage> > CMessageList;
 
+/**
+ * A snapshot of the messages contained within a maildir.
+ *
+ * Messages are keyed by the unique stem of their filename, i.e. the part
+ * before ":2,", so that a message which has merely had its flags changed
+ * may be recognized as the same message.
+ */
+struct CMaildirSnapshot
+{
+    /**
+     * The time at which the snapshot was last updated, zero if never.
+     */
+    time_t scanned;
+
+    /**
+     * The watcher generation at the time of the last update.
+     */
+    unsigned long generation;
+
+    /**
+     * The messages we found, keyed by filename stem.
+     */
+    std::unordered_map<std::string, std::shared_ptr<CMessage> > messages;
+
+    /**
+     * The same messages, in the order they were found on-disk.
+     */
+    CMessageList order;
+
+    CMaildirSnapshot() : scanned(0), generation(0) {}
+};
+
 /**
  * An object for working with maildir folders.
  *
@@ -108,6 +142,21 @@ public:
      */
     CMessageList getMessages();
 
+    /**
+     * Update the given snapshot to match the contents of the folder.
+     *
+     * Messages which were added, removed, or renamed, are appended to
+     * the given lists, and true is returned if there were any.
+     */
+    bool rescan( CMaildirSnapshot &snapshot, CMessageList &added,
+                 CMessageList &removed, CMessageList &renamed );
+
+    /**
+     * Return the unique part of a maildir filename, i.e. the part
+     * before any ":2," flag-suffix.
+     */
+    static std::string stem( const std::string &filename );
+
 
 private:
 
@@ -122,6 +171,11 @@ private:
      */
     void update_cache();
 
+    /**
+     * Count the messages, and unread messages, in cur/ or new/.
+     */
+    void count_messages( const std::string &dir, bool in_new, int &total, int &unread );
+
 private:
 
     /**
@@ -134,6 +188,11 @@ private:
      */
     time_t m_modified;
 
+    /**
+     * The watcher generation our cached counts correspond to.
+     */
+    unsigned long m_generation;
+
     /**
      * Cached unread-count + cached total count.
      */
@@ -47,6 +47,7 @@ int main(int argc, char *argv[])
     bool version         = false;      /* show version */
     bool exit_after_eval = false;      /* exit after eval? */
     bool nodefault       = false;      /* skip default rcfiles? */
+    bool headless        = false;      /* run without a terminal? */
     std::string folder   = "";         /* open folder */
     std::string debug    = "";         /* debug-log */
     std::vector<std::string> rcfile;   /* load startup file(s) */
@@ -60,6 +61,7 @@ int main(int argc, char *argv[])
                 {"eval", required_argument, 0, 'e'},
                 {"exit", no_argument, 0, 'x'},
                 {"folder", required_argument, 0, 'f'},
+                {"headless", no_argument, 0, 'H'},
                 {"nodefault", no_argument, 0, 'n'},
                 {"rcfile", required_argument, 0, 'r'},
                 {"version", no_argument, 0, 'v'},
@@ -69,7 +71,7 @@ int main(int argc, char *argv[])
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "d:e:r:vx:f:", long_options, &option_index);
+        c = getopt_long(argc, argv, "d:e:r:vx:f:H", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (c == -1)
@@ -91,6 +93,9 @@ int main(int argc, char *argv[])
         case 'f':
             folder = optarg;
             break;
+        case 'H':
+            headless = true;
+            break;
         case 'r':
             rcfile.push_back(optarg);
             break;
@@ -148,7 +153,7 @@ int main(int argc, char *argv[])
     /**
      * Create the application.
      */
-    CLumail *obj = new CLumail();
+    CLumail *obj = new CLumail( headless );
 
     /**
      * Load the default init files, and optionally the
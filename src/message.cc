@@ -24,16 +24,27 @@
 #include <fcntl.h>
 #include <string>
 #include <unistd.h>
+#include <cursesw.h>
 #include <unordered_map>
 #include <pcrecpp.h>
 
 
+#include "date_parser.h"
 #include "debug.h"
 #include "file.h"
+#include "filter.h"
+#include "flag_queue.h"
+#include "format_template.h"
 #include "global.h"
+#include "header_cache.h"
+#include "header_reader.h"
 #include "lua.h"
 #include "message.h"
+#include "regexp_cache.h"
 #include "maildir.h"
+#include "message_cache.h"
+#include "rendered_body.h"
+#include "screen.h"
 #include "utfstring.h"
 
 
@@ -45,9 +56,18 @@ CMessage::CMessage(std::string filename)
     m_path         = filename;
     m_date         = 0;
     m_time_cache   = 0;
+    m_inode        = 0;
+    m_size         = 0;
     m_read         = false;
     m_message      = NULL;
     m_fd           = -1;
+    m_headers_complete = false;
+    m_cache_checked    = false;
+    m_headers_partial  = false;
+    m_headers_read     = false;
+    m_index_generation = 0;
+    m_index_width      = -1;
+    m_index_new        = false;
 
 #ifdef LUMAIL_DEBUG
     std::string dm = "CMessage::CMessage(";
@@ -63,6 +83,12 @@ CMessage::CMessage(std::string filename)
  */
 CMessage::~CMessage()
 {
+    /**
+     * Don't lose any flag changes we've yet to write.
+     */
+    if ( ! m_pending_path.empty() )
+        sync_flags();
+
     close_message();
 
 
@@ -114,69 +140,30 @@ bool CMessage::message_parse()
      */
     CGlobal     *global = CGlobal::Instance();
     std::string *filter = global->get_variable("mail_filter");
-    std::string *tmp    = global->get_variable("tmp");
-
-    if ( ( filter != NULL ) && ( ! ( filter->empty() ) ) )
-    {
-        /**
-         * Generate a temporary file for the filter output.
-         */
-        char filename[256] = { '\0' };
-        snprintf( filename, sizeof(filename)-1, "%s/body.filter.XXXXXX", tmp->c_str() );
 
-        /**
-         * Open the file.
-         */
-        int fd  = mkstemp(filename);
-
-        /**
-         * Build up the command to execute, via cat.
-         */
-        std::string cmd = "/bin/cat" ;
-        assert( CFile::exists( cmd ) );
+    /**
+     * We might have parsed this message recently.
+     */
+    CMessageCache *cache = CMessageCache::Instance();
+    std::string filter_cmd = ( filter != NULL ) ? *filter : "";
 
-        cmd += " ";
-        cmd += path();
-        cmd += "|";
-        cmd += *filter;
+    mtime();
+    m_message = cache->lookup( path(), filter_cmd, m_inode, m_size, m_time_cache );
+    if ( is_valid() )
+        return true;
 
+    if ( ( filter != NULL ) && ( ! ( filter->empty() ) ) )
+    {
         /**
-         * Run through the popen dance.
+         * Run the message through the filter, and parse the output.
          */
-        FILE* pipe = popen(cmd.c_str(), "r");
-        if (pipe)
-        {
-            char buffer[16384] = { '\0' };
-            std::string tmp = "";
+        std::string output;
+        CFilterPipeline *pipeline = CFilterPipeline::Instance();
 
-            while(!feof(pipe))
-            {
-                if(fgets(buffer, sizeof(buffer)-1, pipe) != NULL)
-                    tmp += buffer;
-
-                memset(buffer, '\0', sizeof(buffer));
-            }
-            pclose(pipe);
+        if ( pipeline->filter_file( identity(), path(), *filter, output ) )
+            open_message_buffer( output );
 
-            /**
-             * Write the body out to disk.
-             */
-            std::ofstream on;
-            on.open(filename, std::ios::binary);
-            on.write(tmp.c_str(), tmp.size());
-            on.close();
-
-            /**
-             * Parse the message, from the temporary file.
-             */
-            open_message( filename );
-        }
-
-        /**
-         * Don't leak the filename
-         */
-        close(fd);
-        CFile::delete_file( filename );
+        cache->insert( path(), filter_cmd, m_inode, m_size, m_time_cache, m_message );
         return is_valid();
 
     }
@@ -187,6 +174,7 @@ bool CMessage::message_parse()
      */
     open_message( path().c_str() );
 
+    cache->insert( path(), filter_cmd, m_inode, m_size, m_time_cache, m_message );
     return is_valid();
 }
 
@@ -210,17 +198,49 @@ size_t CMessage::size()
     return s.st_size;
 }
 
+/**
+ * A string which identifies the content of this message.
+ *
+ * This is unchanged when the message is renamed, but changes if the
+ * file is modified.
+ */
+std::string CMessage::identity()
+{
+    mtime();
+
+    char buf[128] = { '\0' };
+    snprintf( buf, sizeof(buf)-1, "%lu:%lld:%ld",
+              (unsigned long)m_inode, (long long)m_size, (long)m_time_cache );
+
+    return( buf );
+}
+
+
 /**
  * Update the path to the message.
  */
 void CMessage::path( std::string new_path )
 {
+    /**
+     * If we've been renamed by somebody else then any flag changes we've
+     * yet to write are out of date.
+     */
+    discard_flags();
+
+    /**
+     * Any parsed copy of the message remains valid under its new name.
+     */
+    CMessageCache *cache = CMessageCache::Instance();
+    cache->rename( m_path, new_path );
+
     m_path = new_path;
 
     /**
-     * Reset the cached stat() data.
+     * Reset the cached stat() data, and index-line, as our flags might
+     * have changed.
      */
-    m_time_cache = 0;
+    m_time_cache  = 0;
+    m_index_width = -1;
 
     /**
      * Close the message.
@@ -231,8 +251,11 @@ void CMessage::path( std::string new_path )
 
 /**
  * Copy this message to a different maildir.
+ *
+ * The copy is written into tmp/, and renamed into place once complete,
+ * so that a failure never leaves a partial message in the maildir.
  */
-void CMessage::copy ( const char *destdir )
+bool CMessage::copy( const char *destdir )
 {
     /* Get the source path */
     std::string source = path();
@@ -241,18 +264,87 @@ void CMessage::copy ( const char *destdir )
      * The new path.
      */
     std::string dest = CMaildir::message_in( destdir, is_new() );
+    if ( dest.empty() )
+        return false;
+
+    std::string tmp = std::string( destdir ) + "/tmp/" + CFile::basename( dest );
 
     /**
-     * Copy from source to destination.
+     * Copy from source to tmp/, then move into place.
      */
-    CFile::copy( source, dest );
+    if ( ( ! CFile::copy( source, tmp ) ) ||
+         ( rename( tmp.c_str(), dest.c_str() ) != 0 ) )
+    {
+        DEBUG_LOG( "CMessage::copy(" + source + ") failed: " + std::string( strerror( errno ) ) );
+        unlink( tmp.c_str() );
+        return false;
+    }
+
+    return true;
 }
 
+
+/**
+ * Move this message to a different maildir.
+ *
+ * The file is renamed directly to the name which reflects our current
+ * flags, so any pending changes are written at the same time.  If the
+ * maildir is upon a different filesystem it is copied, then removed.
+ */
+bool CMessage::move_to( const std::string &destdir, CDirectoryHandles &dirs )
+{
+    std::string source = path();
+    std::string target = flags_path();
+
+    /**
+     * Keep the message in new/ or cur/, as appropriate.
+     */
+    std::string name = CFile::basename( target );
+    std::string sub  = CFile::basename( target.substr( 0, target.size() - name.size() - 1 ) );
+    std::string dest = destdir + "/" + ( ( sub == "new" ) ? "new" : "cur" ) + "/" + name;
+
+    std::string from_name, to_name;
+    int from_dir = dirs.parent( source, from_name );
+    int to_dir   = dirs.parent( dest, to_name );
+
+    if ( ( from_dir < 0 ) || ( to_dir < 0 ) )
+        return false;
+
+    if ( renameat( from_dir, from_name.c_str(), to_dir, to_name.c_str() ) != 0 )
+    {
+        if ( errno != EXDEV )
+        {
+            DEBUG_LOG( "CMessage::move_to(" + source + ") failed: " + std::string( strerror( errno ) ) );
+            return false;
+        }
+
+        if ( ! CFile::copy( source, dest ) )
+        {
+            unlinkat( to_dir, to_name.c_str(), 0 );
+            return false;
+        }
+
+        unlinkat( from_dir, from_name.c_str(), 0 );
+    }
+
+    /**
+     * Any parsed copy of the message is still valid.
+     */
+    path( dest );
+    return true;
+}
+
+
 /**
  * Remove this message.
  */
 void CMessage::remove()
 {
+    discard_flags();
+
+    CMessageCache *cache = CMessageCache::Instance();
+    cache->invalidate( path() );
+
     CFile::delete_file( path() );
 }
 
@@ -262,7 +354,7 @@ void CMessage::remove()
 std::string CMessage::get_flags()
 {
     std::string flags = "";
-    std::string pth   = path();
+    std::string pth   = flags_path();
 
     if (pth.empty())
         return (flags);
@@ -302,7 +394,7 @@ void CMessage::set_flags( std::string new_flags )
     /**
      * Get the current ending position.
      */
-    std::string cur_path = path();
+    std::string cur_path = flags_path();
     std::string dst_path = cur_path;
 
     size_t offset = std::string::npos;
@@ -323,14 +415,84 @@ void CMessage::set_flags( std::string new_flags )
 
     DEBUG_LOG( "CMessage::set_flags()" + cur_path + " to " + dst_path );
     if ( cur_path != dst_path )
+        rename_to( dst_path );
+}
+
+
+/**
+ * The path which reflects our current flags.
+ */
+std::string CMessage::flags_path()
+{
+    if ( m_pending_path.empty() )
+        return( m_path );
+
+    return( m_pending_path );
+}
+
+
+/**
+ * Arrange for the file to be renamed to the given path.
+ *
+ * Any number of changes are coalesced into a single rename.
+ */
+void CMessage::rename_to( const std::string &dst )
+{
+    CFlagQueue *queue = CFlagQueue::Instance();
+
+    /**
+     * The index-line shows our flags.
+     */
+    m_index_width = -1;
+
+    if ( dst == m_path )
     {
-        CFile::move( cur_path, dst_path );
-        path( dst_path );
-        close_message();
+        m_pending_path.clear();
+        queue->forget( this );
+    }
+    else
+    {
+        m_pending_path = dst;
+        queue->add( this );
     }
 }
 
 
+/**
+ * The path the message will have once its flag changes are written.
+ */
+std::string CMessage::pending_path()
+{
+    return( m_pending_path );
+}
+
+
+/**
+ * Write any pending flag changes now.
+ */
+bool CMessage::sync_flags()
+{
+    if ( m_pending_path.empty() )
+        return true;
+
+    return( CFlagQueue::Instance()->flush( this ) );
+}
+
+
+/**
+ * Forget any pending flag changes.
+ */
+void CMessage::discard_flags()
+{
+    if ( m_pending_path.empty() )
+        return;
+
+    m_pending_path.clear();
+    m_index_width = -1;
+    CFlagQueue::Instance()->forget( this );
+}
+
+
 /**
  * Add a flag to a message.
  *
@@ -441,13 +603,15 @@ bool CMessage::matches_filter( std::string *filter )
              * Split the header list by "|" and return true if any of
              * them match.
              */
+            std::shared_ptr<pcrecpp::RE> regexp = CRegexpCache::Instance()->get( pattern );
+
             std::istringstream helper(head);
             std::string tmp;
             while (std::getline(helper, tmp, '|'))
             {
                 std::string value = header( tmp );
 
-                if (pcrecpp::RE(pattern, pcrecpp::RE_Options().set_caseless(true)).PartialMatch(value) )
+                if ( regexp->PartialMatch(value) )
                     return true;
             }
             return false;
@@ -459,18 +623,64 @@ bool CMessage::matches_filter( std::string *filter )
      * OK now we're falling back to matching against the formatted version
      * of the message - as set by `index_format`.
      */
-    std::string formatted = format();
+    std::string formatted;
+    format_into( formatted );
 
     /**
      * Regexp Matching.
      */
-    if (pcrecpp::RE(*filter, pcrecpp::RE_Options().set_caseless(true)).PartialMatch(formatted) )
+    if ( CRegexpCache::Instance()->partial_match( *filter, formatted ) )
         return true;
 
     return false;
 }
 
 
+/**
+ * The line to draw for this message in index-mode.
+ */
+const std::string &CMessage::index_line( int width, bool &unread )
+{
+    unsigned long gen = CGlobal::Instance()->get_variable_generation( "index_format" );
+
+    if ( ( m_index_width == width ) && ( m_index_generation == gen ) )
+    {
+        unread = m_index_new;
+        return( m_index_line );
+    }
+
+    m_index_line.clear();
+    format_into( m_index_line );
+
+    /**
+     * Truncate, counting characters rather than bytes, then pad.
+     */
+    int chars = 0;
+    for( size_t i = 0; i < m_index_line.size(); i++ )
+    {
+        if ( ( m_index_line[i] & 0xC0 ) == 0x80 )
+            continue;
+
+        if ( chars == width )
+        {
+            m_index_line.resize( i );
+            break;
+        }
+        chars++;
+    }
+
+    if ( chars < width )
+        m_index_line.append( width - chars, ' ' );
+
+    m_index_new        = is_new();
+    m_index_generation = gen;
+    m_index_width      = width;
+
+    unread = m_index_new;
+    return( m_index_line );
+}
+
+
 /**
  * Is this message new?
  */
@@ -520,6 +730,8 @@ time_t CMessage::mtime()
         return m_time_cache;
 
     memcpy(&m_time_cache, &s.st_mtime, sizeof(time_t));
+    m_inode = s.st_ino;
+    m_size  = s.st_size;
     return m_time_cache;
 }
 
@@ -532,7 +744,7 @@ bool CMessage::mark_read()
     /*
      * Get the current path, and build a new one.
      */
-    std::string c_path = path();
+    std::string c_path = flags_path();
     std::string n_path = "";
 
     size_t offset = std::string::npos;
@@ -549,16 +761,9 @@ bool CMessage::mark_read()
         std::string after  = c_path.substr(offset+strlen("/new/"));
 
         n_path = before + "/cur/" + after;
-        if ( rename(  c_path.c_str(), n_path.c_str() )  == 0 )
-        {
-            path(n_path);
-            add_flag( 'S' );
-            return true;
-        }
-        else
-        {
-            return false;
-        }
+        rename_to( n_path );
+        add_flag( 'S' );
+        return true;
     }
     else
     {
@@ -621,162 +826,295 @@ bool CMessage::mark_unflagged()
 }
 
 
+/**
+ * The fields which may be used in `index_format`.
+ */
+typedef enum { FMT_FLAGS = 1, FMT_FROM, FMT_TO, FMT_SUBJECT, FMT_DATE, FMT_YEAR, FMT_MONTH, FMT_MON, FMT_DAY } TIndexField;
+
+static const CFormatField index_fields[] = {
+    { "FLAGS",   FMT_FLAGS },
+    { "FROM",    FMT_FROM },
+    { "TO",      FMT_TO },
+    { "SUBJECT", FMT_SUBJECT },
+    { "DATE",    FMT_DATE },
+    { "YEAR",    FMT_YEAR },
+    { "MONTH",   FMT_MONTH },
+    { "MON",     FMT_MON },
+    { "DAY",     FMT_DAY },
+    { NULL,      0 }
+};
+
+
 /**
  * Format the message for display in the header - via the lua format string.
  */
 UTFString CMessage::format( std::string fmt )
 {
-    UTFString result = fmt;
+    std::string result;
+    format_into( result, fmt );
+    return( result );
+}
+
 
+/**
+ * Append the formatted message to the given buffer.
+ */
+void CMessage::format_into( std::string &out, const std::string &fmt )
+{
     /**
-     * Get the format-string we'll expand from the global
-     * setting, if it wasn't supplied.
+     * Use the compiled form of the global setting, if no format-string
+     * was supplied.
      */
-    if ( result.empty() )
+    std::shared_ptr<CFormatTemplate> tmpl;
+    if ( fmt.empty() )
+        tmpl = CFormatTemplate::for_variable( "index_format", index_fields, true );
+    else
+        tmpl = std::make_shared<CFormatTemplate>( fmt, index_fields, true );
+
+    int width = tmpl->relative() ? CScreen::width() - 3 : 0;
+
+    tmpl->expand( out, width, [this]( const CFormatToken &token, std::string &buf )
     {
-        CGlobal *global  = CGlobal::Instance();
-        std::string *fmt = global->get_variable("index_format");
-        result = std::string(*fmt);
-    }
+        switch( token.id )
+        {
+        case FMT_FLAGS:
+        {
+            /**
+             * Ensure the flags are suitably padded.
+             */
+            std::string flags = get_flags();
+            buf += flags;
+            if ( flags.size() < 4 )
+                buf.append( 4 - flags.size(), ' ' );
+            break;
+        }
+        case FMT_FROM:
+            buf += header( "From" ).raw();
+            break;
+        case FMT_TO:
+            buf += header( "To" ).raw();
+            break;
+        case FMT_SUBJECT:
+            buf += header( "Subject" ).raw();
+            break;
+        case FMT_DATE:
+            buf += date();
+            break;
+        case FMT_YEAR:
+            buf += date( EYEAR );
+            break;
+        case FMT_MONTH:
+            buf += date( EMONTH );
+            break;
+        case FMT_MON:
+            buf += date( EMON );
+            break;
+        case FMT_DAY:
+            buf += date( EDAY );
+            break;
+        case FORMAT_HEADER:
+        {
+            /**
+             * See if it is header value we can find.
+             */
+            UTFString value = header( token.text );
+            if ( value.empty() )
+                buf += "[unset]";
+            else
+                buf += value.raw();
+            break;
+        }
+        }
+    });
+}
+
 
+/**
+ * Retrieve the value of a given header from the message.
+ *
+ * NOTE: All headers are converted to lower-case prior to lookup.
+ *
+ */
+UTFString CMessage::header( std::string name )
+{
     /**
-     * The variables we know about.
+     * Lookup the cached values.
      */
-    const char *fields[10] = { "$FLAGS", "$FROM", "$TO", "$SUBJECT",  "$DATE", "$YEAR", "$MONTH", "$MON", "$DAY", 0 };
-    const char **std_name = fields;
-
+    std::string nm(name);
+    std::transform(nm.begin(), nm.end(), nm.begin(), tolower);
 
     /**
-     * Iterate over everything we could possibly-expand.
+     * If we don't have this header then try the header-cache, and
+     * failing that open the message for parsing and read them all.
      */
-    for( int i = 0 ; std_name[i] ; ++i)
+    if ( ( ! m_headers_complete ) &&
+         ( m_header_values.find( nm ) == m_header_values.end() ) )
     {
+        load_cached_headers();
 
-        size_t offset = result.find( std_name[i], 0 );
-
-        if ( ( offset != std::string::npos ) && ( offset < result.size() ) )
+        if ( m_header_values.find( nm ) == m_header_values.end() )
         {
-
-            /**
-             * The bit before the variable, the bit after, and the body we'll replace it with.
-             */
-            std::string before = result.substr(0, offset);
-            std::string body = "";
-            std::string after  = result.substr(offset+strlen(std_name[i]));
-
             /**
-             * Expand the specific variables.
+             * Read the headers without GMime, if we can.
              */
-            if ( strcmp(std_name[i] , "$TO" ) == 0 )
-            {
-                body = header( "To" );
-            }
-            if ( strcmp(std_name[i] , "$DATE" ) == 0 )
-            {
-                body = date();
-            }
-            if ( strcmp(std_name[i] , "$FROM" ) == 0 )
-            {
-                body += header( "From" );
-            }
-            if ( strcmp(std_name[i] , "$FLAGS" ) == 0 )
-            {
-                /**
-                 * Ensure the flags are suitably padded.
-                 */
-                body = get_flags();
-
-                while( body.size() < 4 )
-                    body += " ";
-            }
-            if ( strcmp(std_name[i] , "$SUBJECT" ) == 0 )
-            {
-                body = header( "Subject" );
-            }
-            if ( strcmp(std_name[i],  "$YEAR" ) == 0 )
-            {
-                body = date(EYEAR);
-            }
-            if ( strcmp(std_name[i],  "$MONTH" ) == 0 )
-            {
-                body = date(EMONTH);
-            }
-            if ( strcmp(std_name[i],  "$MON" ) == 0 )
-            {
-                body = date(EMON);
-            }
-            if ( strcmp(std_name[i],  "$DAY" ) == 0 )
+            if ( ! read_headers() )
             {
-                body = date(EDAY);
+                DEBUG_LOG( "CMessage::header(" + name + ") - Triggering CMessage::headers()" );
+                headers();
             }
-
-            result = before + body + after;
         }
     }
 
     /**
-     * If the value is still unchanged ..
+     * Headers shouldn't have newlines in them.
      */
-    if ( result.size() > 1 && result.at(0) == '$' )
-    {
-        /**
-         * See if it is header value we can find.
-         */
-        result = header( result.substr(1) );
-        if ( result.empty() )
-            result = "[unset]";
-    }
+    std::string val = m_header_values[nm];
+    val.erase(std::remove(val.begin(), val.end(), '\n'), val.end());
+    val.erase(std::remove(val.begin(), val.end(), '\r'), val.end());
+
+    return( val );
 
-    return( result );
 }
 
 
 /**
- * Retrieve the value of a given header from the message.
+ * Populate our headers from the header-cache, if possible.
  *
- * NOTE: All headers are converted to lower-case prior to lookup.
+ * This is only attempted once per message.
+ */
+bool CMessage::load_cached_headers()
+{
+    if ( m_cache_checked )
+        return false;
+
+    m_cache_checked = true;
+
+    CHeaderCache *cache = CHeaderCache::Instance();
+    if ( ! cache->enabled() )
+        return false;
+
+    /**
+     * Ensure we have the inode, size, & mtime of the file.
+     */
+    if ( mtime() == 0 )
+        return false;
+
+    m_headers_partial = cache->lookup( path(), m_inode, m_size, m_time_cache, m_header_values, m_date );
+    return( m_headers_partial );
+}
+
+
+/**
+ * Have the headers we display been loaded?
+ */
+bool CMessage::headers_loaded()
+{
+    if ( m_headers_complete || m_headers_read || m_headers_partial )
+        return true;
+
+    load_cached_headers();
+    return( m_headers_partial );
+}
+
+
+/**
+ * Adopt headers which were read in the background.
  *
+ * They're ignored if the file has changed since they were read.
  */
-UTFString CMessage::header( std::string name )
+void CMessage::set_headers( ino_t inode, off_t size, time_t mtime,
+                            const std::unordered_map<std::string, UTFString> &headers, time_t date )
 {
+    if ( m_headers_complete || m_headers_read || m_headers_partial )
+        return;
+
+    if ( ( this->mtime() != mtime ) || ( m_inode != inode ) || ( m_size != size ) )
+        return;
+
     /**
-     * If we don't have the set of header:value pairs from the
-     * message then open the message for parsing and read them all.
+     * Anything we've already read, individually, takes precedence.
      */
-    if ( m_header_values.empty() )
+    for (auto it : headers)
     {
-        DEBUG_LOG( "CMessage::header(" + name + ") - Triggering CMessage::headers()" );
-        headers();
+        if ( m_header_values.find( it.first ) == m_header_values.end() )
+            m_header_values[it.first] = it.second;
     }
 
+    if ( m_date == 0 )
+        m_date = date;
+
+    m_headers_partial = true;
+
+    CHeaderCache *cache = CHeaderCache::Instance();
+    if ( cache->enabled() )
+        cache->store( path(), m_inode, m_size, m_time_cache, m_header_values, m_date );
+}
+
+
+
+/**
+ * Read the headers of the message, without involving GMime.
+ *
+ * This is only done once per message, and the result is also stored
+ * in the header-cache.  The reader is discarded once its values have
+ * been copied, so we don't keep the raw headers of every message.
+ */
+bool CMessage::read_headers()
+{
+    if ( m_headers_read )
+        return true;
+
     /**
-     * Lookup the cached values.
+     * If the message is filtered then the headers we display must come
+     * from the filtered version, which needs a full parse.
      */
-    std::string nm(name);
-    std::transform(nm.begin(), nm.end(), nm.begin(), tolower);
+    CGlobal     *global = CGlobal::Instance();
+    std::string *filter = global->get_variable("mail_filter");
+    if ( ( filter != NULL ) && ( ! ( filter->empty() ) ) )
+        return false;
+
+    DEBUG_LOG( "CMessage::read_headers() - Reading from message:" + path() );
+
+    CHeaderReader reader;
+    if ( ! reader.read( path() ) )
+        return false;
+
+    m_headers_read     = true;
+    m_headers_complete = true;
+
+    m_header_values.clear();
+    for (std::string nm : reader.names())
+        m_header_values[nm] = reader.get( nm );
 
     /**
-     * Headers shouldn't have newlines in them.
+     * Update the header-cache with the headers it keeps.
      */
-    std::string val = m_header_values[nm];
-    val.erase(std::remove(val.begin(), val.end(), '\n'), val.end());
-    val.erase(std::remove(val.begin(), val.end(), '\r'), val.end());
-
-    return( val );
+    CHeaderCache *cache = CHeaderCache::Instance();
+    if ( cache->enabled() && ( mtime() != 0 ) )
+    {
+        std::unordered_map<std::string, UTFString> wanted;
+        for (std::string nm : cache->wanted())
+        {
+            auto it = m_header_values.find( nm );
+            if ( it != m_header_values.end() )
+                wanted[nm] = it->second;
+        }
+        cache->store( path(), m_inode, m_size, m_time_cache, wanted, m_date );
+    }
 
+    return true;
 }
 
 
-
 /**
  * Retrieve all headers, and their values, from the message.
  */
 std::unordered_map<std::string, UTFString> CMessage::headers()
 {
     /**
-     * If the headers are empty then read them.
+     * If we don't have all the headers then read them.
      */
-    if ( m_header_values.empty() )
+    if ( ( ! m_headers_complete ) && ( ! read_headers() ) )
     {
         DEBUG_LOG( "CMessage::headers() - Reading from message:" + path() );
 
@@ -789,6 +1127,8 @@ std::unordered_map<std::string, UTFString> CMessage::headers()
         if ( !message_parse() )
             return m_header_values;
 
+        m_header_values.clear();
+
         /**
          * Prepare to iterate.
          */
@@ -833,6 +1173,15 @@ std::unordered_map<std::string, UTFString> CMessage::headers()
          * Close the message.
          */
         close_message();
+
+        m_headers_complete = true;
+
+        /**
+         * Update the header-cache, so we don't need to do this again.
+         */
+        CHeaderCache *cache = CHeaderCache::Instance();
+        if ( cache->enabled() && ( mtime() != 0 ) )
+            cache->store( path(), m_inode, m_size, m_time_cache, m_header_values, m_date );
     }
     else
     {
@@ -851,6 +1200,12 @@ std::unordered_map<std::string, UTFString> CMessage::headers()
  */
 std::string CMessage::date(TDate fmt)
 {
+    /**
+     * The parsed date might be in the header-cache.
+     */
+    if ( m_date == 0 )
+        load_cached_headers();
+
     /**
      * If we have a date setup, then use it.
      */
@@ -868,46 +1223,23 @@ std::string CMessage::date(TDate fmt)
              */
             m_date = mtime();
         }
-        else
+        else if ( ! CDateParser::parse( date, m_date ) )
         {
             struct tm t;
 
             /**
-             * Find the date-formats we accept.
-             *
-             * Any from lua.
+             * We couldn't understand the date, so try any formats the
+             * user has supplied.
              */
             CLua *lua = CLua::Instance();
             std::vector<std::string> fmts = lua->table_to_array( "date_formats" );
 
-            /**
-             * Add in the ones we know about too.
-             */
-            fmts.push_back( "%a, %d %b %y %H:%M:%S" );
-            fmts.push_back( "%a, %d %b %Y %H:%M:%S" );
-            fmts.push_back( "%a, %d %b %y %H:%M:%S %z" );
-            fmts.push_back( "%a, %d %b %Y %H:%M:%S %z" );
-            fmts.push_back( "%d %b %y %H:%M:%S" );
-            fmts.push_back( "%d %b %Y %H:%M:%S" );
-            fmts.push_back( "%a %b %d %H:%M:%S GMT %Y" );
-            fmts.push_back( "%a %b %d %H:%M:%S MSD %Y" );
-            fmts.push_back( "%a %b %d %H:%M:%S BST %Y" );
-            fmts.push_back( "%a %b %d %H:%M:%S CEST %Y" );
-            fmts.push_back( "%a %b %d %H:%M:%S PST %Y" );
-            fmts.push_back( "%a, %d %b %y %H:%M" );
-            fmts.push_back( "%a, %d %b %Y %H:%M" );
-            fmts.push_back( "%a, %d %b %Y %H.%M.%S" );
-            fmts.push_back( "%d-%b-%Y" );
-            fmts.push_back( "%m/%d/%y" );
-            fmts.push_back( "%d %b %Y" );
-            fmts.push_back( "%a %b %d %H:%M:%S %Y" );
-            fmts.push_back( "%d.%m.%Y %H:%M:%S" ); /* Date: 30.04.2014 03:41:22 */
-
             char* rc = NULL;
 
             char *current_loc = NULL;
 
-            current_loc = setlocale(LC_TIME, NULL);
+            if ( ! fmts.empty() )
+                current_loc = setlocale(LC_TIME, NULL);
 
             if (current_loc != NULL)
             {
@@ -923,9 +1255,7 @@ std::string CMessage::date(TDate fmt)
                 if ( rc )
                     break;
 
-                t.tm_sec=0;
-                t.tm_min=0;
-                t.tm_hour=0;
+                memset( &t, '\0', sizeof(t) );
                 rc = strptime(date.c_str(), fmt.c_str(), &t);
             }
 
@@ -946,7 +1276,6 @@ std::string CMessage::date(TDate fmt)
                  * Prepare an error message.
                  */
                 std::string error = "alert(\"Failed to parse date: " + date + "\", 30 );" ;
-                CLua *lua = CLua::Instance();
                 lua->execute( error );
 
                 /**
@@ -972,21 +1301,16 @@ std::string CMessage::date(TDate fmt)
                     break;
                 }
             }
-            else
-            {
-                /**
-                 * Warning, couldn't parse timezone.  Probably "BST" or "EST" or
-                 * something like that.  Ignore it.
-                 */
-            }
 
-            /**
-             *  Note: the following line used to use mktime(), until summer time
-             * started and everything went off by an hour.  This timezone stuff
-             * is unpleasant.
-             */
             m_date = timegm(&t);
         }
+
+        /**
+         * Record the parsed date in the header-cache.
+         */
+        CHeaderCache *cache = CHeaderCache::Instance();
+        if ( cache->enabled() && ( mtime() != 0 ) )
+            cache->store_date( path(), m_inode, m_size, m_time_cache, m_date );
     }
 
     if ( fmt == EFULL )
@@ -1094,23 +1418,41 @@ time_t CMessage::get_date_field()
  */
 UTFString CMessage::get_body()
 {
-    /**
-     * The body we'll return back to the caller.  May be empty if there
-     * is no text/plain part in the message.
-     */
-    UTFString result;
-
     /**
      * Parse the message, if not yet done.
      * Return empty string if parsing failed.
      */
     if ( !message_parse() )
-        return result;
+        return "";
+
+    UTFString result = body_text( m_message );
+
+    /**
+     * All done.
+     */
+    close_message();
+    return( result );
+}
+
+
+/**
+ * Get the text/plain part of the given message.
+ *
+ * This touches nothing but the message, so it may be called from a
+ * worker thread.
+ */
+UTFString CMessage::body_text( GMimeMessage *message )
+{
+    /**
+     * The body we'll return back to the caller.  May be empty if there
+     * is no text/plain part in the message.
+     */
+    UTFString result;
 
     /**
      * Create an iterator to walk over the MIME-parts of the message.
      */
-    GMimePartIter *iter =  g_mime_part_iter_new ((GMimeObject *) m_message);
+    GMimePartIter *iter =  g_mime_part_iter_new ((GMimeObject *) message);
     assert(iter != NULL);
 
     GMimeObject *last = NULL;
@@ -1134,7 +1476,7 @@ UTFString CMessage::get_body()
             /**
              * LOGGING.
              */
-            DEBUG_LOG( "CMessage::get_body() - " + UTFString(content_type->type) + " " + UTFString(content_type->subtype) );
+            DEBUG_LOG( "CMessage::body_text() - " + UTFString(content_type->type) + " " + UTFString(content_type->subtype) );
 
             /**
              * If the content-type is NULL then text/plain is implied.
@@ -1189,23 +1531,19 @@ UTFString CMessage::get_body()
      */
     if ( result.empty() )
     {
-        DEBUG_LOG( "CMessage::get_body() - Fell back to g_mime_message_get_body()" );
+        DEBUG_LOG( "CMessage::body_text() - Fell back to g_mime_message_get_body()" );
 
         /**
          * This function is depreciated ..
          */
-        GMimeObject *x = g_mime_message_get_body( m_message );
+        GMimeObject *x = g_mime_message_get_body( message );
         result = mime_part_to_text( x );
     }
     else
     {
-        DEBUG_LOG( "CMessage::get_body() - SUCCEEDED With GMime/iconv/etc" );
+        DEBUG_LOG( "CMessage::body_text() - SUCCEEDED With GMime/iconv/etc" );
     }
 
-    /**
-     * All done.
-     */
-    close_message();
     return( result );
 }
 
@@ -1215,13 +1553,89 @@ UTFString CMessage::get_body()
  */
 std::vector<UTFString> CMessage::body()
 {
-    std::vector<UTFString> result;
+    return( rendered_body()->lines() );
+}
+
+
+/**
+ * The filters the displayed body depends upon.
+ */
+std::string CMessage::rendered_key()
+{
+    CGlobal     *global  = CGlobal::Instance();
+    std::string *mfilter = global->get_variable("mail_filter");
+    std::string *dfilter = global->get_variable("display_filter");
+
+    std::string key = ( mfilter != NULL ) ? *mfilter : "";
+    key += "\n";
+    key += ( dfilter != NULL ) ? *dfilter : "";
+
+    return( key );
+}
+
+
+/**
+ * Get the body of the message, as it will be displayed.
+ *
+ * The result is shared with the other users of the same body, and is
+ * only rebuilt if the filters which produced it have changed.
+ */
+std::shared_ptr<CRenderedBody> CMessage::rendered_body()
+{
+    std::string key = rendered_key();
+
+    std::shared_ptr<CRenderedBody> result = m_rendered.lock();
+    if ( result && ( key == m_rendered_key ) )
+        return( result );
+
+    /**
+     * Another copy of this message may have rendered it already.
+     */
+    CRenderedBodyCache *cache = CRenderedBodyCache::Instance();
+    std::string cache_key     = identity() + "\n" + key;
+
+    result = cache->get( cache_key );
+    if ( ! result )
+        result = cache->add( cache_key, filtered_body() );
+
+    m_rendered     = result;
+    m_rendered_key = key;
+    return( result );
+}
+
+
+/**
+ * Do we hold a rendered body, for the given filters?
+ */
+bool CMessage::has_rendered_body( const std::string &key )
+{
+    return( ( ! m_rendered.expired() ) && ( key == m_rendered_key ) );
+}
+
 
+/**
+ * Adopt a body which was rendered in the background.
+ */
+void CMessage::set_rendered_body( const std::string &key, std::shared_ptr<CRenderedBody> body )
+{
+    if ( has_rendered_body( key ) )
+        return;
+
+    m_rendered     = body;
+    m_rendered_key = key;
+}
+
+
+/**
+ * Get the body of the message, passed through any `display_filter`.
+ */
+std::string CMessage::filtered_body()
+{
     /**
      * Ensure the message has been read.
      */
     if ( !message_parse() )
-        return result;
+        return "";
 
 
     /**
@@ -1230,95 +1644,90 @@ std::vector<UTFString> CMessage::body()
      */
     UTFString body = get_body();
 
-    /**
-     * At this point we have a std::string containing the body.
-     *
-     * If we have a message_filter set then we should pipe this
-     * through it.
-     *
-     */
-    CGlobal     *global = CGlobal::Instance();
-    std::string *filter = global->get_variable("display_filter");
-    std::string *tmp    = global->get_variable("tmp");
+    CGlobal     *global  = CGlobal::Instance();
+    std::string *filter  = global->get_variable("display_filter");
+    std::string *mfilter = global->get_variable("mail_filter");
 
-    if ( ( filter != NULL ) && ( ! ( filter->empty() ) ) )
-    {
-        /**
-         * Generate a temporary file for the filter output.
-         */
-        char filename[256] = { '\0' };
-        snprintf( filename, sizeof(filename)-1, "%s/msg.filter.XXXXXX", tmp->c_str() );
+    std::string result = display_filtered( identity(), body,
+                                           ( mfilter != NULL ) ? *mfilter : "",
+                                           ( filter != NULL ) ? *filter : "" );
 
-        /**
-         * Open the file.
-         */
-        int fd  = mkstemp(filename);
+    close_message();
+    return( result );
+}
 
-        std::ofstream on;
-        on.open(filename, std::ios::binary);
-        on.write(body.c_str(), body.size());
-        on.close();
 
-        /**
-         * Build up the command to execute, via cat.
-         */
-        std::string cmd = "/bin/cat" ;
-        assert( CFile::exists( cmd ) );
+/**
+ * Pass the body through the `display_filter`, if there is one.
+ */
+std::string CMessage::display_filtered( const std::string &identity, const std::string &body,
+                                        const std::string &mail_filter,
+                                        const std::string &display_filter )
+{
+    if ( display_filter.empty() )
+        return( body );
 
-        cmd += " ";
-        cmd += filename;
-        cmd += "|";
-        cmd += *filter;
+    /**
+     * The body depends upon the mail_filter too.
+     */
+    std::string id = identity + "\n" + mail_filter;
 
-        /**
-         * Run through the popen dance.
-         */
-        FILE* pipe = popen(cmd.c_str(), "r");
-        if (pipe)
-        {
-            char buffer[16384] = { '\0' };
-            std::string tmp = "";
+    std::string output;
+    CFilterPipeline *pipeline = CFilterPipeline::Instance();
 
-            while(!feof(pipe))
-            {
-                if(fgets(buffer, sizeof(buffer)-1, pipe) != NULL)
-                    tmp += buffer;
+    if ( pipeline->filter_text( id, body, display_filter, output ) )
+        return( output );
 
-                memset(buffer, '\0', sizeof(buffer));
-            }
-            pclose(pipe);
+    return( body );
+}
+
+
+/**
+ * Build the body of the message at the given path, as it will be
+ * displayed.  Returns false if the message couldn't be read.
+ *
+ * This doesn't involve Lua, or the message-cache, so it may be called
+ * from a worker thread.
+ */
+bool CMessage::render_file( const std::string &path, const std::string &identity,
+                            const std::string &mail_filter,
+                            const std::string &display_filter, std::string &output )
+{
+    GMimeMessage *message = NULL;
 
+    if ( ! mail_filter.empty() )
+    {
+        std::string filtered;
+        CFilterPipeline *pipeline = CFilterPipeline::Instance();
+
+        if ( pipeline->filter_file( identity, path, mail_filter, filtered ) )
+            message = parse_buffer( filtered );
+    }
+    else
+    {
+        int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+        if ( fd >= 0 )
+        {
             /**
-             * Replace the body we previously generated
-             * with that we've read from popen.
+             * The stream owns the descriptor from here on.
              */
-            body = tmp;
-        }
+            GMimeStream *stream = g_mime_stream_fs_new( fd );
+            GMimeParser *parser = g_mime_parser_new_with_stream( stream );
+            g_object_unref( stream );
 
-        /**
-         * Don't leak the temporary file.
-         */
-        close( fd );
-        CFile::delete_file( filename );
+            message = g_mime_parser_construct_message( parser );
+            g_object_unref( parser );
+        }
     }
 
-    /**
-     * Split the body into an array, by newlines.
-     *
-     * TODO: Use "util.h"
-     *    std::vector<UTFString> split(const UTFString &s, char delim)
-     *
-     */
-    std::stringstream stream(body);
-    std::string line;
-    while (std::getline(stream, line))
-    {
-        result.push_back( line );
-    }
+    if ( message == NULL )
+        return false;
 
+    UTFString body = body_text( message );
+    g_object_unref( message );
 
-    close_message();
-    return(result);
+    output = display_filtered( identity, body, mail_filter, display_filter );
+    return true;
 }
 
 
@@ -1626,6 +2035,39 @@ void CMessage::open_message( const char *filename )
     g_object_unref (parser);
 }
 
+/**
+ * Parse the message from the given buffer, with gmime.
+ */
+void CMessage::open_message_buffer( const std::string &data )
+{
+    DEBUG_LOG( "open_message_buffer(" + path() + ");" );
+
+    m_message = parse_buffer( data );
+
+    if ( m_message == NULL )
+    {
+        DEBUG_LOG( "g_mime_parser_construct_message failed in open_message_buffer("
+                   + path() + ")" );
+    }
+}
+
+
+/**
+ * Parse a message from the given buffer, with gmime.
+ */
+GMimeMessage *CMessage::parse_buffer( const std::string &data )
+{
+    GMimeStream *stream = g_mime_stream_mem_new_with_buffer( data.c_str(), data.size() );
+    GMimeParser *parser = g_mime_parser_new_with_stream (stream);
+    g_object_unref (stream);
+
+    GMimeMessage *message = g_mime_parser_construct_message (parser);
+
+    g_object_unref (parser);
+    return( message );
+}
+
+
 /**
  * Close the message.
  */
@@ -1637,12 +2079,12 @@ void CMessage::close_message()
         m_message = NULL;
     }
 
-
-    if ( m_fd > 0 )
-    {
-        DEBUG_LOG( "file->close" );
-        close( m_fd );
-    }
+    /**
+     * The descriptor belongs to the GMime stream, which closes it once
+     * the last reference to the message - possibly held by the message
+     * cache - is dropped.
+     */
+    m_fd = -1;
 }
 
 
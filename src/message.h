@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <stdint.h>
 #include <glib.h>
@@ -27,9 +28,11 @@
 
 #include "utfstring.h"
 #include "attachment.h"
+#include "rendered_body.h"
 
 
 class CMaildir;
+class CDirectoryHandles;
 
 /**
  * A class for working with a single message.
@@ -77,7 +80,13 @@ public:
     /**
      * Copy this message to a different maildir.
      */
-    void copy( const char *destdir );
+    bool copy( const char *destdir );
+
+    /**
+     * Move this message to a different maildir, keeping its name and
+     * any pending flag changes.
+     */
+    bool move_to( const std::string &destdir, CDirectoryHandles &dirs );
 
     /**
      * Remove this message.
@@ -89,6 +98,22 @@ public:
      */
     UTFString format( std::string fmt = "");
 
+    /**
+     * Append the formatted message to the given buffer, which may be
+     * reused between calls.
+     */
+    void format_into( std::string &out, const std::string &fmt = "" );
+
+    /**
+     * The line to draw for this message in index-mode, padded or
+     * truncated to the given width, along with whether it is new.
+     *
+     * The result is cached until the message is renamed, which includes
+     * any change to its flags, `index_format` is changed, or a different
+     * width is requested.
+     */
+    const std::string &index_line( int width, bool &unread );
+
     /**
      * Retrieve the current flags for this message.
      */
@@ -96,9 +121,28 @@ public:
 
     /**
      * Set the flags for this message.
+     *
+     * The change is made in memory, and the file is renamed to match
+     * later, by the CFlagQueue.
      */
     void set_flags( std::string new_flags );
 
+    /**
+     * The path the message will have once its flag changes are written,
+     * or an empty string if there are none.
+     */
+    std::string pending_path();
+
+    /**
+     * Write any pending flag changes now.
+     */
+    bool sync_flags();
+
+    /**
+     * Forget any pending flag changes, without writing them.
+     */
+    void discard_flags();
+
     /**
      * Add a flag to a message.
      */
@@ -167,6 +211,19 @@ public:
      */
     std::unordered_map<std::string, UTFString> headers();
 
+    /**
+     * Have the headers we display been loaded, from the message or from
+     * the header-cache?  This never reads the message itself.
+     */
+    bool headers_loaded();
+
+    /**
+     * Adopt headers which were read in the background, from the file
+     * with the given identity, unless we've since read them ourselves.
+     */
+    void set_headers( ino_t inode, off_t size, time_t mtime,
+                      const std::unordered_map<std::string, UTFString> &headers, time_t date );
+
     /**
      * Get the date of the message.
      */
@@ -177,6 +234,41 @@ public:
      */
     std::vector<UTFString> body();
 
+    /**
+     * Get the body of the message, as it will be displayed.
+     */
+    std::shared_ptr<CRenderedBody> rendered_body();
+
+    /**
+     * The filters the displayed body depends upon, for the current
+     * configuration.
+     */
+    static std::string rendered_key();
+
+    /**
+     * Do we hold a rendered body, for the given filters?
+     */
+    bool has_rendered_body( const std::string &key );
+
+    /**
+     * Adopt a body which was rendered in the background, unless we
+     * already hold one for the same filters.
+     */
+    void set_rendered_body( const std::string &key, std::shared_ptr<CRenderedBody> body );
+
+    /**
+     * Build the body of the message at the given path, as it will be
+     * displayed.  This may be called from a worker thread.
+     */
+    static bool render_file( const std::string &path, const std::string &identity,
+                             const std::string &mail_filter,
+                             const std::string &display_filter, std::string &output );
+
+    /**
+     * A string which identifies the content of this message.
+     */
+    std::string identity();
+
     /**
      * Get the names of attachments to this message.
      */
@@ -229,7 +321,7 @@ private:
     /**
      * Helper for decoding a body.
      */
-    UTFString mime_part_to_text( GMimeObject *obj );
+    static UTFString mime_part_to_text( GMimeObject *obj );
 
     /**
      * Is the message parsed correctly ?
@@ -246,6 +338,16 @@ private:
      */
     void open_message( const char *filename );
 
+    /**
+     * Parse the message from the given buffer, with gmime.
+     */
+    void open_message_buffer( const std::string &data );
+
+    /**
+     * Parse a message from the given buffer, with gmime.
+     */
+    static GMimeMessage *parse_buffer( const std::string &data );
+
     /**
      * Cleanup the message with gmime.
      */
@@ -261,6 +363,12 @@ private:
      */
     time_t m_time_cache;
 
+    /**
+     * Cached inode + size of the file, valid when m_time_cache is set.
+     */
+    ino_t m_inode;
+    off_t m_size;
+
     /**
      * Cached map of header names + values.
      *
@@ -268,6 +376,42 @@ private:
      */
     std::unordered_map<std::string, UTFString> m_header_values;
 
+    /**
+     * Does m_header_values contain every header, or just the subset
+     * we loaded from the header-cache?
+     */
+    bool m_headers_complete;
+
+    /**
+     * Have we consulted the header-cache for this message?
+     */
+    bool m_cache_checked;
+
+    /**
+     * Does m_header_values contain the subset of headers the header-cache
+     * keeps, either from the cache or read in the background?
+     */
+    bool m_headers_partial;
+
+    /**
+     * Populate our headers from the header-cache, if possible.
+     */
+    bool load_cached_headers();
+
+    /**
+     * Have we read the headers directly from the message?
+     */
+    bool m_headers_read;
+
+    /**
+     * Read the headers of the message, without involving GMime, into
+     * m_header_values.
+     *
+     * Returns false if that isn't possible, because the message
+     * must be passed through the `mail_filter`.
+     */
+    bool read_headers();
+
     /**
      * Parse the message, if that hasn't been done.
      * Returns false if parsing failed.
@@ -286,11 +430,59 @@ private:
      */
     UTFString get_body();
 
+    /**
+     * Get the text/plain part of the given message.
+     */
+    static UTFString body_text( GMimeMessage *message );
+
+    /**
+     * Get the body, passed through any `display_filter`.
+     */
+    std::string filtered_body();
+
+    /**
+     * Pass the body through the `display_filter`, if there is one.
+     */
+    static std::string display_filtered( const std::string &identity, const std::string &body,
+                                         const std::string &mail_filter,
+                                         const std::string &display_filter );
+
+    /**
+     * The body we last rendered, and the filters it was rendered with.
+     */
+    std::weak_ptr<CRenderedBody> m_rendered;
+    std::string m_rendered_key;
+
+    /**
+     * The cached index-line, the `index_format` generation and width it
+     * was rendered for, and whether the message was new at the time.
+     */
+    std::string m_index_line;
+    unsigned long m_index_generation;
+    int m_index_width;
+    bool m_index_new;
+
     /**
      * The file we represent.
      */
     std::string m_path;
 
+    /**
+     * The path we'll be renamed to, once our flag changes are written.
+     */
+    std::string m_pending_path;
+
+    /**
+     * The path which reflects our current flags, whether or not they
+     * have been written.
+     */
+    std::string flags_path();
+
+    /**
+     * Arrange for the file to be renamed to the given path.
+     */
+    void rename_to( const std::string &dst );
+
 
     /**
      * Cached time/date object.
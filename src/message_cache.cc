@@ -0,0 +1,268 @@
+/**
+ * message_cache.cc - A cache of parsed GMime messages.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <stdlib.h>
+#include <vector>
+
+#include "debug.h"
+#include "global.h"
+#include "message_cache.h"
+
+
+/**
+ * Instance-handle.
+ */
+CMessageCache *CMessageCache::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CMessageCache *CMessageCache::Instance()
+{
+    if (!pinstance)
+        pinstance = new CMessageCache;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is private as this class is a singleton.
+ */
+CMessageCache::CMessageCache()
+{
+    m_bytes = 0;
+}
+
+
+/**
+ * Read a numeric budget from the given variable, allowing a K/M/G suffix.
+ */
+static long long get_budget( const char *name )
+{
+    CGlobal *global = CGlobal::Instance();
+    std::string *val = global->get_variable( name );
+    if ( ( val == NULL ) || val->empty() )
+        return 0;
+
+    char *end = NULL;
+    long long result = strtoll( val->c_str(), &end, 10 );
+
+    switch( *end )
+    {
+    case 'k':
+    case 'K':
+        result *= 1024;
+        break;
+    case 'm':
+    case 'M':
+        result *= 1024 * 1024;
+        break;
+    case 'g':
+    case 'G':
+        result *= 1024 * 1024 * 1024;
+        break;
+    }
+
+    return( result );
+}
+
+
+/**
+ * Find the parsed message for the given path + filter.
+ */
+GMimeMessage *CMessageCache::lookup( const std::string &path, const std::string &filter,
+                                     ino_t inode, off_t size, time_t mtime )
+{
+    auto range = m_paths.equal_range( path );
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        std::list<CMessageCacheEntry>::iterator entry = it->second;
+        if ( entry->filter != filter )
+            continue;
+
+        /**
+         * If the file changed then the entry is stale.
+         */
+        if ( ( entry->inode != inode ) ||
+             ( entry->size  != size ) ||
+             ( entry->mtime != mtime ) )
+        {
+            DEBUG_LOG( "CMessageCache::lookup - stale entry " + path );
+            remove( entry );
+            return NULL;
+        }
+
+        /**
+         * Move to the front of the recently-used list.
+         */
+        m_entries.splice( m_entries.begin(), m_entries, entry );
+
+        g_object_ref( entry->message );
+        return( entry->message );
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Add a parsed message to the cache.
+ */
+void CMessageCache::insert( const std::string &path, const std::string &filter,
+                            ino_t inode, off_t size, time_t mtime, GMimeMessage *message )
+{
+    if ( message == NULL )
+        return;
+
+    /**
+     * Caching might be disabled.
+     */
+    if ( get_budget( "message_cache_entries" ) <= 0 )
+        return;
+
+    /**
+     * Replace any existing entry.
+     */
+    auto range = m_paths.equal_range( path );
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if ( it->second->filter == filter )
+        {
+            remove( it->second );
+            break;
+        }
+    }
+
+    CMessageCacheEntry entry;
+    entry.path    = path;
+    entry.filter  = filter;
+    entry.inode   = inode;
+    entry.size    = size;
+    entry.mtime   = mtime;
+    entry.message = message;
+    g_object_ref( message );
+
+    m_entries.push_front( entry );
+    m_paths.insert( std::make_pair( path, m_entries.begin() ) );
+    m_bytes += size;
+
+    expire();
+}
+
+
+/**
+ * A message has been renamed; move any entries to the new path.
+ *
+ * The content of a message doesn't change when its flags do, so there
+ * is no need to parse it again.
+ */
+void CMessageCache::rename( const std::string &old_path, const std::string &new_path )
+{
+    if ( old_path == new_path )
+        return;
+
+    std::vector<std::list<CMessageCacheEntry>::iterator> moved;
+
+    auto range = m_paths.equal_range( old_path );
+    for (auto it = range.first; it != range.second; ++it)
+        moved.push_back( it->second );
+
+    m_paths.erase( old_path );
+
+    for (std::list<CMessageCacheEntry>::iterator entry : moved)
+    {
+        entry->path = new_path;
+        m_paths.insert( std::make_pair( new_path, entry ) );
+    }
+}
+
+
+/**
+ * Remove any entries for the given path.
+ */
+void CMessageCache::invalidate( const std::string &path )
+{
+    std::vector<std::list<CMessageCacheEntry>::iterator> stale;
+
+    auto range = m_paths.equal_range( path );
+    for (auto it = range.first; it != range.second; ++it)
+        stale.push_back( it->second );
+
+    for (std::list<CMessageCacheEntry>::iterator entry : stale)
+        remove( entry );
+}
+
+
+/**
+ * Remove all entries.
+ */
+void CMessageCache::clear()
+{
+    while( ! m_entries.empty() )
+        remove( m_entries.begin() );
+}
+
+
+/**
+ * Remove the given entry, dropping our reference.
+ */
+void CMessageCache::remove( std::list<CMessageCacheEntry>::iterator entry )
+{
+    auto range = m_paths.equal_range( entry->path );
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if ( it->second == entry )
+        {
+            m_paths.erase( it );
+            break;
+        }
+    }
+
+    m_bytes -= entry->size;
+    g_object_unref( entry->message );
+    m_entries.erase( entry );
+}
+
+
+/**
+ * Discard entries until we're within our budget.
+ *
+ * The most recently used entry is always retained, even if it alone
+ * exceeds the size budget.
+ */
+void CMessageCache::expire()
+{
+    long long max_entries = get_budget( "message_cache_entries" );
+    long long max_bytes   = get_budget( "message_cache_size" );
+
+    while( m_entries.size() > 1 )
+    {
+        bool over = ( (long long)m_entries.size() > max_entries ) ||
+                    ( ( max_bytes > 0 ) && ( m_bytes > max_bytes ) );
+        if ( ! over )
+            break;
+
+        std::list<CMessageCacheEntry>::iterator last = m_entries.end();
+        --last;
+
+        DEBUG_LOG( "CMessageCache::expire - discarding " + last->path );
+        remove( last );
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * message_cache.h - A cache of parsed GMime messages.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+#include <gmime/gmime.h>
+
+
+/**
+ * A singleton class which retains recently parsed messages, so that
+ * drawing a message, listing its attachments, and fetching its MIME
+ * parts don't each parse the file again.
+ *
+ * The cache holds its own reference to each GMimeMessage.  It is bounded
+ * by both the number of messages and their total size on-disk, as set by
+ * the `message_cache_entries` and `message_cache_size` variables, and
+ * the least recently used message is discarded first.
+ *
+ * Entries are keyed by path, and by the filter the message was passed
+ * through.  They are only returned if the inode, size, and mtime of the
+ * file still match those recorded when it was parsed.
+ */
+class CMessageCache
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CMessageCache *Instance();
+
+    /**
+     * Find the parsed message for the given path + filter.
+     *
+     * The result has a new reference added, which the caller must drop.
+     * Returns NULL if there is no valid entry.
+     */
+    GMimeMessage *lookup( const std::string &path, const std::string &filter,
+                          ino_t inode, off_t size, time_t mtime );
+
+    /**
+     * Add a parsed message to the cache, which takes its own reference.
+     */
+    void insert( const std::string &path, const std::string &filter,
+                 ino_t inode, off_t size, time_t mtime, GMimeMessage *message );
+
+    /**
+     * A message has been renamed; move any entries to the new path.
+     */
+    void rename( const std::string &old_path, const std::string &new_path );
+
+    /**
+     * Remove any entries for the given path.
+     */
+    void invalidate( const std::string &path );
+
+    /**
+     * Remove all entries.
+     */
+    void clear();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CMessageCache();
+    CMessageCache(const CMessageCache &);
+    CMessageCache & operator=(const CMessageCache &);
+
+private:
+
+    /**
+     * A single cached message.
+     */
+    struct CMessageCacheEntry
+    {
+        std::string path;
+        std::string filter;
+        ino_t  inode;
+        off_t  size;
+        time_t mtime;
+        GMimeMessage *message;
+    };
+
+    /**
+     * Remove the given entry, dropping our reference.
+     */
+    void remove( std::list<CMessageCacheEntry>::iterator it );
+
+    /**
+     * Discard entries until we're within our budget.
+     */
+    void expire();
+
+    /**
+     * The single instance of this class.
+     */
+    static CMessageCache *pinstance;
+
+    /**
+     * The cached messages, most recently used first.
+     */
+    std::list<CMessageCacheEntry> m_entries;
+
+    /**
+     * The entries for each path.
+     */
+    std::unordered_multimap<std::string, std::list<CMessageCacheEntry>::iterator> m_paths;
+
+    /**
+     * The total size of the cached messages.
+     */
+    off_t m_bytes;
+
+};
@@ -0,0 +1,232 @@
+/**
+ * message_prefetch.cc - Render the bodies of nearby messages in the background.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <unordered_set>
+#include <vector>
+
+#include "debug.h"
+#include "filter.h"
+#include "global.h"
+#include "message.h"
+#include "message_prefetch.h"
+#include "worker_pool.h"
+
+
+/**
+ * Instance-handle.
+ */
+CMessagePrefetch *CMessagePrefetch::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CMessagePrefetch *CMessagePrefetch::Instance()
+{
+    if (!pinstance)
+        pinstance = new CMessagePrefetch;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is protected as this class is a singleton.
+ */
+CMessagePrefetch::CMessagePrefetch()
+{
+    m_enabled = false;
+}
+
+
+/**
+ * Allow/Prevent prefetching.
+ */
+void CMessagePrefetch::enable( bool state )
+{
+    if ( state )
+    {
+        /**
+         * The workers share the filter cache, so make sure it exists
+         * before they do.
+         */
+        CFilterPipeline::Instance();
+    }
+    else
+        cancel();
+
+    m_enabled = state;
+}
+
+
+/**
+ * Abandon all outstanding jobs, and release the bodies we hold.
+ */
+void CMessagePrefetch::cancel()
+{
+    for (auto &pending : m_pending)
+        *(pending.second) = true;
+
+    m_pending.clear();
+    m_bodies.clear();
+    m_position.clear();
+}
+
+
+/**
+ * Render the messages either side of the selected one.
+ */
+void CMessagePrefetch::around( CMessageView *messages, int selected )
+{
+    if ( ! m_enabled || ( CWorkerPool::Instance()->size() == 0 ) ||
+         ( messages == NULL ) || messages->empty() )
+        return;
+
+    int count = messages->size();
+    if ( ( selected < 0 ) || ( selected >= count ) )
+        return;
+
+    /**
+     * We're called whenever the message is redrawn, so there's nothing
+     * to do unless the selection, or the filters, have changed.
+     */
+    std::string key      = CMessage::rendered_key();
+    std::string position = messages->at( selected )->path() + "\n" +
+        std::to_string( count ) + "\n" + key;
+
+    if ( position == m_position )
+        return;
+
+    m_position = position;
+
+    /**
+     * The nearest messages are rendered first.
+     */
+    std::vector<std::shared_ptr<CMessage> > nearby;
+    std::unordered_set<std::string> paths;
+
+    for( int i = 1; i <= MESSAGE_PREFETCH_COUNT; i++ )
+    {
+        if ( selected + i < count )
+            nearby.push_back( messages->at( selected + i ) );
+        if ( selected - i >= 0 )
+            nearby.push_back( messages->at( selected - i ) );
+    }
+
+    for (std::shared_ptr<CMessage> &message : nearby)
+        paths.insert( message->path() );
+
+    /**
+     * Abandon the jobs for messages which are no longer nearby, if they
+     * haven't yet started.
+     */
+    for( auto it = m_pending.begin(); it != m_pending.end(); )
+    {
+        if ( paths.find( it->first ) == paths.end() )
+        {
+            *(it->second) = true;
+            it = m_pending.erase( it );
+        }
+        else
+            ++it;
+    }
+
+    CGlobal     *global  = CGlobal::Instance();
+    std::string *mfilter = global->get_variable("mail_filter");
+    std::string *dfilter = global->get_variable("display_filter");
+
+    CWorkerPool *pool = CWorkerPool::Instance();
+
+    for (std::shared_ptr<CMessage> &message : nearby)
+    {
+        std::string path = message->path();
+
+        if ( message->has_rendered_body( key ) ||
+             ( m_pending.find( path ) != m_pending.end() ) )
+            continue;
+
+        std::shared_ptr<CPrefetchedBody> job = std::make_shared<CPrefetchedBody>();
+        job->message        = message;
+        job->path           = path;
+        job->identity       = message->identity();
+        job->key            = key;
+        job->mail_filter    = ( mfilter != NULL ) ? *mfilter : "";
+        job->display_filter = ( dfilter != NULL ) ? *dfilter : "";
+
+        std::shared_ptr<std::atomic<bool> > cancelled = std::make_shared<std::atomic<bool> >( false );
+        m_pending[path] = cancelled;
+
+        DEBUG_LOG( "CMessagePrefetch::around - " + path );
+
+        pool->submit( [job, cancelled]()
+                      {
+                          render( *job, *cancelled );
+                      },
+                      [this, job, cancelled]()
+                      {
+                          auto it = m_pending.find( job->path );
+                          if ( ( it != m_pending.end() ) && ( it->second == cancelled ) )
+                              m_pending.erase( it );
+
+                          if ( job->body )
+                              apply( *job );
+                      } );
+    }
+}
+
+
+/**
+ * Render a single body, upon a worker thread.
+ *
+ * Nothing here may touch the message itself, only its path.
+ */
+void CMessagePrefetch::render( CPrefetchedBody &entry, const std::atomic<bool> &cancelled )
+{
+    if ( cancelled )
+        return;
+
+    std::string text;
+    if ( CMessage::render_file( entry.path, entry.identity, entry.mail_filter,
+                                entry.display_filter, text ) )
+        entry.body = std::make_shared<CRenderedBody>( text );
+}
+
+
+/**
+ * Hand a rendered body to its message, upon the main thread.
+ */
+void CMessagePrefetch::apply( CPrefetchedBody &entry )
+{
+    std::shared_ptr<CMessage> message = entry.message.lock();
+    if ( ! message )
+        return;
+
+    /**
+     * The message may have been renamed since, which is fine, but not
+     * modified - and the filters mustn't have changed.
+     */
+    if ( ( message->identity() != entry.identity ) ||
+         ( entry.key != CMessage::rendered_key() ) )
+        return;
+
+    message->set_rendered_body( entry.key, entry.body );
+
+    m_bodies.push_front( entry.body );
+    while( m_bodies.size() > ( 2 * MESSAGE_PREFETCH_COUNT + 2 ) )
+        m_bodies.pop_back();
+}
@@ -0,0 +1,151 @@
+/**
+ * message_prefetch.h - Render the bodies of nearby messages in the background.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "message_view.h"
+#include "rendered_body.h"
+
+
+/**
+ * The number of messages either side of the one being viewed which
+ * are rendered in advance.
+ */
+#ifndef MESSAGE_PREFETCH_COUNT
+# define MESSAGE_PREFETCH_COUNT 3
+#endif
+
+
+/**
+ * A single body, as rendered by a worker.
+ */
+struct CPrefetchedBody
+{
+    /**
+     * The message, and the path it had when we were asked to render it.
+     */
+    std::weak_ptr<CMessage> message;
+    std::string path;
+
+    /**
+     * The identity of the message, and the filters in use, at that time.
+     */
+    std::string identity;
+    std::string key;
+    std::string mail_filter;
+    std::string display_filter;
+
+    /**
+     * The result, if the job wasn't abandoned.
+     */
+    std::shared_ptr<CRenderedBody> body;
+};
+
+
+/**
+ * A singleton which renders the bodies of the messages either side of
+ * the one being viewed, upon the worker-pool, so that moving to the next
+ * or previous message doesn't have to parse, decode, and filter it.
+ *
+ * The messages don't own the bodies they're given - so that the bodies
+ * of messages we've moved away from are released - so the most recent
+ * results are held here.
+ */
+class CMessagePrefetch
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CMessagePrefetch *Instance();
+
+    /**
+     * Allow/Prevent prefetching.
+     *
+     * This is only enabled while the event-loop is running, as there is
+     * nothing to apply the results otherwise.
+     */
+    void enable( bool state );
+
+    /**
+     * Render the messages either side of the selected one, which we
+     * haven't already, abandoning those which are no longer nearby.
+     */
+    void around( CMessageView *messages, int selected );
+
+    /**
+     * Abandon all outstanding jobs, and release the bodies we hold.
+     */
+    void cancel();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CMessagePrefetch();
+    CMessagePrefetch(const CMessagePrefetch &);
+    CMessagePrefetch & operator=(const CMessagePrefetch &);
+
+private:
+
+    /**
+     * Render a single body, upon a worker thread.
+     */
+    static void render( CPrefetchedBody &entry, const std::atomic<bool> &cancelled );
+
+    /**
+     * Hand a rendered body to its message, upon the main thread.
+     */
+    void apply( CPrefetchedBody &entry );
+
+    /**
+     * The single instance of this class.
+     */
+    static CMessagePrefetch *pinstance;
+
+    /**
+     * Are we allowed to prefetch?
+     */
+    bool m_enabled;
+
+    /**
+     * The message, and filters, we last prefetched around.
+     */
+    std::string m_position;
+
+    /**
+     * The outstanding jobs, keyed by path, and the flags which abandon
+     * them.
+     */
+    std::unordered_map<std::string, std::shared_ptr<std::atomic<bool> > > m_pending;
+
+    /**
+     * The bodies we've rendered, most recent first.
+     */
+    std::deque<std::shared_ptr<CRenderedBody> > m_bodies;
+
+};
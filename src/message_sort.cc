@@ -0,0 +1,275 @@
+/**
+ * message_sort.cc - Sort messages by the user-selected criterion.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <thread>
+
+#include "debug.h"
+#include "message_sort.h"
+
+
+/**
+ * Lists shorter than this are sorted without starting a thread.
+ */
+#ifndef SORT_PARALLEL_MIN
+# define SORT_PARALLEL_MIN 2048
+#endif
+
+
+/**
+ * Constructor.  Resolve the named sort-mode.
+ *
+ * An empty mode sorts by date, and an unknown one leaves the messages
+ * in the order they were found.
+ */
+CMessageSorter::CMessageSorter( const std::string &mode )
+{
+    m_mode        = SORT_NONE;
+    m_ascending   = true;
+    m_provisional = false;
+
+    if ( mode.empty() || mode == "date-asc" )
+        m_mode = SORT_DATE;
+    else if ( mode == "date-desc" )
+    {
+        m_mode      = SORT_DATE;
+        m_ascending = false;
+    }
+    else if ( mode == "subject" || mode == "subject-asc" )
+        m_mode = SORT_SUBJECT;
+    else if ( mode == "subject-desc" )
+    {
+        m_mode      = SORT_SUBJECT;
+        m_ascending = false;
+    }
+    else if ( mode == "from" || mode == "from-asc" )
+        m_mode = SORT_FROM;
+    else if ( mode == "from-desc" )
+    {
+        m_mode      = SORT_FROM;
+        m_ascending = false;
+    }
+    else if ( mode == "header" || mode == "header-asc" )
+        m_mode = SORT_HEADER;
+    else if ( mode == "header-desc" )
+    {
+        m_mode      = SORT_HEADER;
+        m_ascending = false;
+    }
+}
+
+
+/**
+ * Build the key for the given message.
+ *
+ * This may read headers, so it is only ever called from the main thread.
+ */
+CSortKey CMessageSorter::key( std::shared_ptr<CMessage> message, size_t index )
+{
+    CSortKey result;
+    result.when    = 0;
+    result.index   = index;
+    result.message = message;
+
+    /**
+     * A provisional sort orders messages without headers by their mtime.
+     */
+    if ( m_provisional && needs_headers() && ! message->headers_loaded() )
+    {
+        result.when = message->mtime();
+        return( result );
+    }
+
+    switch( m_mode )
+    {
+    case SORT_DATE:
+        result.when = message->mtime();
+        break;
+    case SORT_HEADER:
+        result.when = message->get_date_field();
+        break;
+    case SORT_SUBJECT:
+        result.text = message->header( "Subject" );
+        break;
+    case SORT_FROM:
+        result.text = message->header( "From" );
+        break;
+    case SORT_NONE:
+        break;
+    }
+
+    std::transform(result.text.begin(), result.text.end(), result.text.begin(), tolower);
+    return( result );
+}
+
+
+/**
+ * Compare two keys.
+ *
+ * Equal keys retain their original order, whichever the direction.
+ */
+bool CMessageSorter::less( const CSortKey &a, const CSortKey &b ) const
+{
+    int cmp = 0;
+
+    switch( m_mode )
+    {
+    case SORT_DATE:
+    case SORT_HEADER:
+        cmp = ( a.when < b.when ) ? -1 : ( a.when > b.when ) ? 1 : 0;
+        break;
+    case SORT_SUBJECT:
+    case SORT_FROM:
+        cmp = a.text.compare( b.text );
+        break;
+    case SORT_NONE:
+        break;
+    }
+
+    /**
+     * Provisionally, messages which tie are ordered by mtime - which is
+     * all we have for those without headers.
+     */
+    if ( ( cmp == 0 ) && m_provisional && ( m_mode == SORT_SUBJECT || m_mode == SORT_FROM ) )
+        cmp = ( a.when < b.when ) ? -1 : ( a.when > b.when ) ? 1 : 0;
+
+    if ( ! m_ascending )
+        cmp = -cmp;
+
+    if ( cmp != 0 )
+        return( cmp < 0 );
+
+    return( a.index < b.index );
+}
+
+
+/**
+ * Compare two messages.
+ */
+bool CMessageSorter::less( std::shared_ptr<CMessage> a, std::shared_ptr<CMessage> b )
+{
+    return( less( key( a, 0 ), key( b, 0 ) ) );
+}
+
+
+/**
+ * Does this sort depend upon the headers of the messages?
+ */
+bool CMessageSorter::needs_headers() const
+{
+    return( m_mode == SORT_HEADER || m_mode == SORT_SUBJECT || m_mode == SORT_FROM );
+}
+
+
+/**
+ * Make a provisional sort.
+ */
+void CMessageSorter::set_provisional( bool provisional )
+{
+    m_provisional = provisional;
+}
+
+
+/**
+ * Sort each of the given lists, and merge them into the result.
+ */
+void CMessageSorter::sort( const std::vector<CMessageList> &lists, CMessageList &result )
+{
+    result.clear();
+
+    /**
+     * Extract the keys - the index is global, so that ties between
+     * lists are broken consistently.
+     */
+    std::vector<std::vector<CSortKey> > runs( lists.size() );
+    size_t index = 0;
+    size_t total = 0;
+
+    for( size_t i = 0; i < lists.size(); i++ )
+    {
+        runs[i].reserve( lists[i].size() );
+        for (std::shared_ptr<CMessage> message : lists[i])
+            runs[i].push_back( key( message, index++ ) );
+
+        total += lists[i].size();
+    }
+
+    /**
+     * Sort each run - the large ones upon their own threads.
+     */
+    std::vector<std::thread> threads;
+    size_t max_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    std::atomic<size_t> next( 0 );
+
+    auto worker = [&]()
+    {
+        size_t i;
+        while( ( i = next++ ) < runs.size() )
+            std::sort( runs[i].begin(), runs[i].end(),
+                       [this](const CSortKey &a, const CSortKey &b) { return( less( a, b ) ); } );
+    };
+
+    if ( ( runs.size() > 1 ) && ( total >= SORT_PARALLEL_MIN ) )
+    {
+        size_t count = std::min( max_threads, runs.size() );
+        for( size_t i = 1; i < count; i++ )
+            threads.push_back( std::thread( worker ) );
+    }
+    worker();
+
+    for (std::thread &t : threads)
+        t.join();
+
+    /**
+     * Merge the sorted runs.
+     */
+    result.reserve( total );
+
+    if ( runs.size() == 1 )
+    {
+        for (CSortKey &k : runs[0])
+            result.push_back( k.message );
+        return;
+    }
+
+    typedef std::pair<size_t, size_t> TPosition;
+    auto later = [&](const TPosition &a, const TPosition &b)
+    {
+        return( less( runs[b.first][b.second], runs[a.first][a.second] ) );
+    };
+    std::priority_queue<TPosition, std::vector<TPosition>, decltype(later)> heap( later );
+
+    for( size_t i = 0; i < runs.size(); i++ )
+    {
+        if ( ! runs[i].empty() )
+            heap.push( TPosition( i, 0 ) );
+    }
+
+    while( ! heap.empty() )
+    {
+        TPosition top = heap.top();
+        heap.pop();
+
+        result.push_back( runs[top.first][top.second].message );
+
+        if ( top.second + 1 < runs[top.first].size() )
+            heap.push( TPosition( top.first, top.second + 1 ) );
+    }
+}
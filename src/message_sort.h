@@ -0,0 +1,127 @@
+/**
+ * message_sort.h - Sort messages by the user-selected criterion.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "message.h"
+#include "maildir.h"
+
+
+/**
+ * The criteria we can sort by.
+ */
+typedef enum { SORT_NONE, SORT_DATE, SORT_SUBJECT, SORT_FROM, SORT_HEADER } TSortMode;
+
+
+/**
+ * The key we sort a single message by.
+ *
+ * This is extracted once per message, so comparisons never need to
+ * consult the message itself.
+ */
+struct CSortKey
+{
+    /**
+     * The mtime, or Date: header, for date-based sorts.
+     */
+    time_t when;
+
+    /**
+     * The lower-cased header for textual sorts.
+     */
+    std::string text;
+
+    /**
+     * The original position of the message, used to break ties.
+     */
+    size_t index;
+
+    /**
+     * The message itself.
+     */
+    std::shared_ptr<CMessage> message;
+};
+
+
+/**
+ * Sort lists of messages by the criterion named by the `sort` variable.
+ *
+ * The criterion is resolved once, when the sorter is created.  Each list
+ * given to sort() is keyed and sorted independently, in parallel, and
+ * the results are then merged.
+ */
+class CMessageSorter
+{
+
+public:
+
+    /**
+     * Constructor.  Resolve the named sort-mode.
+     */
+    CMessageSorter( const std::string &mode );
+
+    /**
+     * Sort each of the given lists, and merge them into the result.
+     */
+    void sort( const std::vector<CMessageList> &lists, CMessageList &result );
+
+    /**
+     * Compare two messages, as a "less than" predicate.
+     */
+    bool less( std::shared_ptr<CMessage> a, std::shared_ptr<CMessage> b );
+
+    /**
+     * Does this sort depend upon the headers of the messages?
+     */
+    bool needs_headers() const;
+
+    /**
+     * Make a provisional sort, which doesn't read any headers which
+     * haven't already been loaded.  Messages without them are ordered
+     * by their mtime instead.
+     */
+    void set_provisional( bool provisional );
+
+private:
+
+    /**
+     * Build the key for the given message.
+     */
+    CSortKey key( std::shared_ptr<CMessage> message, size_t index );
+
+    /**
+     * Compare two keys, as a "less than" predicate.
+     */
+    bool less( const CSortKey &a, const CSortKey &b ) const;
+
+    /**
+     * The resolved sort-mode, and direction.
+     */
+    TSortMode m_mode;
+    bool m_ascending;
+
+    /**
+     * Is this a provisional sort?
+     */
+    bool m_provisional;
+
+};
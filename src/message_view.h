@@ -0,0 +1,106 @@
+/**
+ * message_view.h - The visible subset of a list of messages.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "maildir.h"
+
+
+/**
+ * The messages which match the current `index_limit`.
+ *
+ * Rather than holding copies of the messages this holds the offsets of
+ * the matching messages within the (sorted) list of all messages in the
+ * selected folders, so changing the limit only needs that list to be
+ * filtered again.
+ */
+class CMessageView
+{
+
+public:
+
+    /**
+     * Constructor.  The view is initially empty.
+     */
+    CMessageView( CMessageList *all ) : m_all( all )
+    {
+    }
+
+    /**
+     * The number of visible messages.
+     */
+    size_t size() const
+    {
+        return( m_index.size() );
+    }
+
+    /**
+     * Are there no visible messages?
+     */
+    bool empty() const
+    {
+        return( m_index.empty() );
+    }
+
+    /**
+     * Get the given visible message.
+     */
+    std::shared_ptr<CMessage> at( size_t offset ) const
+    {
+        return( m_all->at( m_index.at( offset ) ) );
+    }
+
+    std::shared_ptr<CMessage> operator[]( size_t offset ) const
+    {
+        return( (*m_all)[ m_index[offset] ] );
+    }
+
+    /**
+     * Remove all messages from the view.
+     */
+    void clear()
+    {
+        m_index.clear();
+    }
+
+    /**
+     * Make the given message, by its offset amongst all messages, visible.
+     *
+     * Offsets must be added in ascending order.
+     */
+    void push_back( size_t offset )
+    {
+        m_index.push_back( offset );
+    }
+
+private:
+
+    /**
+     * All the messages we're a view of.
+     */
+    CMessageList *m_all;
+
+    /**
+     * The offsets of the visible messages.
+     */
+    std::vector<size_t> m_index;
+
+};
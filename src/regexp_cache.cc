@@ -0,0 +1,139 @@
+/**
+ * regexp_cache.cc - A cache of compiled regular expressions.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include "debug.h"
+#include "regexp_cache.h"
+
+
+/**
+ * Instance-handle.
+ */
+CRegexpCache *CRegexpCache::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CRegexpCache *CRegexpCache::Instance()
+{
+    if (!pinstance)
+        pinstance = new CRegexpCache;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is private as this class is a singleton.
+ */
+CRegexpCache::CRegexpCache()
+{
+    m_hits     = 0;
+    m_compiles = 0;
+}
+
+
+/**
+ * Get the compiled form of the given pattern, compiling it if required.
+ */
+std::shared_ptr<pcrecpp::RE> CRegexpCache::get( const std::string &pattern, bool caseless )
+{
+    std::string key = caseless ? "i:" : "-:";
+    key += pattern;
+
+    std::lock_guard<std::mutex> guard( m_lock );
+
+    std::unordered_map<std::string, CRegexpCacheEntry>::iterator it = m_entries.find( key );
+    if ( it != m_entries.end() )
+    {
+        m_hits += 1;
+
+        /**
+         * Move to the front of the recently-used list.
+         */
+        m_used.splice( m_used.begin(), m_used, it->second.used );
+        return( it->second.regexp );
+    }
+
+#ifdef LUMAIL_DEBUG
+    DEBUG_LOG( "CRegexpCache::get - compiling " + pattern );
+#endif
+
+    m_compiles += 1;
+
+    std::shared_ptr<pcrecpp::RE> regexp( new pcrecpp::RE( pattern, pcrecpp::RE_Options().set_caseless(caseless) ) );
+
+    /**
+     * Discard the least recently-used pattern if we're full.
+     */
+    if ( m_entries.size() >= REGEXP_CACHE_SIZE )
+    {
+        m_entries.erase( m_used.back() );
+        m_used.pop_back();
+    }
+
+    m_used.push_front( key );
+
+    CRegexpCacheEntry entry;
+    entry.regexp = regexp;
+    entry.used   = m_used.begin();
+    m_entries[key] = entry;
+
+    return( regexp );
+}
+
+
+/**
+ * Does the pattern match anywhere within the input?
+ */
+bool CRegexpCache::partial_match( const std::string &pattern, const std::string &input, bool caseless )
+{
+    std::shared_ptr<pcrecpp::RE> regexp = get( pattern, caseless );
+
+    return( regexp->PartialMatch( input ) );
+}
+
+
+/**
+ * The number of lookups satisfied from the cache.
+ */
+unsigned long CRegexpCache::hits()
+{
+    std::lock_guard<std::mutex> guard( m_lock );
+    return( m_hits );
+}
+
+
+/**
+ * The number of patterns we've compiled.
+ */
+unsigned long CRegexpCache::compiles()
+{
+    std::lock_guard<std::mutex> guard( m_lock );
+    return( m_compiles );
+}
+
+
+/**
+ * The number of patterns currently cached.
+ */
+size_t CRegexpCache::size()
+{
+    std::lock_guard<std::mutex> guard( m_lock );
+    return( m_entries.size() );
+}
@@ -0,0 +1,126 @@
+/**
+ * regexp_cache.h - A cache of compiled regular expressions.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <pcrecpp.h>
+
+
+/**
+ * The maximum number of compiled patterns we'll retain.
+ */
+#ifndef REGEXP_CACHE_SIZE
+# define REGEXP_CACHE_SIZE 64
+#endif
+
+
+/**
+ * A singleton class which holds recently-used compiled patterns, so
+ * that limiting a large folder doesn't compile the same expression
+ * once for every message tested.
+ *
+ * Patterns are keyed by their text and options, and the least
+ * recently used pattern is discarded once the cache is full.
+ */
+class CRegexpCache
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CRegexpCache *Instance();
+
+    /**
+     * Get the compiled form of the given pattern, compiling it if required.
+     */
+    std::shared_ptr<pcrecpp::RE> get( const std::string &pattern, bool caseless = true );
+
+    /**
+     * Convenience wrapper: does the pattern match anywhere within the input?
+     */
+    bool partial_match( const std::string &pattern, const std::string &input, bool caseless = true );
+
+    /**
+     * The number of lookups satisfied from the cache.
+     */
+    unsigned long hits();
+
+    /**
+     * The number of patterns we've compiled.
+     */
+    unsigned long compiles();
+
+    /**
+     * The number of patterns currently cached.
+     */
+    size_t size();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CRegexpCache();
+    CRegexpCache(const CRegexpCache &);
+    CRegexpCache & operator=(const CRegexpCache &);
+
+private:
+
+    /**
+     * A cached pattern, and its position in the recently-used list.
+     */
+    struct CRegexpCacheEntry
+    {
+        std::shared_ptr<pcrecpp::RE> regexp;
+        std::list<std::string>::iterator used;
+    };
+
+    /**
+     * The single instance of this class.
+     */
+    static CRegexpCache *pinstance;
+
+    /**
+     * The compiled patterns, keyed by options + pattern.
+     */
+    std::unordered_map<std::string, CRegexpCacheEntry> m_entries;
+
+    /**
+     * The keys of the cached patterns, most recently used first.
+     */
+    std::list<std::string> m_used;
+
+    /**
+     * Statistics.
+     */
+    unsigned long m_hits;
+    unsigned long m_compiles;
+
+    /**
+     * Lookups may come from more than one thread.
+     */
+    std::mutex m_lock;
+
+};
@@ -0,0 +1,256 @@
+/**
+ * rendered_body.cc - The decoded body of a message, indexed by line.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <functional>
+#include <string.h>
+
+#include "rendered_body.h"
+
+
+/**
+ * The number of bodies CRenderedBodyCache retains.
+ */
+#ifndef RENDERED_BODY_CACHE
+# define RENDERED_BODY_CACHE 4
+#endif
+
+
+/**
+ * Constructor.  Build the line-index of the given text.
+ *
+ * Lines are split upon newlines in the same way std::getline() would:
+ * a trailing newline doesn't introduce an empty final line.
+ */
+CRenderedBody::CRenderedBody( const std::string &text ) : m_text( text )
+{
+    m_layout_width = 0;
+
+    size_t start = 0;
+    const char *data = m_text.c_str();
+    size_t len = m_text.size();
+
+    while( start < len )
+    {
+        m_lines.push_back( start );
+
+        const char *nl = (const char *)memchr( data + start, '\n', len - start );
+        if ( nl == NULL )
+            start = len;
+        else
+            start = ( nl - data ) + 1;
+    }
+    m_lines.push_back( len );
+}
+
+
+/**
+ * The number of lines in the body.
+ */
+size_t CRenderedBody::count()
+{
+    return( m_lines.size() - 1 );
+}
+
+
+/**
+ * Get a single line of the body, without its newline.
+ */
+UTFString CRenderedBody::line( size_t offset )
+{
+    if ( offset >= count() )
+        return "";
+
+    size_t start = m_lines[offset];
+    size_t end   = m_lines[offset+1];
+
+    if ( ( end > start ) && ( m_text[end-1] == '\n' ) )
+        end--;
+
+    return( UTFString( m_text.substr( start, end - start ) ) );
+}
+
+
+/**
+ * Get all the lines of the body.
+ */
+std::vector<UTFString> CRenderedBody::lines()
+{
+    std::vector<UTFString> result;
+    result.reserve( count() );
+
+    for( size_t i = 0; i < count(); i++ )
+        result.push_back( line( i ) );
+
+    return( result );
+}
+
+
+/**
+ * The complete text of the body.
+ */
+const std::string &CRenderedBody::text()
+{
+    return( m_text );
+}
+
+
+/**
+ * The number of screen-rows the given line occupies when wrapped.
+ */
+size_t CRenderedBody::rows( size_t offset, size_t width )
+{
+    if ( offset >= count() )
+        return 0;
+
+    layout( width );
+    return( m_layout[offset+1] - m_layout[offset] );
+}
+
+
+/**
+ * Update m_layout for the given width.
+ */
+void CRenderedBody::layout( size_t width )
+{
+    if ( width < 1 )
+        width = 1;
+
+    if ( ( width == m_layout_width ) && ( ! m_layout.empty() ) )
+        return;
+
+    /**
+     * The character-length of each line doesn't depend on the width,
+     * so it is only counted once.
+     */
+    if ( m_chars.empty() )
+    {
+        m_chars.reserve( count() );
+        for( size_t i = 0; i < count(); i++ )
+        {
+            size_t chars = 0;
+            for( size_t b = m_lines[i]; b < m_lines[i+1]; b++ )
+            {
+                unsigned char c = m_text[b];
+                if ( ( c != '\n' ) && ( ( c & 0xC0 ) != 0x80 ) )
+                    chars++;
+            }
+            m_chars.push_back( chars );
+        }
+    }
+
+    m_layout.clear();
+    m_layout.reserve( count() + 1 );
+
+    size_t row = 0;
+    for( size_t i = 0; i < count(); i++ )
+    {
+        m_layout.push_back( row );
+
+        size_t chars = m_chars[i];
+        row += ( chars == 0 ) ? 1 : ( chars + width - 1 ) / width;
+    }
+    m_layout.push_back( row );
+    m_layout_width = width;
+}
+
+
+/**
+ * Instance-handle.
+ */
+CRenderedBodyCache *CRenderedBodyCache::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CRenderedBodyCache *CRenderedBodyCache::Instance()
+{
+    if (!pinstance)
+        pinstance = new CRenderedBodyCache;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is protected as this class is a singleton.
+ */
+CRenderedBodyCache::CRenderedBodyCache()
+{
+}
+
+
+/**
+ * Get the body stored under the given key, or NULL.
+ */
+std::shared_ptr<CRenderedBody> CRenderedBodyCache::get( const std::string &key )
+{
+    for (auto it = m_recent.begin(); it != m_recent.end(); ++it)
+    {
+        if ( it->first == key )
+        {
+            std::shared_ptr<CRenderedBody> found = it->second;
+            m_recent.splice( m_recent.begin(), m_recent, it );
+            return( found );
+        }
+    }
+
+    return( NULL );
+}
+
+
+/**
+ * Index the given text, and store the result under the given key.
+ */
+std::shared_ptr<CRenderedBody> CRenderedBodyCache::add( const std::string &key, const std::string &text )
+{
+    std::shared_ptr<CRenderedBody> body = std::make_shared<CRenderedBody>( text );
+
+    for (auto it = m_recent.begin(); it != m_recent.end(); ++it)
+    {
+        if ( it->first == key )
+        {
+            m_recent.erase( it );
+            break;
+        }
+    }
+
+    m_recent.push_front( std::make_pair( key, body ) );
+    if ( m_recent.size() > RENDERED_BODY_CACHE )
+        m_recent.pop_back();
+
+    return( body );
+}
+
+
+/**
+ * Get the body built from the given text.
+ *
+ * Only the body with the same hash is compared against the text, to
+ * rule out a collision.
+ */
+std::shared_ptr<CRenderedBody> CRenderedBodyCache::for_text( const std::string &text )
+{
+    std::string key = "text:" + std::to_string( std::hash<std::string>()( text ) );
+
+    std::shared_ptr<CRenderedBody> body = get( key );
+    if ( body && ( body->text() == text ) )
+        return( body );
+
+    return( add( key, text ) );
+}
@@ -0,0 +1,161 @@
+/**
+ * rendered_body.h - The decoded body of a message, indexed by line.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utfstring.h"
+
+
+/**
+ * The body of a message, as it will be displayed.
+ *
+ * The text is held once, along with the byte-offset at which each line
+ * starts, so that drawing or searching a slice of a long message doesn't
+ * require the whole of it to be split into separate strings.
+ *
+ * The number of screen-rows each line occupies when wrapped is computed
+ * on demand, and remembered for the most recent screen-width.
+ */
+class CRenderedBody
+{
+
+public:
+
+    /**
+     * Constructor.  Build the line-index of the given text.
+     */
+    CRenderedBody( const std::string &text );
+
+    /**
+     * The number of lines in the body.
+     */
+    size_t count();
+
+    /**
+     * Get a single line of the body, without its newline.
+     */
+    UTFString line( size_t offset );
+
+    /**
+     * Get all the lines of the body.
+     */
+    std::vector<UTFString> lines();
+
+    /**
+     * The complete text of the body.
+     */
+    const std::string &text();
+
+    /**
+     * The number of screen-rows the given line occupies, when wrapped
+     * at the given width.
+     */
+    size_t rows( size_t offset, size_t width );
+
+private:
+
+    /**
+     * Update m_layout for the given width.
+     */
+    void layout( size_t width );
+
+    /**
+     * The text of the body.
+     */
+    std::string m_text;
+
+    /**
+     * The byte-offset of the start of each line, with a final entry
+     * marking the end of the text.
+     */
+    std::vector<size_t> m_lines;
+
+    /**
+     * The length of each line in characters, computed when first needed.
+     */
+    std::vector<size_t> m_chars;
+
+    /**
+     * The first screen-row of each line, for the width m_layout_width.
+     */
+    std::vector<size_t> m_layout;
+    size_t m_layout_width;
+
+};
+
+
+/**
+ * A singleton which holds the most recently rendered bodies, so that
+ * redrawing or scrolling a message doesn't index its body again.
+ *
+ * Bodies are keyed by the identity of the message and the filters
+ * which produced them, or, for the text returned by on_get_body(), by
+ * a hash of that text.
+ */
+class CRenderedBodyCache
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CRenderedBodyCache *Instance();
+
+    /**
+     * Get the body stored under the given key, or NULL.
+     */
+    std::shared_ptr<CRenderedBody> get( const std::string &key );
+
+    /**
+     * Index the given text, and store the result under the given key.
+     */
+    std::shared_ptr<CRenderedBody> add( const std::string &key, const std::string &text );
+
+    /**
+     * Get the body built from the given text, indexing it if required.
+     */
+    std::shared_ptr<CRenderedBody> for_text( const std::string &text );
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CRenderedBodyCache();
+    CRenderedBodyCache(const CRenderedBodyCache &);
+    CRenderedBodyCache & operator=(const CRenderedBodyCache &);
+
+private:
+
+    /**
+     * The single instance of this class.
+     */
+    static CRenderedBodyCache *pinstance;
+
+    /**
+     * The cached bodies, and their keys, most recently used first.
+     */
+    std::list<std::pair<std::string, std::shared_ptr<CRenderedBody> > > m_recent;
+
+};
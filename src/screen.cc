@@ -29,6 +29,7 @@
 
 #include "debug.h"
 #include "file.h"
+#include "frame.h"
 #include "global.h"
 #include "history.h"
 #include "input.h"
@@ -36,6 +37,8 @@
 #include "lua.h"
 #include "maildir.h"
 #include "message.h"
+#include "message_prefetch.h"
+#include "rendered_body.h"
 #include "screen.h"
 #include "utfstring.h"
 #include "util.h"
@@ -45,6 +48,18 @@
 # define DEFAULT_UNREAD_COLOUR "red"
 #endif
 
+/**
+ * The dimensions we report when there is no terminal.
+ */
+#define HEADLESS_WIDTH  80
+#define HEADLESS_HEIGHT 25
+
+
+/**
+ * Are we running without a terminal?
+ */
+bool CScreen::m_headless = false;
+
 
 /**
  * Constructor.  NOP.
@@ -65,10 +80,14 @@ CScreen::~CScreen()
  */
 void CScreen::refresh_display()
 {
+    if ( m_headless )
+        return;
+
     /**
-     * Clear the main-part of the screen.
+     * Start a fresh frame of the main-part of the screen.
      */
-    CScreen::clear_main();
+    CFrame *frame = CFrame::Instance();
+    frame->begin( CScreen::height() - 1, CScreen::width() );
 
     /**
      * Get the current mode.
@@ -88,9 +107,14 @@ void CScreen::refresh_display()
         drawText();
     else
     {
-        move(3, 3);
-        printw("UNKNOWN MODE: '%s'", s->c_str());
+        frame->position(3, 3);
+        frame->print("UNKNOWN MODE: '%s'", s->c_str());
     }
+
+    /**
+     * Draw only what changed since the last refresh.
+     */
+    frame->flush();
 }
 
 /**
@@ -98,6 +122,8 @@ void CScreen::refresh_display()
  */
 void CScreen::drawMaildir()
 {
+    CFrame *frame = CFrame::Instance();
+
     /**
      * Get all known folders + the current display mode
      */
@@ -181,8 +207,8 @@ void CScreen::drawMaildir()
      */
     if ( count < 1 )
     {
-        move(2, 2);
-        printw("No maildirs found matching the limit '%s'.", limit->c_str());
+        frame->position(2, 2);
+        frame->print("No maildirs found matching the limit '%s'.", limit->c_str());
         return;
     }
 
@@ -197,8 +223,8 @@ void CScreen::drawMaildir()
     {
         int unread = 0;
 
-        move(row, 0);
-        printw("  ");
+        frame->position(row, 0);
+        frame->print("  ");
 
         /**
          * The current object.
@@ -244,7 +270,7 @@ void CScreen::drawMaildir()
         }
 
         if (row == rowToHighlight)
-            attrset(highlight_mode);
+            frame->set_attr(highlight_mode);
 
         /**
          * The item we'll draw for this row.
@@ -263,21 +289,21 @@ void CScreen::drawMaildir()
         if ((int)display.size() < (CScreen::width() - 3))
             display += UTFString((CScreen::width() - 3)-(int)display.size(),' ');
 
-        move(row, 2);
+        frame->position(row, 2);
 
         if ( unread )
         {
             if ( row == rowToHighlight )
-                attron( highlight_mode | COLOR_PAIR(m_colours[unread_colour]) );
+                frame->add_attr( highlight_mode | COLOR_PAIR(m_colours[unread_colour]) );
             else
-                attron( COLOR_PAIR(m_colours[unread_colour]) );
+                frame->add_attr( COLOR_PAIR(m_colours[unread_colour]) );
         }
-        printw("%s", display.c_str());
+        frame->print("%s", display.c_str());
 
         /**
          * Reset the colours.
          */
-        attrset(A_NORMAL);
+        frame->set_attr(A_NORMAL);
     }
 }
 
@@ -286,11 +312,13 @@ void CScreen::drawMaildir()
  */
 void CScreen::drawIndex()
 {
+    CFrame *frame = CFrame::Instance();
+
     /**
      * Get all messages from the currently selected maildirs.
      */
     CGlobal *global = CGlobal::Instance();
-    CMessageList *messages = global->get_messages();
+    CMessageView *messages = global->get_messages();
     std::string *filter = global->get_variable("index_limit" );
 
 
@@ -306,21 +334,21 @@ void CScreen::drawIndex()
             /**
              * No folders selected, and no messages.
              */
-            move(2,2);
-            printw( NO_MESSAGES_NO_FOLDERS );
+            frame->position(2,2);
+            frame->print( NO_MESSAGES_NO_FOLDERS );
             return;
         }
 
         /**
          * Show the selected folders.
          */
-        move(2, 2);
+        frame->position(2, 2);
 
         if ( ( filter != NULL ) &&
              ( *filter == "all" ) )
-            printw( NO_MESSAGES_MATCHING_FILTER, filter->c_str() );
+            frame->print( NO_MESSAGES_MATCHING_FILTER, filter->c_str() );
         else
-            printw( NO_MESSAGES_IN_FOLDERS );
+            frame->print( NO_MESSAGES_IN_FOLDERS );
 
         int height = CScreen::height();
         int row = 4;
@@ -335,8 +363,8 @@ void CScreen::drawIndex()
             /**
              * Show the name of the folder.
              */
-            move( row, 5 );
-            printw("%s", folder.c_str() );
+            frame->position( row, 5 );
+            frame->print("%s", folder.c_str() );
             row+=1;
         }
         return;
@@ -405,15 +433,17 @@ void CScreen::drawIndex()
      */
     int row = 0;
 
+    /**
+     * The width available to each row, and the blank line we draw when
+     * there is no message for a row.
+     */
+    int width = CScreen::width() - 3;
+    std::string blank( width > 0 ? width : 0, ' ' );
+
     for (row = 0; row < (height - 1); row++)
     {
-        move(row, 0);
-        printw("  " );
-
-        /**
-         * What we'll output for this row.
-         */
-        UTFString buf;
+        frame->position(row, 0);
+        frame->print("  " );
 
         /**
          * The current object.
@@ -445,47 +475,35 @@ void CScreen::drawIndex()
             cur = messages->at(mailIndex);
 
         if (row == rowToHighlight)
-            attrset(highlight_mode);
+            frame->set_attr(highlight_mode);
 
         /**
-         * Is this message new/unread?
+         * Is this message new/unread?  And what we'll output for this row,
+         * which the message caches until it, the format, or the width
+         * changes.
          */
         bool unread = false;
+        const std::string *buf = &blank;
         if ( cur != NULL )
-            unread = cur->is_new();
+            buf = &cur->index_line( width, unread );
 
         if (unread)
         {
             if ( row == rowToHighlight )
-                attron( highlight_mode | COLOR_PAIR(m_colours[unread_colour]) );
+                frame->add_attr( highlight_mode | COLOR_PAIR(m_colours[unread_colour]) );
             else
-                attron( COLOR_PAIR(m_colours[unread_colour]) );
+                frame->add_attr( COLOR_PAIR(m_colours[unread_colour]) );
         }
 
-        if (cur != NULL)
-            buf =  cur->format();
+        frame->position(row, 2);
+        frame->print("%s", buf->c_str());
 
-        /**
-         * Pad.
-         */
-        if ((int)buf.size() < (CScreen::width() - 3))
-            buf += UTFString((CScreen::width() - 3)-(int)buf.size(),' ');
-
-        /**
-         * Truncate.
-         */
-        if ((int)buf.size() > (CScreen::width() - 3))
-            buf.resize((CScreen::width() - 3));
-
-        move(row, 2);
-        printw("%s", buf.c_str());
-
-        attrset( COLOR_PAIR(m_colours[ "white"]));
+        frame->set_attr( COLOR_PAIR(m_colours[ "white"]));
 
         /**
          * Remove the inverse.
          */
-        attrset(A_NORMAL);
+        frame->set_attr(A_NORMAL);
     }
 }
 
@@ -496,12 +514,14 @@ void CScreen::drawIndex()
  */
 void CScreen::drawMessage()
 {
+    CFrame *frame = CFrame::Instance();
+
 
     /**
      * Get all messages from the currently selected maildirs.
      */
     CGlobal *global = CGlobal::Instance();
-    CMessageList *messages = global->get_messages();
+    CMessageView *messages = global->get_messages();
 
     /**
      * How many lines we've scrolled down the message.
@@ -544,8 +564,8 @@ void CScreen::drawMessage()
         cur = messages->at(selected);
     else
     {
-        move(3,3);
-        printw(NO_MESSAGES);
+        frame->position(3,3);
+        frame->print(NO_MESSAGES);
         return;
     }
 
@@ -593,7 +613,7 @@ void CScreen::drawMessage()
      */
     for (std::string header : headers)
     {
-        move( row, 0 );
+        frame->position( row, 0 );
 
         /**
          * The header-name, in useful format - i.e. without the '$' prefix
@@ -631,9 +651,9 @@ void CScreen::drawMessage()
             /**
              * Draw the single line.
              */
-            attrset( COLOR_PAIR(m_colours[header_colour]) );
-            printw( "%s: %s", name.c_str(), value.c_str() );
-            attrset( COLOR_PAIR(m_colours["white"]) );
+            frame->set_attr( COLOR_PAIR(m_colours[header_colour]) );
+            frame->print( "%s: %s", name.c_str(), value.c_str() );
+            frame->set_attr( COLOR_PAIR(m_colours["white"]) );
             row += 1;
         }
         else
@@ -654,10 +674,10 @@ void CScreen::drawMessage()
             bool cont = true;
             while( cont )
             {
-                move( row, 0 );
-                attrset( COLOR_PAIR(m_colours[header_colour]) );
-                printw( "%s", line.c_str() );
-                attrset( COLOR_PAIR(m_colours["white"]) );
+                frame->position( row, 0 );
+                frame->set_attr( COLOR_PAIR(m_colours[header_colour]) );
+                frame->print( "%s", line.c_str() );
+                frame->set_attr( COLOR_PAIR(m_colours["white"]) );
 
                 row += 1;
                 if ( line.length() > slength )
@@ -698,15 +718,15 @@ void CScreen::drawMessage()
         int acount = 1;
         for (std::string path : attachments)
         {
-            move( row, 0 );
+            frame->position( row, 0 );
 
             /**
              * Change to the right colour, draw the message,
              * and revert.
              */
-            attrset( COLOR_PAIR(m_colours[attachment_colour]) );
-            printw( "Attachment %d - %s", acount, path.c_str() );
-            attrset( COLOR_PAIR(m_colours["white"]));
+            frame->set_attr( COLOR_PAIR(m_colours[attachment_colour]) );
+            frame->print( "Attachment %d - %s", acount, path.c_str() );
+            frame->set_attr( COLOR_PAIR(m_colours["white"]));
 
             acount += 1;
             row += 1;
@@ -716,15 +736,18 @@ void CScreen::drawMessage()
 
     /**
      * Now draw the body.
+     *
+     * The body might come from on_get_body.
      */
-    std::vector<UTFString> body;
+    std::shared_ptr<CRenderedBody> body = lua->on_get_body();
+    if ( ! body )
+        body = cur->rendered_body();
 
     /**
-     * The body might come from on_get_body.
+     * Now that the current message is done, render its neighbours so
+     * that moving to them is instant.
      */
-    body = lua->on_get_body();
-    if ( body.empty() )
-        body = cur->body();
+    CMessagePrefetch::Instance()->around( messages, selected );
 
 
     /**
@@ -762,54 +785,41 @@ void CScreen::drawMessage()
 
     /**
      * Draw each line of the body.
+     *
+     * Only the lines which are visible are fetched, and the number of
+     * rows each occupies when wrapped comes from the body's layout.
      */
     for( int row_idx = 0, line_idx = 0;;)
     {
-        UTFString line = "";
-
         /** Get current line */
-        if ( (line_idx + offset) < (int)body.size() )
-        {
-            line = body[line_idx+offset];
-            line_idx++;
-        }
-        else
+        if ( (line_idx + offset) >= (int)body->count() )
             break;
 
-        int len = line.length();
-        int slen = 0;
-        UTFString subline = line.substr(0, width);
+        UTFString line = body->line(line_idx+offset);
+        size_t rows = wrap ? body->rows(line_idx+offset, width) : 1;
+        line_idx++;
 
-        for(;;)
+        for( size_t part = 0; part < rows; part++ )
         {
             /**
              * Here "row" counts the rows taken up by the
              * headers+attachment lists.
              */
-            move( row_idx + row + 1, 0 );
+            frame->position( row_idx + row + 1, 0 );
 
-            attrset( COLOR_PAIR(m_colours[body_colour]) );
-            printw( "%s", subline.c_str() );
-            attrset( COLOR_PAIR(m_colours["white"]) );
+            UTFString subline = line.substr(part * width, width);
 
-            row_idx++;
+            frame->set_attr( COLOR_PAIR(m_colours[body_colour]) );
+            frame->print( "%s", subline.c_str() );
+            frame->set_attr( COLOR_PAIR(m_colours["white"]) );
 
-            slen += subline.length();
+            row_idx++;
 
             /**
              * Should we stop displaying this line ?
              */
-            if (row_idx > (textspace-2) || !wrap || len == slen)
+            if (row_idx > (textspace-2))
                 break;
-
-            /**
-             * Make sure we don't overstep our bounds by trying to draw past
-             * the line-buffer.
-             */
-            if ( slen > (int)line.size() )
-                break;
-
-            subline = line.substr(slen, width );
         }
 
         /**
@@ -833,6 +843,8 @@ void CScreen::drawMessage()
  */
 void CScreen::drawText()
 {
+    CFrame *frame = CFrame::Instance();
+
     CGlobal *global = CGlobal::Instance();
 
     int offset                  = global->get_text_offset();
@@ -867,8 +879,8 @@ void CScreen::drawText()
             /**
              * Move to the start of the line, and setup the default colour.
              */
-            move(i, 0);
-            attron( COLOR_PAIR(m_colours[text_colour]) );
+            frame->position(i, 0);
+            frame->add_attr( COLOR_PAIR(m_colours[text_colour]) );
 
             /**
              * If the line is of the form ${XX YY ZZ} then strip
@@ -913,7 +925,7 @@ void CScreen::drawText()
                             if ( strcasestr( token.c_str(), "colour:" ) != NULL )
                             {
                                 UTFString col = token.substr( 7 );
-                                attron( COLOR_PAIR(m_colours[col]) );
+                                frame->add_attr( COLOR_PAIR(m_colours[col]) );
                             }
                             else
                             {
@@ -921,7 +933,7 @@ void CScreen::drawText()
 
                                 int val = lookup_curses_attribute( x, 0 );
                                 if ( val != 0 )
-                                    attron( val );
+                                    frame->add_attr( val );
 
                                 delete( x );
                             }
@@ -932,15 +944,15 @@ void CScreen::drawText()
             /**
              * Draw the line of text, and reset attributes.
              */
-            printw("%s", line.c_str());
-            attrset( 0 );
+            frame->print("%s", line.c_str());
+            frame->set_attr( 0 );
         }
     }
     else
     {
 #ifdef LUMAIL_DEBUG
-        move(3, 3);
-        printw("We're outside our array of text?" );
+        frame->position(3, 3);
+        frame->print("We're outside our array of text?" );
 #endif
     }
 }
@@ -951,6 +963,9 @@ void CScreen::drawText()
  */
 void CScreen::setup()
 {
+    if ( m_headless )
+        return;
+
     /**
      * Setup locale.
      */
@@ -1011,13 +1026,33 @@ void CScreen::setup()
 }
 
 
+/**
+ * Run without a terminal.
+ */
+void CScreen::set_headless( bool headless )
+{
+    m_headless = headless;
+}
+
+
+/**
+ * Are we running without a terminal?
+ */
+bool CScreen::headless()
+{
+    return( m_headless );
+}
+
+
 /**
  * Return the width of the screen.
  */
 int CScreen::width()
 {
     struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
+    if ( m_headless || ( ioctl(0, TIOCGWINSZ, &w) != 0 ) )
+        return( HEADLESS_WIDTH );
+
     return (w.ws_col);
 }
 
@@ -1027,15 +1062,47 @@ int CScreen::width()
 int CScreen::height()
 {
     struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
+    if ( m_headless || ( ioctl(0, TIOCGWINSZ, &w) != 0 ) )
+        return( HEADLESS_HEIGHT );
+
     return (w.ws_row);
 }
 
+/**
+ * Leave curses, so that an external command may use the terminal.
+ */
+void CScreen::suspend()
+{
+    if ( m_headless )
+        return;
+
+    refresh();
+    def_prog_mode();
+    endwin();
+}
+
+
+/**
+ * Return to curses after an external command.
+ */
+void CScreen::resume()
+{
+    if ( m_headless )
+        return;
+
+    reset_prog_mode();
+    refresh();
+}
+
+
 /**
  * Clear the status-line of the screen.
  */
 void CScreen::clear_status()
 {
+    if ( m_headless )
+        return;
+
     move(CScreen::height() - 1, 0);
 
     for (int i = 0; i < CScreen::width(); i++)
@@ -1074,6 +1141,8 @@ const char *CScreen::get_key_name( gunichar c, bool isKeyCode)
  */
 void CScreen::clear_main()
 {
+    if ( m_headless )
+        return;
 
     /**
      * Clear all the screen - but not the prompt.
@@ -1088,6 +1157,11 @@ void CScreen::clear_main()
     for(int i = 0; i < ( height - 1 ); i++ )
         mvprintw( i, 0, "%s", blank.c_str() );
 
+    /**
+     * The next refresh must redraw everything.
+     */
+    CFrame::Instance()->invalidate();
+
 }
 
 
@@ -1104,6 +1178,12 @@ std::string CScreen::choose_string( std::vector<std::string> choices )
      */
     assert( choices.size() > 0 );
 
+    /**
+     * Without a terminal there is nobody to choose.
+     */
+    if ( m_headless )
+        return( "" );
+
     /**
      * Find longest/widest entry.
      */
@@ -1399,6 +1479,18 @@ UTFString CScreen::get_line()
 {
     UTFString buffer;
 
+    /**
+     * Without a terminal there is no editing, just read up to the newline.
+     */
+    if ( m_headless )
+    {
+        gunichar c;
+        while( ( CInput::Instance()->get_wchar(&c) != ERR ) && ( c != '\n' ) )
+            buffer += c;
+
+        return( buffer );
+    }
+
     int old_curs = curs_set(1);
     int pos = 0;
     int x, y;
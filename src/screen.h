@@ -50,6 +50,15 @@ public:
      */
     void setup();
 
+    /**
+     * Run without a terminal.
+     *
+     * Nothing is drawn, messages are written to STDOUT, and input is read
+     * from STDIN.
+     */
+    static void set_headless( bool headless );
+    static bool headless();
+
     /**
      * Return the width of the screen.
      */
@@ -62,9 +71,19 @@ public:
 
     /**
      * Clear the main display area, leaving the status-area alone.
+     *
+     * This must be called by anything else which draws over the main
+     * area, so that the next refresh redraws all of it.
      */
     static void clear_main();
 
+    /**
+     * Leave curses, so that an external command may use the terminal,
+     * and return to it afterwards.
+     */
+    static void suspend();
+    static void resume();
+
     /**
      * Clear the status-line of the screen.
      */
@@ -123,4 +142,9 @@ private:
      */
     std::unordered_map<std::string, int> m_colours;
 
+    /**
+     * Are we running without a terminal?
+     */
+    static bool m_headless;
+
 };
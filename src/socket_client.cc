@@ -0,0 +1,219 @@
+/**
+ * socket_client.cc - A client connected to our domain-socket.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "lua.h"
+#include "socket_client.h"
+#include "socket_protocol.h"
+
+
+/**
+ * Constructor.
+ */
+CSocketClient::CSocketClient( int fd )
+{
+    m_fd       = fd;
+    m_consumed = 0;
+    m_written  = 0;
+    m_started  = false;
+    m_legacy   = false;
+    m_eof      = false;
+    m_failed   = false;
+}
+
+
+/**
+ * Destructor.
+ */
+CSocketClient::~CSocketClient()
+{
+    close( m_fd );
+}
+
+
+/**
+ * Read all available input.
+ */
+void CSocketClient::readable()
+{
+    char buf[16384];
+
+    while( ! m_eof )
+    {
+        ssize_t rval = read( m_fd, buf, sizeof(buf) );
+
+        if ( rval > 0 )
+        {
+            /**
+             * The first byte of a connection tells us whether it is framed.
+             */
+            if ( ! m_started && buf[0] != '\0' )
+                m_legacy = true;
+
+            m_started = true;
+
+            m_input.append( buf, rval );
+            continue;
+        }
+
+        if ( rval < 0 && errno == EINTR )
+            continue;
+        if ( rval < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+            break;
+
+        if ( rval < 0 )
+        {
+            DEBUG_LOG( "CSocketClient::readable - error reading from domain-socket" );
+            m_failed = true;
+            return;
+        }
+
+        m_eof = true;
+    }
+
+    if ( m_legacy )
+    {
+        /**
+         * Raw Lua is executed, in full, once the client is done.
+         */
+        if ( m_eof && ! m_input.empty() )
+        {
+#ifdef LUMAIL_DEBUG
+            DEBUG_LOG( "Read from domain-socket:" + m_input );
+#endif
+            CLua::Instance()->execute( m_input );
+            m_input.clear();
+        }
+        return;
+    }
+
+    process();
+    writable();
+}
+
+
+/**
+ * Run each complete frame in our input buffer.
+ */
+void CSocketClient::process()
+{
+    CLua *lua = CLua::Instance();
+
+    while( m_input.size() - m_consumed >= 4 )
+    {
+        const unsigned char *hdr = (const unsigned char *)m_input.data() + m_consumed;
+        uint32_t len = ( (uint32_t)hdr[0] << 24 ) | ( (uint32_t)hdr[1] << 16 ) |
+                       ( (uint32_t)hdr[2] << 8 )  |   (uint32_t)hdr[3];
+
+        if ( len > LUMAIL_FRAME_MAX )
+        {
+            reply( false, "frame too large" );
+            m_eof = true;
+            break;
+        }
+
+        if ( m_input.size() - m_consumed - 4 < len )
+            break;
+
+        std::string command = m_input.substr( m_consumed + 4, len );
+        m_consumed += 4 + len;
+
+#ifdef LUMAIL_DEBUG
+        DEBUG_LOG( "Read from domain-socket:" + command );
+#endif
+
+        std::string result;
+        bool ok = lua->evaluate( command, result );
+        reply( ok, result );
+    }
+
+    /**
+     * Discard what we've consumed, once it is worth doing so.
+     */
+    if ( m_consumed == m_input.size() )
+    {
+        m_input.clear();
+        m_consumed = 0;
+    }
+    else if ( m_consumed > 65536 )
+    {
+        m_input.erase( 0, m_consumed );
+        m_consumed = 0;
+    }
+}
+
+
+/**
+ * Queue a reply.
+ *
+ * A reply larger than a frame may be is replaced by an error, so that
+ * the first byte of each reply remains zero.
+ */
+void CSocketClient::reply( bool ok, const std::string &text )
+{
+    if ( text.size() + 1 > LUMAIL_FRAME_MAX )
+    {
+        reply( false, "reply too large" );
+        return;
+    }
+
+    uint32_t len = text.size() + 1;
+
+    m_output += (char)( ( len >> 24 ) & 0xFF );
+    m_output += (char)( ( len >> 16 ) & 0xFF );
+    m_output += (char)( ( len >> 8 ) & 0xFF );
+    m_output += (char)( len & 0xFF );
+    m_output += ok ? LUMAIL_REPLY_OK : LUMAIL_REPLY_ERROR;
+    m_output += text;
+}
+
+
+/**
+ * Write as much pending output as the client will accept.
+ */
+void CSocketClient::writable()
+{
+    while( want_write() )
+    {
+        ssize_t rval = send( m_fd, m_output.data() + m_written,
+                             m_output.size() - m_written, MSG_NOSIGNAL );
+
+        if ( rval > 0 )
+        {
+            m_written += rval;
+            continue;
+        }
+
+        if ( rval < 0 && errno == EINTR )
+            continue;
+        if ( rval < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+            return;
+
+        DEBUG_LOG( "CSocketClient::writable - error writing to domain-socket" );
+        m_failed = true;
+        return;
+    }
+
+    m_output.clear();
+    m_written = 0;
+}
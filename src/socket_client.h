@@ -0,0 +1,126 @@
+/**
+ * socket_client.h - A client connected to our domain-socket.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <string>
+
+
+/**
+ * A non-blocking connection to the domain-socket.
+ *
+ * Input is buffered until complete frames are available, each of which
+ * is evaluated and answered.  Replies are buffered until the client is
+ * able to accept them.  See socket_protocol.h for the framing.
+ */
+class CSocketClient
+{
+
+public:
+
+    /**
+     * Constructor.  Take ownership of the given socket.
+     */
+    CSocketClient( int fd );
+
+    /**
+     * Destructor.  Close the socket.
+     */
+    ~CSocketClient();
+
+    /**
+     * The socket.
+     */
+    int fd() { return m_fd; }
+
+    /**
+     * Read all available input, running each complete command.
+     */
+    void readable();
+
+    /**
+     * Write as much pending output as the client will accept.
+     */
+    void writable();
+
+    /**
+     * Do we have output the client hasn't yet accepted?
+     */
+    bool want_write() { return( m_written < m_output.size() ); }
+
+    /**
+     * Is the client still sending?
+     */
+    bool want_read() { return( !m_eof ); }
+
+    /**
+     * Is this connection finished with, and ready to be closed?
+     */
+    bool finished() { return( m_failed || ( m_eof && !want_write() ) ); }
+
+private:
+
+    /**
+     * Run each complete frame in our input buffer.
+     */
+    void process();
+
+    /**
+     * Queue a reply.
+     */
+    void reply( bool ok, const std::string &text );
+
+private:
+
+    /**
+     * The socket.
+     */
+    int m_fd;
+
+    /**
+     * Buffered input, and the offset of the first unprocessed byte.
+     */
+    std::string m_input;
+    size_t m_consumed;
+
+    /**
+     * Buffered output, and the number of bytes of it already written.
+     */
+    std::string m_output;
+    size_t m_written;
+
+    /**
+     * Have we received anything yet?
+     */
+    bool m_started;
+
+    /**
+     * Is this a client sending raw, unframed, Lua?
+     */
+    bool m_legacy;
+
+    /**
+     * Has the client finished sending?
+     */
+    bool m_eof;
+
+    /**
+     * Has the connection failed?
+     */
+    bool m_failed;
+};
@@ -0,0 +1,48 @@
+/**
+ * socket_protocol.h - The framing used upon the domain-socket.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+
+/**
+ * Clients send a series of frames, each a 32-bit big-endian length
+ * followed by that many bytes of Lua.  Many frames may be sent without
+ * waiting for replies.
+ *
+ * Each frame receives a reply, in order, framed in the same way.  The
+ * first byte of the reply is LUMAIL_REPLY_OK or LUMAIL_REPLY_ERROR, and
+ * the remainder is the value(s) returned by the Lua, or the error.
+ *
+ * A client whose first byte is not zero, which no frame can begin with,
+ * is taken to be sending raw Lua - as older versions of lumailctl, and
+ * socat, do.  That Lua is executed once the client disconnects, and no
+ * reply is sent.
+ */
+
+
+/**
+ * The largest frame we accept, this keeps the first byte zero.
+ */
+#define LUMAIL_FRAME_MAX ( ( 1 << 24 ) - 1 )
+
+
+/**
+ * The status which prefixes each reply.
+ */
+#define LUMAIL_REPLY_OK    '+'
+#define LUMAIL_REPLY_ERROR '-'
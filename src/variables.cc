@@ -34,6 +34,7 @@
 #include "debug.h"
 #include "file.h"
 #include "global.h"
+#include "header_cache.h"
 #include "history.h"
 #include "maildir.h"
 #include "util.h"
@@ -262,6 +263,27 @@ int global_mode(lua_State * L)
     return( ret );
 }
 
+/**
+ * Get, or set, the directory to cache message-headers beneath.
+ */
+int header_cache(lua_State *L )
+{
+    const char *str = lua_tostring(L, 1);
+
+    int ret = get_set_string_variable( L, "header_cache" );
+
+    /**
+     * Update the cache location.
+     */
+    if ( str != NULL )
+    {
+        CHeaderCache *cache = CHeaderCache::Instance();
+        cache->set_directory( str );
+    }
+
+    return( ret );
+}
+
 /**
  * Get, or set, the history persistance file.
  */
@@ -311,10 +333,10 @@ int index_limit(lua_State * L)
      */
     if ( str != NULL )
     {
-        DEBUG_LOG( "index_limit(" + std::string(str) + ") triggering CGlobal::update_messages" );
+        DEBUG_LOG( "index_limit(" + std::string(str) + ") triggering CGlobal::filter_messages" );
 
         CGlobal *global = CGlobal::Instance();
-        global->update_messages();
+        global->filter_messages();
         global->set_message_offset(0);
     }
 
@@ -331,6 +353,22 @@ int mail_filter(lua_State * L)
     return( get_set_string_variable(L, "mail_filter" ) );
 }
 
+/**
+ * Get, or set, the number of parsed messages to retain.
+ */
+int message_cache_entries(lua_State * L)
+{
+    return( get_set_string_variable(L, "message_cache_entries" ) );
+}
+
+/**
+ * Get, or set, the total size of the parsed messages to retain.
+ */
+int message_cache_size(lua_State * L)
+{
+    return( get_set_string_variable(L, "message_cache_size" ) );
+}
+
 /**
  * The format-string for maildir-display.
  */
@@ -430,19 +468,14 @@ int sort(lua_State * L)
     int ret = get_set_string_variable( L, "sort" );
 
     /**
-     * Update the selected massages.
+     * Reorder the selected messages.  The current message is retained
+     * so there is no need to reset the message offset.
      */
     if ( str != NULL )
     {
-        DEBUG_LOG( "sort(" + std::string(str) + ") triggering CGlobal::update_messages" );
+        DEBUG_LOG( "sort(" + std::string(str) + ") triggering CGlobal::resort_messages" );
         CGlobal *global = CGlobal::Instance();
-        global->update_messages();
-
-        /**
-         * Reset the message offset because the current message
-         * has probably changed.
-         */
-        global->set_message_offset(0);
+        global->resort_messages();
     }
     return ret;
 
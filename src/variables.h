@@ -53,10 +53,13 @@ int display_filter(lua_State * L);
 int editor(lua_State * L);
 int from(lua_State * L);
 int global_mode(lua_State * L);
+int header_cache(lua_State *L);
 int history_file(lua_State *L);
 int index_format(lua_State * L);
 int index_limit(lua_State * L);
 int mail_filter(lua_State * L);
+int message_cache_entries(lua_State * L);
+int message_cache_size(lua_State * L);
 int maildir_format(lua_State *L );
 int maildir_limit(lua_State * L);
 int maildir_prefix(lua_State * L);
@@ -0,0 +1,250 @@
+/**
+ * watcher.cc - Watch maildirs for changes, via inotify.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <unordered_set>
+#include <unistd.h>
+
+#ifdef INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "debug.h"
+#include "watcher.h"
+
+
+/**
+ * The events which indicate the contents of a directory changed.
+ */
+#ifdef INOTIFY
+#define WATCH_EVENTS ( IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF )
+#endif
+
+
+/**
+ * Instance-handle.
+ */
+CWatcher *CWatcher::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CWatcher *CWatcher::Instance()
+{
+    if (!pinstance)
+        pinstance = new CWatcher;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is private as this class is a singleton.
+ */
+CWatcher::CWatcher()
+{
+    m_fd      = -1;
+    m_counter = 0;
+
+#ifdef INOTIFY
+    m_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+
+    if ( m_fd < 0 )
+        DEBUG_LOG( "CWatcher::CWatcher - inotify unavailable" );
+#endif
+}
+
+
+/**
+ * The file-descriptor to poll for events, or -1 if unavailable.
+ */
+int CWatcher::fd()
+{
+    return( m_fd );
+}
+
+
+/**
+ * Update the set of maildirs which we're watching.
+ */
+void CWatcher::watch_maildirs( std::vector<std::string> paths )
+{
+    if ( m_fd < 0 )
+        return;
+
+    std::unordered_set<std::string> wanted( paths.begin(), paths.end() );
+
+    /**
+     * Stop watching maildirs which have gone away.
+     */
+    std::vector<std::string> stale;
+    for (auto it = m_generations.begin(); it != m_generations.end(); ++it)
+    {
+        if ( wanted.find( it->first ) == wanted.end() )
+            stale.push_back( it->first );
+    }
+    for (std::string path : stale)
+        remove_watch( path );
+
+    /**
+     * Start watching new ones.
+     */
+    for (std::string path : paths)
+    {
+        if ( m_generations.find( path ) == m_generations.end() )
+            add_watch( path );
+    }
+}
+
+
+/**
+ * Get the generation-number of the given maildir.
+ */
+bool CWatcher::generation( const std::string &maildir, unsigned long &gen )
+{
+    std::unordered_map<std::string, unsigned long>::iterator it = m_generations.find( maildir );
+    if ( it == m_generations.end() )
+        return false;
+
+    gen = it->second;
+    return true;
+}
+
+
+/**
+ * Read any pending events, without blocking.
+ */
+std::vector<std::string> CWatcher::process()
+{
+    std::vector<std::string> changed;
+
+#ifdef INOTIFY
+    if ( m_fd < 0 )
+        return( changed );
+
+    std::unordered_set<std::string> seen;
+
+    char buf[16384] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while( true )
+    {
+        ssize_t len = read( m_fd, buf, sizeof(buf) );
+        if ( len <= 0 )
+            break;
+
+        for( char *ptr = buf; ptr < buf + len; )
+        {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            /**
+             * If we lost events then everything might have changed.
+             */
+            if ( event->mask & IN_Q_OVERFLOW )
+            {
+                DEBUG_LOG( "CWatcher::process - event queue overflowed" );
+
+                for (auto it = m_generations.begin(); it != m_generations.end(); ++it)
+                {
+                    it->second = ++m_counter;
+                    if ( seen.insert( it->first ).second )
+                        changed.push_back( it->first );
+                }
+                continue;
+            }
+
+            std::unordered_map<int, std::string>::iterator it = m_watches.find( event->wd );
+            if ( it == m_watches.end() )
+                continue;
+
+            std::string maildir = it->second;
+
+            /**
+             * The kernel removed the watch, so the directory is gone.
+             * Stop watching the maildir entirely, so callers fall back
+             * to its modification times until it is watched again.
+             */
+            if ( event->mask & IN_IGNORED )
+                remove_watch( maildir );
+            else
+                m_generations[maildir] = ++m_counter;
+
+            if ( seen.insert( maildir ).second )
+                changed.push_back( maildir );
+        }
+    }
+#endif
+
+    return( changed );
+}
+
+
+/**
+ * Start watching the cur/ + new/ directories of the given maildir.
+ */
+bool CWatcher::add_watch( const std::string &maildir )
+{
+#ifdef INOTIFY
+    int cur = inotify_add_watch( m_fd, std::string( maildir + "/cur" ).c_str(), WATCH_EVENTS );
+    if ( cur < 0 )
+    {
+        DEBUG_LOG( "CWatcher::add_watch - failed to watch " + maildir );
+        return false;
+    }
+
+    int nw = inotify_add_watch( m_fd, std::string( maildir + "/new" ).c_str(), WATCH_EVENTS );
+    if ( nw < 0 )
+    {
+        DEBUG_LOG( "CWatcher::add_watch - failed to watch " + maildir );
+        inotify_rm_watch( m_fd, cur );
+        return false;
+    }
+
+    m_watches[cur] = maildir;
+    m_watches[nw]  = maildir;
+    m_generations[maildir] = ++m_counter;
+    return true;
+#else
+    (void)maildir;
+    return false;
+#endif
+}
+
+
+/**
+ * Stop watching the given maildir.
+ */
+void CWatcher::remove_watch( const std::string &maildir )
+{
+#ifdef INOTIFY
+    for (auto it = m_watches.begin(); it != m_watches.end(); )
+    {
+        if ( it->second == maildir )
+        {
+            inotify_rm_watch( m_fd, it->first );
+            it = m_watches.erase( it );
+        }
+        else
+            ++it;
+    }
+#endif
+
+    m_generations.erase( maildir );
+}
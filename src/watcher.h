@@ -0,0 +1,115 @@
+/**
+ * watcher.h - Watch maildirs for changes, via inotify.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+/**
+ * A singleton class which watches the cur/ and new/ directories of
+ * every known maildir, and records when they change.
+ *
+ * Each watched maildir has a generation-number which changes whenever
+ * the kernel reports a change beneath it, so callers can determine
+ * whether their cached state is current without touching the
+ * filesystem.  Generations are drawn from a single counter, so a
+ * maildir which is watched afresh never reuses an old number.
+ *
+ * If inotify isn't available, or a maildir couldn't be watched, then
+ * callers must fall back to checking the modification times themselves.
+ */
+class CWatcher
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CWatcher *Instance();
+
+    /**
+     * The file-descriptor to poll for events, or -1 if unavailable.
+     */
+    int fd();
+
+    /**
+     * Update the set of maildirs which we're watching.
+     */
+    void watch_maildirs( std::vector<std::string> paths );
+
+    /**
+     * Get the generation-number of the given maildir.
+     *
+     * Returns false if the maildir isn't being watched.
+     */
+    bool generation( const std::string &maildir, unsigned long &gen );
+
+    /**
+     * Read any pending events, without blocking.
+     *
+     * Returns the maildirs which have changed.
+     */
+    std::vector<std::string> process();
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CWatcher();
+    CWatcher(const CWatcher &);
+    CWatcher & operator=(const CWatcher &);
+
+private:
+
+    /**
+     * Start/Stop watching a single maildir.
+     */
+    bool add_watch( const std::string &maildir );
+    void remove_watch( const std::string &maildir );
+
+    /**
+     * The single instance of this class.
+     */
+    static CWatcher *pinstance;
+
+    /**
+     * The inotify handle.
+     */
+    int m_fd;
+
+    /**
+     * The maildir each watch-descriptor belongs to.
+     */
+    std::unordered_map<int, std::string> m_watches;
+
+    /**
+     * The generation of each watched maildir.
+     */
+    std::unordered_map<std::string, unsigned long> m_generations;
+
+    /**
+     * The most recent generation handed out, to any maildir.
+     */
+    unsigned long m_counter;
+
+};
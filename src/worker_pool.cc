@@ -0,0 +1,293 @@
+/**
+ * worker_pool.cc - Background threads, and results applied on the main thread.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "worker_pool.h"
+
+
+/**
+ * The index of the worker running upon this thread, or -1 for the
+ * main thread.
+ */
+static thread_local int t_worker = -1;
+
+
+/**
+ * Instance-handle.
+ */
+CWorkerPool *CWorkerPool::pinstance = NULL;
+
+
+/**
+ * Get access to our singleton-object.
+ */
+CWorkerPool *CWorkerPool::Instance()
+{
+    if (!pinstance)
+        pinstance = new CWorkerPool;
+
+    return pinstance;
+}
+
+
+/**
+ * Constructor - This is protected as this class is a singleton.
+ */
+CWorkerPool::CWorkerPool()
+{
+    m_queued      = 0;
+    m_outstanding = 0;
+    m_stopping    = false;
+    m_event       = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+}
+
+
+/**
+ * Start the worker threads.
+ */
+void CWorkerPool::start( size_t threads )
+{
+    if ( ! m_threads.empty() )
+        return;
+
+    if ( threads == 0 )
+        threads = std::max( 2u, std::thread::hardware_concurrency() );
+
+    for( size_t i = 0; i < threads; i++ )
+        m_queues.push_back( std::unique_ptr<CWorkerQueue>( new CWorkerQueue ) );
+
+    /**
+     * The workers inherit our signal-mask, and the signals the event-loop
+     * handles should be delivered to the main thread rather than to them.
+     */
+    sigset_t all, old;
+    sigfillset( &all );
+    pthread_sigmask( SIG_BLOCK, &all, &old );
+
+    for( size_t i = 0; i < threads; i++ )
+        m_threads.push_back( std::thread( &CWorkerPool::worker, this, i ) );
+
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+
+    DEBUG_LOG( "CWorkerPool::start - " + std::to_string( threads ) + " threads" );
+}
+
+
+/**
+ * Stop the worker threads.
+ */
+void CWorkerPool::stop()
+{
+    if ( m_threads.empty() )
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard( m_sleep_lock );
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread &t : m_threads)
+        t.join();
+
+    m_threads.clear();
+    m_queues.clear();
+    m_shared.jobs.clear();
+    m_queued      = 0;
+    m_outstanding = 0;
+    m_stopping    = false;
+
+    std::lock_guard<std::mutex> guard( m_done_lock );
+    m_done.clear();
+
+    uint64_t count;
+    int result __attribute__((unused));
+    result = read( m_event, &count, sizeof(count) );
+}
+
+
+/**
+ * Queue work for a worker thread, and its completion.
+ */
+void CWorkerPool::submit( std::function<void()> work, std::function<void()> done )
+{
+    /**
+     * Without workers there is nothing to be gained by waiting.
+     */
+    if ( m_threads.empty() )
+    {
+        work();
+        if ( done )
+            done();
+        return;
+    }
+
+    m_outstanding += 1;
+
+    std::function<void()> job = [this, work, done]()
+    {
+        work();
+
+        if ( done )
+        {
+            post( [this, done]()
+                  {
+                      done();
+                      m_outstanding -= 1;
+                  } );
+        }
+        else
+        {
+            m_outstanding -= 1;
+        }
+    };
+
+    /**
+     * Jobs submitted by a worker go to its own queue, and the others to
+     * the shared queue, so that they're started in the order submitted.
+     */
+    CWorkerQueue *queue = ( t_worker >= 0 ) ? m_queues[t_worker].get() : &m_shared;
+
+    m_queued += 1;
+
+    {
+        std::lock_guard<std::mutex> guard( queue->lock );
+        queue->jobs.push_back( job );
+    }
+
+    /**
+     * Taking the lock ensures a worker which has just found nothing to do
+     * is either asleep, and will be woken, or will see the new job.
+     */
+    {
+        std::lock_guard<std::mutex> guard( m_sleep_lock );
+    }
+    m_wake.notify_one();
+}
+
+
+/**
+ * Queue a function to run upon the main thread.
+ */
+void CWorkerPool::post( std::function<void()> done )
+{
+    {
+        std::lock_guard<std::mutex> guard( m_done_lock );
+        m_done.push_back( done );
+    }
+
+    uint64_t one = 1;
+    if ( write( m_event, &one, sizeof(one) ) != sizeof(one) )
+        DEBUG_LOG( "CWorkerPool::post - failed to signal the main thread" );
+}
+
+
+/**
+ * Run all the queued completions.
+ */
+size_t CWorkerPool::complete()
+{
+    uint64_t count;
+    int result __attribute__((unused));
+    result = read( m_event, &count, sizeof(count) );
+
+    std::vector<std::function<void()> > done;
+    {
+        std::lock_guard<std::mutex> guard( m_done_lock );
+        done.swap( m_done );
+    }
+
+    /**
+     * Completions may queue more work, or more completions, which will
+     * be handled next time around.
+     */
+    for (std::function<void()> &fn : done)
+        fn();
+
+    return( done.size() );
+}
+
+
+/**
+ * The body of each worker thread.
+ */
+void CWorkerPool::worker( size_t index )
+{
+    t_worker = index;
+
+    while( ! m_stopping )
+    {
+        std::function<void()> job;
+
+        if ( take( index, job ) )
+        {
+            job();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard( m_sleep_lock );
+        m_wake.wait( guard, [this]() { return( m_stopping || m_queued > 0 ); } );
+    }
+}
+
+
+/**
+ * Take a job: the newest from our own queue, else the oldest from the
+ * shared queue, else the oldest from another worker.
+ */
+bool CWorkerPool::take( size_t index, std::function<void()> &job )
+{
+    size_t count = m_queues.size();
+
+    for( size_t i = 0; i <= count; i++ )
+    {
+        CWorkerQueue *queue;
+        if ( i == 0 )
+            queue = m_queues[index].get();
+        else if ( i == 1 )
+            queue = &m_shared;
+        else
+            queue = m_queues[( index + i - 1 ) % count].get();
+
+        std::lock_guard<std::mutex> guard( queue->lock );
+        if ( queue->jobs.empty() )
+            continue;
+
+        if ( i == 0 )
+        {
+            job = queue->jobs.back();
+            queue->jobs.pop_back();
+        }
+        else
+        {
+            job = queue->jobs.front();
+            queue->jobs.pop_front();
+        }
+
+        m_queued -= 1;
+        return true;
+    }
+
+    return false;
+}
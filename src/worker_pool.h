@@ -0,0 +1,178 @@
+/**
+ * worker_pool.h - Background threads, and results applied on the main thread.
+ *
+ * This file is part of lumail: http://lumail.org/
+ *
+ * Copyright (c) 2014 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * A singleton pool of worker threads.
+ *
+ * Jobs are split into two halves: the work, which runs upon a worker
+ * thread, and an optional completion which runs upon the main thread
+ * once the work has finished.  The work must not touch Lua, curses, or
+ * CGlobal - anything it produces is handed to the completion, which may.
+ *
+ * Jobs submitted from the main thread are taken, oldest first, from a
+ * single shared queue.  Jobs a worker submits itself go to its own
+ * queue, from which it takes the newest first; when both are empty a
+ * worker steals the oldest job from another worker's queue.
+ *
+ * Completions are queued until the main thread calls complete(), which
+ * the event-loop does whenever fd() becomes readable.
+ */
+class CWorkerPool
+{
+
+public:
+
+    /**
+     * Get access to the singleton instance.
+     */
+    static CWorkerPool *Instance();
+
+    /**
+     * Start the worker threads, if they're not already running.
+     */
+    void start( size_t threads = 0 );
+
+    /**
+     * Stop the worker threads, once they have finished their current job.
+     *
+     * Jobs which haven't been started are discarded, as are completions
+     * which haven't been run.
+     */
+    void stop();
+
+    /**
+     * Queue work to run upon a worker thread, and optionally a function
+     * to run upon the main thread once it has finished.
+     *
+     * If the pool isn't running both are run immediately.
+     */
+    void submit( std::function<void()> work, std::function<void()> done = nullptr );
+
+    /**
+     * Queue a function to run upon the main thread.
+     */
+    void post( std::function<void()> done );
+
+    /**
+     * Run all the queued completions.  This must only be called from the
+     * main thread.  Returns the number run.
+     */
+    size_t complete();
+
+    /**
+     * A descriptor which is readable while completions are queued.
+     */
+    int fd() { return m_event; }
+
+    /**
+     * The number of jobs submitted whose completion hasn't yet run.
+     */
+    size_t outstanding() { return m_outstanding; }
+
+    /**
+     * The number of worker threads.
+     */
+    size_t size() { return m_threads.size(); }
+
+protected:
+
+    /**
+     * Protected functions to allow our singleton implementation.
+     */
+    CWorkerPool();
+    CWorkerPool(const CWorkerPool &);
+    CWorkerPool & operator=(const CWorkerPool &);
+
+private:
+
+    /**
+     * The body of each worker thread.
+     */
+    void worker( size_t index );
+
+    /**
+     * Take a job for the given worker, from its own queue, the shared
+     * queue, or another worker's queue.
+     */
+    bool take( size_t index, std::function<void()> &job );
+
+private:
+
+    /**
+     * A queue of jobs belonging to a single worker.
+     */
+    struct CWorkerQueue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()> > jobs;
+    };
+
+    /**
+     * The single instance of this class.
+     */
+    static CWorkerPool *pinstance;
+
+    /**
+     * The worker threads, and their queues.
+     */
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<CWorkerQueue> > m_queues;
+
+    /**
+     * The jobs submitted from the main thread.
+     */
+    CWorkerQueue m_shared;
+
+    /**
+     * The number of jobs queued, but not yet taken by a worker.
+     */
+    std::atomic<size_t> m_queued;
+
+    /**
+     * The number of jobs whose completion hasn't yet run.
+     */
+    std::atomic<size_t> m_outstanding;
+
+    /**
+     * Idle workers sleep upon this, until jobs are queued or we stop.
+     */
+    std::mutex m_sleep_lock;
+    std::condition_variable m_wake;
+    std::atomic<bool> m_stopping;
+
+    /**
+     * The completions awaiting the main thread, and the eventfd which
+     * signals them.
+     */
+    std::mutex m_done_lock;
+    std::vector<std::function<void()> > m_done;
+    int m_event;
+
+};
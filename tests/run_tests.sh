@@ -18,15 +18,11 @@ run_rc() {
     cp -r folders output/folders
 
     set +e  # Temporarily allow errors (which we'll capture).
-      OUTFILE="${stdoutfile}" "${LUMAIL}" --nodefault --rcfile "testsetup.lua" --rcfile "${rc}" --eval "exit()"
+      OUTFILE="${stdoutfile}" "${LUMAIL}" --headless --nodefault --rcfile "testsetup.lua" --rcfile "${rc}" --eval "exit()" < /dev/null
       result="$?"
     set -e
 
     echo "Exit: $result" >> "${stdoutfile}"
-    # If it didn't exit nicely, reset the terminal
-    if [ $result -ne 0 ]; then
-        stty sane ; reset
-    fi
 
     set +e
     diff -u "${expectfile}" "${stdoutfile}"
@@ -6,6 +6,13 @@
  *
  *     echo "alert('ok');" | socat - UNIX-CLIENT:/tmp/foo.sock
  *
+ * Unlike socat the commands are framed, as described in socket_protocol.h,
+ * so any value they return, or any error they raise, is shown.
+ *
+ * In batch mode each line of the given file, or of STDIN if the file is
+ * "-", is sent as a separate command over a single connection without
+ * waiting for the replies - which are read as they arrive.
+ *
  * Steve
  * --
  */
@@ -13,6 +20,9 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -20,8 +30,234 @@
 #include <getopt.h>
 
 
+#include "socket_protocol.h"
 #include "version.h"
 
+
+/**
+ * A growable buffer.
+ */
+struct buffer
+{
+  char *data;
+  size_t size;
+  size_t used;
+};
+
+
+/**
+ * Append to a buffer.
+ */
+void buffer_append(struct buffer *b, const char *data, size_t len)
+{
+  if ( b->used + len > b->size )
+  {
+      b->size = ( b->used + len ) * 2;
+      b->data = realloc( b->data, b->size );
+      if ( b->data == NULL )
+      {
+          perror( "realloc" );
+          exit(-1);
+      }
+  }
+  memcpy( b->data + b->used, data, len );
+  b->used += len;
+}
+
+
+/**
+ * Append a single command, as a frame, to the buffer.
+ */
+void append_frame(struct buffer *b, const char *lua, size_t len)
+{
+  unsigned char hdr[4];
+
+  if ( len > LUMAIL_FRAME_MAX )
+  {
+      fprintf( stderr, "Command too large: %lu bytes\n", (unsigned long)len );
+      exit(-1);
+  }
+
+  hdr[0] = ( len >> 24 ) & 0xFF;
+  hdr[1] = ( len >> 16 ) & 0xFF;
+  hdr[2] = ( len >> 8 ) & 0xFF;
+  hdr[3] = len & 0xFF;
+
+  buffer_append( b, (const char *)hdr, 4 );
+  buffer_append( b, lua, len );
+}
+
+
+/**
+ * Read the commands from the given file, one per line, into the buffer.
+ *
+ * Blank lines, and Lua comments, are skipped.  Returns the number of
+ * commands read.
+ */
+int read_batch(const char *file, struct buffer *b)
+{
+  FILE *fp = ( strcmp( file, "-" ) == 0 ) ? stdin : fopen( file, "r" );
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int count = 0;
+
+  if ( fp == NULL )
+  {
+      fprintf( stderr, "Failed to open %s: %s\n", file, strerror(errno) );
+      exit(-1);
+  }
+
+  while ( ( len = getline( &line, &size, fp ) ) != -1 )
+  {
+      char *start = line;
+
+      while ( len > 0 && ( line[len-1] == '\n' || line[len-1] == '\r' ) )
+          line[--len] = '\0';
+
+      while ( *start == ' ' || *start == '\t' )
+          start++;
+
+      if ( *start == '\0' || strncmp( start, "--", 2 ) == 0 )
+          continue;
+
+      append_frame( b, line, len );
+      count += 1;
+  }
+
+  free( line );
+  if ( fp != stdin )
+      fclose( fp );
+
+  return count;
+}
+
+
+/**
+ * Show every complete reply in the buffer, consuming them.
+ *
+ * Returns the number of replies shown, and increments *errors for each
+ * which reported a failure.
+ */
+int show_replies(struct buffer *b, int *errors)
+{
+  size_t offset = 0;
+  int count = 0;
+
+  while ( b->used - offset >= 4 )
+  {
+      const unsigned char *hdr = (const unsigned char *)b->data + offset;
+      uint32_t len = ( (uint32_t)hdr[0] << 24 ) | ( (uint32_t)hdr[1] << 16 ) |
+                     ( (uint32_t)hdr[2] << 8 ) | (uint32_t)hdr[3];
+
+      /**
+       * No valid reply is this large, so we've lost the framing.
+       */
+      if ( len > LUMAIL_FRAME_MAX )
+      {
+          fprintf( stderr, "Reply too large: %lu bytes\n", (unsigned long)len );
+          exit(-1);
+      }
+
+      if ( b->used - offset - 4 < len )
+          break;
+
+      if ( len > 0 )
+      {
+          const char *text = b->data + offset + 5;
+          int tlen = (int)len - 1;
+
+          if ( b->data[offset + 4] == LUMAIL_REPLY_ERROR )
+          {
+              fprintf( stderr, "%.*s\n", tlen, text );
+              *errors += 1;
+          }
+          else if ( tlen > 0 )
+          {
+              printf( "%.*s\n", tlen, text );
+          }
+      }
+
+      offset += 4 + len;
+      count += 1;
+  }
+
+  memmove( b->data, b->data + offset, b->used - offset );
+  b->used -= offset;
+
+  return count;
+}
+
+
+/**
+ * Send all the framed commands, reading the replies as they arrive.
+ *
+ * Returns the number of commands which failed.
+ */
+int converse(int fd, struct buffer *out, int expected)
+{
+  struct buffer in = { NULL, 0, 0 };
+  size_t written = 0;
+  int received = 0;
+  int errors = 0;
+
+  while ( received < expected )
+  {
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN | ( ( written < out->used ) ? POLLOUT : 0 );
+      pfd.revents = 0;
+
+      if ( poll( &pfd, 1, -1 ) < 0 )
+      {
+          if ( errno == EINTR )
+              continue;
+          perror( "poll" );
+          exit(-1);
+      }
+
+      if ( pfd.revents & POLLOUT )
+      {
+          ssize_t rc = send( fd, out->data + written, out->used - written, MSG_NOSIGNAL );
+          if ( rc < 0 && errno != EINTR && errno != EAGAIN )
+          {
+              perror( "Error writing to the domain-socket" );
+              exit(-1);
+          }
+          if ( rc > 0 )
+              written += rc;
+      }
+
+      if ( pfd.revents & ( POLLIN | POLLHUP | POLLERR ) )
+      {
+          char tmp[16384];
+          ssize_t rc = read( fd, tmp, sizeof(tmp) );
+
+          if ( rc < 0 && errno != EINTR && errno != EAGAIN )
+          {
+              perror( "Error reading from the domain-socket" );
+              exit(-1);
+          }
+          if ( rc == 0 )
+          {
+              fprintf( stderr, "The domain-socket closed after %d of %d replies\n",
+                       received, expected );
+              exit(-1);
+          }
+          if ( rc > 0 )
+          {
+              buffer_append( &in, tmp, rc );
+              received += show_replies( &in, &errors );
+              fflush( stdout );
+          }
+      }
+  }
+
+  free( in.data );
+  return errors;
+}
+
+
 /**
  * Entry point.
  */
@@ -29,12 +265,14 @@ int main(int argc, char *argv[])
 {
   struct sockaddr_un addr;
   struct stat sb;
+  struct buffer out = { NULL, 0, 0 };
   int fd;
-  size_t rc;
+  int count;
 
   char tmp[1024];
   char *soc;
-  char *lua;
+  char *lua = NULL;
+  char *batch = NULL;
   int show_version = 0;
 
   /**
@@ -44,6 +282,7 @@ int main(int argc, char *argv[])
   {
       static struct option long_options[] =
           {
+              {"batch", required_argument, 0, 'b'},
               {"version", no_argument, 0, 'v'},
               {0, 0, 0, 0}
           };
@@ -51,7 +290,7 @@ int main(int argc, char *argv[])
       /* getopt_long stores the option index here. */
       int option_index = 0;
 
-      char c = getopt_long(argc, argv, "v", long_options, &option_index);
+      int c = getopt_long(argc, argv, "b:v", long_options, &option_index);
 
       /* Detect the end of the options. */
       if (c == -1)
@@ -59,6 +298,9 @@ int main(int argc, char *argv[])
 
       switch (c)
       {
+        case 'b':
+            batch = optarg;
+            break;
         case 'v':
             show_version = 1;
             break;
@@ -78,27 +320,48 @@ int main(int argc, char *argv[])
       exit(1);
   }
 
+  memset( tmp, '\0', sizeof(tmp));
+  snprintf( tmp, sizeof(tmp)-1, "%s/.lumail.sock", getenv( "HOME" ) );
+  soc = tmp;
 
-  if ( argc == 2 )
+  if ( batch != NULL && argc - optind <= 1 )
   {
-      memset( tmp, '\0', sizeof(tmp));
-      snprintf( tmp, sizeof(tmp)-1, "%s/.lumail.sock", getenv( "HOME" ) );
-
-      soc =  tmp;
-      lua = argv[1];
+      if ( argc - optind == 1 )
+          soc = argv[optind];
   }
-  else if ( argc == 3 )
+  else if ( batch == NULL && argc - optind == 1 )
   {
-      soc = argv[1];
-      lua = argv[2];
+      lua = argv[optind];
+  }
+  else if ( batch == NULL && argc - optind == 2 )
+  {
+      soc = argv[optind];
+      lua = argv[optind + 1];
   }
   else
   {
       fprintf(stderr,"Usage: %s [socket/path] 'lua code'\n", argv[0]);
+      fprintf(stderr,"       %s --batch file [socket/path]\n", argv[0]);
       exit(0);
   }
 
 
+  /**
+   * Prepare the command(s).
+   */
+  if ( batch != NULL )
+  {
+      count = read_batch( batch, &out );
+      if ( count == 0 )
+          return 0;
+  }
+  else
+  {
+      append_frame( &out, lua, strlen(lua) );
+      count = 1;
+  }
+
+
   /**
    * Ensure the socket exists.
    */
@@ -131,20 +394,15 @@ int main(int argc, char *argv[])
   }
 
   /**
-   * Write the data to the socket.
+   * Send the command(s) and show the replies.
    */
-  if ((rc = (size_t)write(fd, lua, strlen(lua))) != strlen(lua) )
-  {
-      if (rc > 0)
-      {
-          fprintf(stderr,"Partial write performed on the domain-socket");
-      }
-  }
+  int errors = converse( fd, &out, count );
 
   /**
    * Cleanup.
    */
   close( fd );
+  free( out.data );
 
-  return 0;
+  return ( errors > 0 ) ? 1 : 0;
 }